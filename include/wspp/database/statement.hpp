@@ -65,9 +65,7 @@ public:
         exec() ;
     }
 
-    void exec() {
-        stmt_->exec() ;
-    }
+    void exec() ;
 
 protected:
 
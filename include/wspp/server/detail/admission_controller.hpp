@@ -0,0 +1,78 @@
+#ifndef HTTP_SERVER_ADMISSION_CONTROLLER_HPP
+#define HTTP_SERVER_ADMISSION_CONTROLLER_HPP
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <wspp/server/server_options.hpp>
+
+namespace wspp {
+namespace server {
+
+/// Snapshot of the admission controller state.
+struct AdmissionStats {
+    std::size_t in_flight_ ;    // requests admitted and still being handled
+    std::size_t max_loop_lag_ ; // largest lag of an event loop at its last measurement, in milliseconds
+    std::size_t admitted_ ;     // requests admitted since startup
+    std::size_t rejected_ ;     // requests refused with 503 since startup
+};
+
+namespace detail {
+
+/// Decides whether a parsed request is handled or refused because the server is overloaded. Load is measured as the
+/// number of requests being handled and as the lag of the event loop that received the request, i.e. how late a
+/// periodic timer on that loop fires.
+class admission_controller
+        : private boost::noncopyable
+{
+public:
+    /// Construct with the limits of options for the given number of event loops.
+    admission_controller(const ServerOptions &options, std::size_t num_loops);
+
+    /// Start measuring the lag of an event loop. The lag is measured, and exported as a metric, even when no lag
+    /// limit is set.
+    void monitor(boost::asio::io_service &io_service, std::size_t loop_index);
+
+    /// Lag of an event loop at its last measurement, in milliseconds.
+    std::size_t loop_lag(std::size_t loop_index) const;
+
+    /// Admit a request received on the given loop. Each admitted request has to be released once handled.
+    bool admit(std::size_t loop_index);
+
+    /// An admitted request has been handled.
+    void release();
+
+    /// Complete 503 response, with Retry-After, sent instead of handling a refused request.
+    const std::string &overload_response() const { return overload_response_ ; }
+
+    AdmissionStats stats() const;
+
+private:
+
+    /// Timer firing periodically on an event loop and the lag measured by it.
+    struct probe {
+        explicit probe(boost::asio::io_service &io_service): timer_(io_service), lag_(0) {}
+
+        boost::asio::deadline_timer timer_ ;
+        std::atomic<std::size_t> lag_ ;
+    };
+
+    void schedule(probe &p);
+
+    std::size_t max_in_flight_, max_loop_lag_ ;
+    std::string overload_response_ ;
+
+    std::vector<std::unique_ptr<probe>> probes_ ;
+    std::atomic<std::size_t> in_flight_, admitted_, rejected_ ;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
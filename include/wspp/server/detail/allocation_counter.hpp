@@ -0,0 +1,32 @@
+#ifndef HTTP_SERVER_ALLOCATION_COUNTER_HPP
+#define HTTP_SERVER_ALLOCATION_COUNTER_HPP
+
+#include <cstdint>
+
+namespace wspp {
+namespace server {
+
+/// Heap allocations made while serving requests. Counting replaces the global operator new and is only compiled in
+/// when building with -DWSPP_COUNT_ALLOCATIONS; otherwise all values are zero.
+struct AllocationStats {
+    std::uint64_t requests_ ;        // requests measured
+    std::uint64_t allocations_ ;     // allocations made parsing, handling and writing them
+    std::uint64_t max_allocations_ ; // most allocations made by a single request
+};
+
+namespace detail {
+
+/// Number of heap allocations made so far by the calling thread.
+std::uint64_t thread_allocations() ;
+
+/// Add the allocation count of a finished request to the totals.
+void record_request_allocations(std::uint64_t count) ;
+
+/// Totals since startup.
+AllocationStats allocation_stats() ;
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef HTTP_SERVER_ARENA_HPP
+#define HTTP_SERVER_ARENA_HPP
+
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace wspp {
+namespace server {
+namespace detail {
+
+/// Monotonic memory for request scoped data of a connection. Allocation just bumps a pointer and nothing is freed
+/// until reset(), which keeps the first block for the next requests so that a steady keep-alive connection does not
+/// touch the heap at all.
+class arena
+        : private boost::noncopyable
+{
+public:
+    explicit arena(std::size_t block_size = 4096);
+
+    /// Allocate size bytes aligned for any type.
+    void *allocate(std::size_t size);
+
+    /// Copy a string to the arena.
+    boost::string_ref copy(boost::string_ref src);
+
+    /// Return src followed by data. If src is the last allocation it is extended in place.
+    boost::string_ref append(boost::string_ref src, const char *data, std::size_t size);
+
+    /// Release everything allocated so far.
+    void reset();
+
+    /// True if p points into memory allocated from the arena.
+    bool owns(const char *p) const;
+
+    /// Bytes currently allocated from the arena.
+    std::size_t bytes_used() const { return bytes_used_; }
+
+    /// Number of blocks currently held.
+    std::size_t blocks() const { return blocks_.size(); }
+
+private:
+    char *allocate_block(std::size_t size);
+
+    struct block {
+        std::unique_ptr<char[]> data_;
+        std::size_t size_;
+    };
+
+    std::vector<block> blocks_;
+    std::size_t block_size_, offset_, bytes_used_;
+    const char *last_; // start of the most recent allocation
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
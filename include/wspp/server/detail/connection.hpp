@@ -17,6 +17,12 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+
 #include <wspp/server/response.hpp>
 #include <wspp/server/request.hpp>
 #include <wspp/util/logger.hpp>
@@ -26,6 +32,14 @@
 #include <wspp/server/exceptions.hpp>
 #include <wspp/server/detail/request_parser.hpp>
 #include <wspp/server/detail/connection_manager.hpp>
+#include <wspp/server/detail/worker_pool.hpp>
+#include <wspp/server/detail/arena.hpp>
+#include <wspp/server/detail/allocation_counter.hpp>
+#include <wspp/server/detail/file_sender.hpp>
+#include <wspp/server/detail/admission_controller.hpp>
+#include <wspp/server/detail/http_metrics.hpp>
+#include <wspp/server/detail/request_tracer.hpp>
+#include <wspp/server/server_options.hpp>
 
 namespace wspp { namespace server {
 
@@ -34,8 +48,10 @@ class Server ;
 
 
 using util::Logger ;
+using util::LoggerStream ;
+using util::LogContext ;
 
-extern std::vector<boost::asio::const_buffer> response_to_buffers(Response &rep, bool) ;
+extern void serialize_response_head(const Response &rep, std::string &out) ;
 
 /// Represents a single HttpConnection from a client.
 
@@ -43,123 +59,786 @@ class HttpConnection:
         public boost::enable_shared_from_this<HttpConnection>
 {
 public:
-    explicit HttpConnection(boost::asio::ip::tcp::socket socket,
+    explicit HttpConnection(boost::asio::io_service& io_service,
+                        std::size_t loop_index,
                         ConnectionManager& manager,
-                        FilterChain &handler) : socket_(std::move(socket)),
-        connection_manager_(manager), handler_(handler) {}
+                        const FilterChain &handler,
+                        const ServerOptions &options,
+                        detail::admission_controller &admission,
+                        detail::request_tracer &tracer,
+                        detail::worker_pool *workers = nullptr) : socket_(io_service), loop_index_(loop_index),
+        connection_manager_(manager), handler_(handler), options_(options), admission_(admission), tracer_(tracer), workers_(workers),
+        timer_(socket_.get_io_service()), deadline_(no_deadline), timed_out_(false), arena_(&arenas_[0]), request_parser_(options, arenas_[0]), next_exchange_(0), streaming_(nullptr), file_part_(0), input_offset_(0), input_size_(0),
+        requests_served_(0), keep_alive_(false), pending_handlers_(0), prev_in_loop_(nullptr), next_in_loop_(nullptr),
+        metrics_(detail::http_metrics::get()), id_(next_id()) {}
 
 private:
 
     friend class Server ;
     friend class ConnectionManager ;
 
+    /// A parsed request and its response.
+    struct Exchange {
+        Request request_ ;
+        Response response_ ;
+        bool keep_alive_ = false ; // connection persists after this response
+        bool decoded_ = false ;    // false for malformed requests answered with a stock reply
+        bool refused_ = false ;    // refused by load shedding, answered with the precomputed 503
+        std::uint64_t allocations_ = 0 ; // heap allocations made serving the request (see AllocationStats)
+        std::string head_ ;        // serialized status line and headers, keeps its capacity when the exchange is reused
+        std::chrono::steady_clock::time_point start_ ; // when the request was parsed
+        util::TraceContext trace_ ;       // stages of the request, when tracing is enabled
+        std::chrono::steady_clock::time_point write_start_ ; // when the response was queued for writing
+
+        void clear() {
+            request_.clear() ;
+            response_.clear() ;
+            trace_.clear() ;
+            keep_alive_ = decoded_ = refused_ = false ;
+            allocations_ = 0 ;
+        }
+    };
+
+    // get an exchange for the next request, reusing one from a previous request if possible
+    Exchange &new_exchange() {
+        if ( spare_exchanges_.empty() )
+            exchanges_.emplace_back(new Exchange) ;
+        else {
+            exchanges_.push_back(std::move(spare_exchanges_.back())) ;
+            spare_exchanges_.pop_back() ;
+        }
+        exchanges_.back()->start_ = std::chrono::steady_clock::now() ;
+        return *exchanges_.back() ;
+    }
+
 
+    // called by the connection manager on the event loop that owns the socket. The first request has to arrive
+    // within the header timeout.
 
     void start() {
+        set_deadline(header_deadline, options_.header_timeout_) ;
         read() ;
     }
     void stop() {
-        socket_.close();
+        boost::system::error_code ignored_ec;
+        timer_.cancel(ignored_ec) ;
+        socket_.close(ignored_ec);
     }
 
 
     void read() {
         auto self(this->shared_from_this());
         socket_.async_read_some(boost::asio::buffer(buffer_), [self, this] (boost::system::error_code e, std::size_t bytes_transferred) {
+            if ( timed_out_ ) return ;
+
             if (!e)
             {
-                boost::tribool result;
-                result = request_parser_.parse(buffer_.data(), bytes_transferred);
+                metrics_.received_bytes_.inc(bytes_transferred) ;
+                input_offset_ = 0 ;
+                input_size_ = bytes_transferred ;
 
-                if ( result )
-                {
-                    if ( !request_parser_.decode_message(request_) ) {
-                        response_.stockReply(Response::bad_request);
-                    }
-                    else {
-                        request_.SERVER_.add("REMOTE_ADDR", socket_.remote_endpoint().address().to_string() ) ;
-
-                         try {
-                             handler_.handle(request_, response_) ;
-
-                             if ( response_.status_ != Response::ok )
-                                 response_.stockReply(response_.status_);
-                         }
-                         catch ( HttpResponseException &e  ) {
-
-                            response_.status_ = e.code_ ;
-                            if ( e.reason_.empty() )
-                                response_.stockReply(e.code_);
-                            else {
-                                response_.content_.assign(e.reason_);
-                                response_.setContentType("text/html");
-                                response_.setContentLength() ;
-                            }
-
-                         }
-
-                        catch ( std::runtime_error &e ) {
-                            std::cout << e.what() << std::endl ;
-                            response_.stockReply(Response::internal_server_error) ;
-                        }
-                    }
+                process_input() ;
+            }
+            else if (e != boost::asio::error::operation_aborted)
+            {
+                connection_manager_.stop(self) ;
+            }
 
-                    write(response_to_buffers(response_, request_.method_ == "HEAD")) ;
+        });
+    }
 
-                }
-                else if (!result)
-                {
-                    response_.stockReply(Response::bad_request);
+    // Feed the unconsumed part of the input buffer to the parser. Every complete request found is queued, so that
+    // pipelined requests are answered in order with a single write.
+
+    void process_input() {
 
-                    write(response_to_buffers(response_, request_.method_ == "HEAD")) ;
+        while ( input_offset_ < input_size_ && exchanges_.size() < max_pipelined_responses ) {
 
+            size_t consumed = 0 ;
+            std::uint64_t allocations = detail::thread_allocations() ;
+            std::chrono::steady_clock::time_point parse_start ;
+            if ( tracer_.enabled() ) parse_start = std::chrono::steady_clock::now() ;
+            boost::tribool result = request_parser_.parse(buffer_.data() + input_offset_, input_size_ - input_offset_, consumed);
+            input_offset_ += consumed ;
+
+            if ( result ) {
+                Exchange &ex = new_exchange() ;
+
+                ex.keep_alive_ = request_parser_.should_keep_alive() ;
+
+                // when overloaded do not even decode the request
+                if ( !admission_.admit(loop_index_) ) {
+                    ex.refused_ = true ;
+                    ex.keep_alive_ = false ;
+                }
+                else if ( !request_parser_.decode_message(ex.request_) ) {
+                    admission_.release() ;
+                    ex.keep_alive_ = false ;
+                    ex.response_.stockReply(Response::bad_request);
                 }
-                else
-                {
-                    read() ;
+                else {
+                    ex.decoded_ = true ;
+
+                    boost::system::error_code ec ;
+                    auto endpoint = socket_.remote_endpoint(ec) ;
+                    if ( !ec )
+                        ex.request_.SERVER_.add("REMOTE_ADDR", endpoint.address().to_string() ) ;
+
+                    // the trace starts with the read that completed the request
+                    if ( tracer_.enabled() ) {
+                        ex.trace_.start(parse_start) ;
+                        ex.trace_.add("parse", parse_start, std::chrono::steady_clock::now()) ;
+                    }
                 }
+
+                ++requests_served_ ;
+
+                if ( !options_.keep_alive_ ||
+                     ( options_.max_keep_alive_requests_ && requests_served_ >= options_.max_keep_alive_requests_ ) )
+                    ex.keep_alive_ = false ;
+
+                request_parser_.reset() ;
+
+                ex.allocations_ = detail::thread_allocations() - allocations ;
+
+                // anything sent after a request that closes the connection is discarded
+                if ( !ex.keep_alive_ ) break ;
+            }
+            else if ( !result ) {
+                new_exchange().response_.stockReply(request_parser_.error_status());
+                break ;
+            }
+            else break ;
+        }
+
+        if ( exchanges_.empty() ) {
+            read_more() ;
+            return ;
+        }
+
+        // handlers are not subject to the timeouts
+        cancel_deadline() ;
+
+        keep_alive_ = exchanges_.back()->keep_alive_ ;
+        if ( !keep_alive_ ) input_offset_ = input_size_ ;
+
+        if ( workers_ ) {
+            // run the handlers on the worker pool so that they do not block the event loop
+            if ( tracer_.enabled() ) queued_ = std::chrono::steady_clock::now() ;
+            auto self(this->shared_from_this());
+            workers_->post([this, self]() {
+                handle_requests() ;
+            }) ;
+        }
+        else
+            handle_requests() ;
+    }
+
+    // pass the parsed requests to the filter chain. Filters may finish responses later on other threads, the
+    // responses are written on the loop owning the socket once all requests have been handled.
+
+    void handle_requests() {
+        handling_ = this->shared_from_this() ;
+        pending_handlers_ = 1 ;
+
+        // time spent waiting for a worker thread
+        if ( workers_ && tracer_.enabled() ) {
+            auto now = std::chrono::steady_clock::now() ;
+            for( auto &ex: exchanges_ )
+                if ( ex->decoded_ ) ex->trace_.add("queue", queued_, now) ;
+        }
+
+        for( auto &ex: exchanges_ ) {
+            if ( ex->decoded_ ) {
+                ++pending_handlers_ ;
+                std::uint64_t allocations = detail::thread_allocations() ;
+                handle_request(*ex) ;
+                ex->allocations_ += detail::thread_allocations() - allocations ;
+            }
+        }
+
+        request_handled() ;
+    }
+
+    void request_handled() {
+        if ( --pending_handlers_ ) return ;
+
+        ConnectionPtr self ;
+        self.swap(handling_) ;
+        socket_.get_io_service().dispatch([this, self]() {
+            write() ;
+        }) ;
+    }
+
+    void handle_request(Exchange &ex) {
+
+         Request &request = ex.request_ ;
+         Response &response = ex.response_ ;
+
+         // spans opened by filters and handlers on this thread go to the trace of the request
+         util::TraceContext::Scope trace_scope(tracer_.enabled() ? &ex.trace_ : nullptr) ;
+         util::TraceSpan span("handler") ;
+
+         try {
+             handler_.handle(request, response, [this, &response]() {
+                 if ( response.status_ != Response::ok )
+                     response.stockReply(response.status_);
+
+                 admission_.release() ;
+                 request_handled() ;
+             }) ;
+         }
+         catch ( HttpResponseException &e  ) {
+
+            response.status_ = e.code_ ;
+            if ( e.reason_.empty() )
+                response.stockReply(e.code_);
+            else {
+                response.shared_content_.reset() ;
+                response.content_.assign(e.reason_);
+                response.setContentType("text/html");
+                response.setContentLength() ;
+            }
+
+         }
+
+        // anything else is a bug of the handler, which must not take down the worker thread. The chain has
+        // already called the completion above, releasing the admission slot and the pending handler count.
+        catch ( std::exception &e ) {
+            log_error("Request handler failed", e.what()) ;
+            response.stockReply(Response::internal_server_error) ;
+        }
+        catch ( ... ) {
+            log_error("Request handler failed", "unknown exception") ;
+            response.stockReply(Response::internal_server_error) ;
+        }
+    }
+
+    void log_error(const char *msg, const char *what) {
+        if ( options_.error_logger_ ) {
+            LOG_X_STREAM(*options_.error_logger_, util::Error, msg << ": " << what) ;
+        }
+    }
+
+    // fill in the headers of the response and append it to the output buffers. Returns true if the response body
+    // has to be sent separately after the headers, either streamed from its content generator or from a file.
+
+    bool queue_response(Exchange &ex) {
+
+        if ( ex.refused_ ) {
+            output_buffers_.push_back(boost::asio::buffer(admission_.overload_response())) ;
+            keep_alive_ = false ;
+            return false ;
+        }
+
+        Response &response = ex.response_ ;
+        bool is_head = ex.request_.method_ == "HEAD" ;
+
+        if ( ex.request_.method_ == "GET" ) {
+            boost::string_ref range = ex.request_.headerRef("Range") ;
+            if ( !range.empty() ) response.applyRange(range.to_string(), ex.request_.header("If-Range")) ;
+        }
+
+        // open the file now so that a missing file can still be reported
+        bool has_file = !response.file_.path_.empty() ;
+        if ( has_file && !is_head && !file_sender_.open(response.file_.path_, response.file_.offset_, response.file_.length_) ) {
+            response.stockReply(Response::not_found) ;
+            has_file = false ;
+        }
+
+        bool streamed = (bool)response.generator_ ;
+
+        if ( streamed ) {
+            // HTTP/1.0 clients do not understand chunked encoding; the end of the body is signalled by closing the connection
+            if ( ex.request_.protocol_ == "HTTP/1.0" ) {
+                response.headers_.remove("Transfer-Encoding") ;
+                ex.keep_alive_ = false ;
+            }
+        }
+        else if ( has_file ) {
+            if ( !response.headers_.contains("Content-Length") )
+                response.headers_.add("Content-Length", std::to_string(response.file_.length_)) ;
+        }
+        // a persistent connection needs an explicit message length
+        else if ( !response.headers_.contains("Content-Length") &&
+                  response.status_ != Response::not_modified && response.status_ != Response::no_content )
+            response.setContentLength() ;
+
+        response.headers_.replace("Connection", ex.keep_alive_ ? "keep-alive" : "close") ;
+        keep_alive_ = ex.keep_alive_ ;
+
+        char status[8] ;
+        int status_len = snprintf(status, sizeof(status), "%d", (int)response.status_) ;
+        metrics_.duration_.with({ex.request_.route_, boost::string_ref(status, status_len)})
+                .observe(std::chrono::steady_clock::now() - ex.start_) ;
+
+        if ( ex.decoded_ && tracer_.enabled() ) {
+            tracer_.add_server_timing(response, ex.trace_) ;
+            ex.write_start_ = std::chrono::steady_clock::now() ;
+        }
+
+        // at most two buffers per response: the head and the in-memory body
+        serialize_response_head(response, ex.head_) ;
+        output_buffers_.push_back(boost::asio::buffer(ex.head_)) ;
+        if ( !is_head && !response.body().empty() )
+            output_buffers_.push_back(boost::asio::buffer(response.body())) ;
+
+        return ( streamed || has_file ) && !is_head ;
+    }
+
+    // write queued responses with a single gathered write. Gathering stops at a streamed or file response whose body
+    // is then sent separately before continuing with the rest.
+
+    void write()  {
+
+        while ( next_exchange_ < exchanges_.size() ) {
+            Exchange &ex = *exchanges_[next_exchange_++] ;
+
+            std::uint64_t allocations = detail::thread_allocations() ;
+            bool streamed = queue_response(ex) ;
+            ex.allocations_ += detail::thread_allocations() - allocations ;
+
+            if ( streamed ) {
+                streaming_ = &ex ;
+                break ;
+            }
+            // the connection closes after this response, drop the rest
+            if ( !ex.keep_alive_ ) {
+                next_exchange_ = exchanges_.size() ;
+                break ;
+            }
+        }
+
+        set_deadline(write_deadline, options_.write_timeout_) ;
+
+        auto self(this->shared_from_this());
+        boost::asio::async_write(socket_, output_buffers_, [this, self](boost::system::error_code e, std::size_t bytes_transferred) {
+            output_buffers_.clear() ;
+            metrics_.sent_bytes_.inc(bytes_transferred) ;
+
+            if ( !e ) {
+                if ( !streaming_ ) write_completed() ;
+                else if ( file_sender_.is_open() ) send_file_body() ;
+                else produce_chunk() ;
             }
             else if (e != boost::asio::error::operation_aborted)
             {
                 connection_manager_.stop(self) ;
             }
+       });
+    }
 
-        });
+    // start sending the file body of the current response
+
+    void send_file_body() {
+        // the file regions bypass the writes below, count them up front
+        const Response::FileBody &body = streaming_->response_.file_ ;
+        if ( body.parts_.empty() ) metrics_.sent_bytes_.inc(body.length_) ;
+        else for( const auto &part: body.parts_ ) metrics_.sent_bytes_.inc(part.length_) ;
+
+        file_part_ = 0 ;
+        if ( streaming_->response_.file_.parts_.empty() ) send_file() ;
+        else send_file_part() ;
     }
 
-    void write(const std::vector<boost::asio::const_buffer> &buffers)  {
+    // send the next part of a multipart/byteranges body: its header followed by the file region, or the closing
+    // delimiter after the last one
+
+    void send_file_part() {
         auto self(this->shared_from_this());
-        boost::asio::async_write(socket_, buffers, [this, self](boost::system::error_code e, std::size_t) {
-            if (!e)
-            {
-                // Initiate graceful Connection closure.
-                boost::system::error_code ignored_ec;
-                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+        const Response::FileBody &body = streaming_->response_.file_ ;
+
+        set_deadline(write_deadline, options_.write_timeout_) ;
+
+        if ( file_part_ == body.parts_.size() ) {
+            boost::asio::async_write(socket_, boost::asio::buffer(body.trailer_), [this, self](boost::system::error_code e, std::size_t bytes_transferred) {
+                metrics_.sent_bytes_.inc(bytes_transferred) ;
+                if ( !e ) file_sent() ;
+                else if ( e != boost::asio::error::operation_aborted ) connection_manager_.stop(self) ;
+            }) ;
+            return ;
+        }
+
+        const Response::FileBody::Part &part = body.parts_[file_part_++] ;
+        file_sender_.select(part.offset_, part.length_) ;
+
+        boost::asio::async_write(socket_, boost::asio::buffer(part.header_), [this, self](boost::system::error_code e, std::size_t bytes_transferred) {
+            metrics_.sent_bytes_.inc(bytes_transferred) ;
+            if ( !e ) send_file() ;
+            else if ( e != boost::asio::error::operation_aborted ) connection_manager_.stop(self) ;
+        }) ;
+    }
+
+    // a file region has been sent
+    void region_sent() {
+        if ( streaming_->response_.file_.parts_.empty() ) file_sent() ;
+        else send_file_part() ;
+    }
+
+    // send the current file region directly from the file descriptor, waiting for the socket to become
+    // writable whenever its buffer is full
+
+    void send_file() {
+        auto self(this->shared_from_this());
+
+        boost::system::error_code ec ;
+        socket_.native_non_blocking(true, ec) ;
+
+        switch ( file_sender_.send(socket_.native_handle()) ) {
+        case detail::file_sender::done:
+            region_sent() ;
+            break ;
+        case detail::file_sender::would_block:
+            set_deadline(write_deadline, options_.write_timeout_) ;
+            socket_.async_write_some(boost::asio::null_buffers(), [this, self](boost::system::error_code e, std::size_t) {
+                if ( !e ) send_file() ;
+                else if ( e != boost::asio::error::operation_aborted ) connection_manager_.stop(self) ;
+            }) ;
+            break ;
+        case detail::file_sender::unsupported: {
+            boost::asio::const_buffer data = file_sender_.map() ;
+            if ( boost::asio::buffer_size(data) == 0 ) {
+                connection_manager_.stop(self) ;
+                break ;
             }
+            set_deadline(write_deadline, options_.write_timeout_) ;
+            boost::asio::async_write(socket_, boost::asio::buffer(data), [this, self](boost::system::error_code e, std::size_t) {
+                if ( !e ) region_sent() ;
+                else if ( e != boost::asio::error::operation_aborted ) connection_manager_.stop(self) ;
+            }) ;
+            break ;
+        }
+        default:
+            // part of the body has been sent already, the only way to signal the failure is to close the connection
+            connection_manager_.stop(self) ;
+        }
+    }
+
+    void file_sent() {
+        file_sender_.close() ;
+        streaming_ = nullptr ;
+        write_completed() ;
+    }
+
+    // ask the content generator of the streamed response for the next chunk. This runs on the worker pool if there
+    // is one since generators may block as handlers do.
+
+    void produce_chunk() {
+        // the generator may take its time, only writing the chunk is subject to the write timeout
+        cancel_deadline() ;
+
+        if ( workers_ ) {
+            auto self(this->shared_from_this());
+            workers_->post([this, self]() {
+                bool more = next_chunk() ;
+                socket_.get_io_service().post([this, self, more]() {
+                    write_chunk(more) ;
+                }) ;
+            }) ;
+        }
+        else write_chunk(next_chunk()) ;
+    }
+
+    bool next_chunk() {
+        chunk_.clear() ;
+        try {
+            return streaming_->response_.generator_(chunk_) ;
+        }
+        catch ( std::exception &e ) {
+            log_error("Content generator failed", e.what()) ;
+        }
+        catch ( ... ) {
+            log_error("Content generator failed", "unknown exception") ;
+        }
+
+        // the status line has already been sent: drop the partial chunk, terminate the body and close the
+        // connection afterwards
+        streaming_->keep_alive_ = false ;
+        keep_alive_ = false ;
+        chunk_.clear() ;
+        return false ;
+    }
+
+    // send a chunk of streamed content with chunked transfer encoding framing; the next chunk is requested only after
+    // this one has been written to the socket
 
-            if (e != boost::asio::error::operation_aborted)
+    void write_chunk(bool more) {
+
+        static const char crlf[] = { '\r', '\n' };
+        static const char last_chunk[] = { '0', '\r', '\n', '\r', '\n' };
+
+        bool chunked = streaming_->response_.headers_.contains("Transfer-Encoding") ;
+
+        if ( !chunk_.empty() ) {
+            if ( chunked ) {
+                std::ostringstream strm ;
+                strm << std::hex << chunk_.size() << "\r\n" ;
+                chunk_header_ = strm.str() ;
+                output_buffers_.push_back(boost::asio::buffer(chunk_header_)) ;
+                output_buffers_.push_back(boost::asio::buffer(chunk_)) ;
+                output_buffers_.push_back(boost::asio::buffer(crlf)) ;
+            }
+            else
+                output_buffers_.push_back(boost::asio::buffer(chunk_)) ;
+        }
+
+        // the body is always terminated, also when the connection closes after it
+        if ( !more && chunked )
+            output_buffers_.push_back(boost::asio::buffer(last_chunk)) ;
+
+        if ( output_buffers_.empty() ) {
+            // nothing produced this time
+            if ( more ) produce_chunk() ;
+            else {
+                streaming_ = nullptr ;
+                write_completed() ;
+            }
+            return ;
+        }
+
+        set_deadline(write_deadline, options_.write_timeout_) ;
+
+        auto self(this->shared_from_this());
+        boost::asio::async_write(socket_, output_buffers_, [this, self, more](boost::system::error_code e, std::size_t bytes_transferred) {
+            output_buffers_.clear() ;
+            metrics_.sent_bytes_.inc(bytes_transferred) ;
+
+            if ( !e ) {
+                if ( more ) produce_chunk() ;
+                else {
+                    streaming_ = nullptr ;
+                    write_completed() ;
+                }
+            }
+            else if (e != boost::asio::error::operation_aborted)
             {
                 connection_manager_.stop(self) ;
             }
-       });
+        }) ;
+    }
+
+    // continue with the remaining responses or, once all have been sent, wait for more requests or close the connection
+
+    void write_completed() {
+
+        if ( next_exchange_ < exchanges_.size() ) {
+            write() ;
+            return ;
+        }
+
+        if ( tracer_.enabled() ) {
+            auto now = std::chrono::steady_clock::now() ;
+            for( auto &ex: exchanges_ ) {
+                if ( !ex->decoded_ ) continue ;
+                ex->trace_.add("write", ex->write_start_, now) ;
+                tracer_.finish(ex->request_, ex->response_, ex->trace_, id_) ;
+            }
+        }
+
+        // keep the request and response objects, and the memory they hold, for the next requests
+        for( auto &ex: exchanges_ ) {
+            detail::record_request_allocations(ex->allocations_) ;
+            ex->clear() ;
+            spare_exchanges_.push_back(std::move(ex)) ;
+        }
+        exchanges_.clear() ;
+        next_exchange_ = 0 ;
+
+        // headers copied by the parser are no longer referenced, except those of a partially read next request.
+        // These are moved to the other arena, so that the blocks of this one are released after every batch.
+        detail::arena &used = *arena_ ;
+        if ( !request_parser_.is_idle() ) {
+            arena_ = ( arena_ == &arenas_[0] ) ? &arenas_[1] : &arenas_[0] ;
+            request_parser_.relocate(*arena_) ;
+        }
+        used.reset() ;
+
+        if ( keep_alive_ ) {
+            // pipelined requests may be left in the input buffer
+            if ( input_offset_ < input_size_ ) process_input() ;
+            else wait_for_next_request() ;
+            return ;
+        }
+
+        // Initiate graceful Connection closure.
+        boost::system::error_code ignored_ec;
+        socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+
+        connection_manager_.stop(this->shared_from_this()) ;
+    }
+
+    // read the next request closing the connection if it stays idle longer than the keep-alive timeout
+
+    void wait_for_next_request() {
+        if ( request_parser_.is_idle() ) {
+            set_deadline(idle_deadline, options_.keep_alive_timeout_) ;
+            read() ;
+        }
+        else read_more() ; // part of the next request has been read already
+    }
+
+    // read more of a partially received request. The headers have to be complete within the header timeout
+    // counted from the start of the request, while the body may not stall for longer than the body timeout.
+
+    void read_more() {
+        if ( request_parser_.headers_complete() )
+            set_deadline(body_deadline, options_.body_timeout_) ;
+        else if ( !request_parser_.is_idle() ) {
+            if ( deadline_ != header_deadline ) set_deadline(header_deadline, options_.header_timeout_) ;
+        }
+        // only blank lines so far, keep waiting as for an idle connection
+        else if ( deadline_ != header_deadline && deadline_ != idle_deadline )
+            set_deadline(idle_deadline, options_.keep_alive_timeout_) ;
+
+        read() ;
+    }
+
+    enum Deadline { no_deadline, idle_deadline, header_deadline, body_deadline, write_deadline } ;
+
+    // (re)arm the connection timer for the given phase; a zero timeout disables it
+
+    void set_deadline(Deadline d, size_t seconds) {
+        if ( seconds == 0 ) {
+            cancel_deadline() ;
+            return ;
+        }
+
+        deadline_ = d ;
+        timer_.expires_from_now(boost::posix_time::seconds(seconds)) ;
+
+        auto self(this->shared_from_this());
+        timer_.async_wait([this, self, d](boost::system::error_code e) {
+            // the timer may have been re-armed after it expired but before this handler ran
+            if ( e == boost::asio::error::operation_aborted || d != deadline_ ||
+                 timer_.expires_at() > boost::asio::deadline_timer::traits_type::now() ) return ;
+
+            deadline_expired(d) ;
+        }) ;
+    }
+
+    void cancel_deadline() {
+        deadline_ = no_deadline ;
+        boost::system::error_code ignored_ec;
+        timer_.cancel(ignored_ec) ;
+    }
+
+    void deadline_expired(Deadline d) {
+        deadline_ = no_deadline ;
+
+        // nothing to answer to: idle connections, stalled writes and clients that never started a request are closed
+        if ( d == write_deadline || d == idle_deadline || request_parser_.is_idle() ) {
+            connection_manager_.stop(this->shared_from_this()) ;
+            return ;
+        }
+
+        // abandon the pending read and tell the client why the connection is closed
+        timed_out_ = true ;
+        boost::system::error_code ignored_ec;
+        socket_.cancel(ignored_ec) ;
+
+        new_exchange().response_.stockReply(Response::request_timeout) ;
+        keep_alive_ = false ;
+        write() ;
+    }
+
+    /// Maximum number of responses gathered in a single write.
+    static const size_t max_pipelined_responses = 16 ;
+
+    /// Number identifying the connection in traces.
+    static std::size_t next_id() {
+        static std::atomic<std::size_t> id(0) ;
+        return ++id ;
     }
 
      boost::asio::ip::tcp::socket socket_;
 
+     /// Index of the event loop (io_service of the pool) serving this connection.
+     std::size_t loop_index_ ;
 
      /// The handler of incoming HttpRequest.
-     FilterChain &handler_;
+     const FilterChain &handler_;
 
      /// Buffer for incoming data.
      boost::array<char, 8192> buffer_;
 
      ConnectionManager& connection_manager_ ;
 
+     const ServerOptions &options_ ;
+
+     /// Load shedding shared by all connections.
+     detail::admission_controller &admission_ ;
+
+     /// Outputs of the request traces, shared by all connections.
+     detail::request_tracer &tracer_ ;
+
+     /// Pool running the request handlers, or null to run them on the event loop.
+     detail::worker_pool *workers_ ;
+
+     /// Timer enforcing the idle, header, body and write timeouts, and the phase it is armed for.
+     boost::asio::deadline_timer timer_ ;
+     Deadline deadline_ ;
+
+     /// Set when a request timed out; input arriving afterwards is ignored.
+     bool timed_out_ ;
+
+     /// Request scoped memory, released once all pending responses have been written. Two arenas are used in turn so
+     /// that a request read only in part by then can be kept.
+     detail::arena arenas_[2] ;
+     detail::arena *arena_ ;
+
       /// The parser for the incoming HttpRequest.
      detail::RequestParser request_parser_;
 
-     Request request_ ;
-     Response response_ ;
+     /// Requests being handled and responses waiting to be written, in request order. Exchanges are held by pointer
+     /// so that references stay stable while buffers point into them.
+     std::vector<std::unique_ptr<Exchange>> exchanges_ ;
+
+     /// Exchanges of earlier requests kept for reuse.
+     std::vector<std::unique_ptr<Exchange>> spare_exchanges_ ;
+
+     /// Buffers of all queued responses.
+     std::vector<boost::asio::const_buffer> output_buffers_ ;
+
+     /// Index of the next exchange whose response has to be written.
+     size_t next_exchange_ ;
+
+     /// Exchange whose response body is currently being streamed or sent from a file, if any.
+     Exchange *streaming_ ;
+
+     /// File body of the current response and, for multipart/byteranges bodies, the index of the next part.
+     detail::file_sender file_sender_ ;
+     size_t file_part_ ;
+
+     /// Last chunk produced by a content generator and its chunked encoding size line.
+     std::string chunk_, chunk_header_ ;
+
+     /// Part of buffer_ not yet fed to the parser.
+     size_t input_offset_, input_size_ ;
+
+     /// Number of requests served so far over this connection.
+     size_t requests_served_ ;
+
+     /// Whether the connection should persist after the current response.
+     bool keep_alive_ ;
+
+     /// When the current requests were posted to the worker pool.
+     std::chrono::steady_clock::time_point queued_ ;
+
+     /// Requests still being handled, plus one while they are passed to the filter chain, and the reference keeping
+     /// the connection alive meanwhile.
+     std::atomic<size_t> pending_handlers_ ;
+     ConnectionPtr handling_ ;
+
+     /// Links of the connection manager's list of connections of this event loop, and the reference held by the
+     /// list while the connection is in it.
+     HttpConnection *prev_in_loop_, *next_in_loop_ ;
+     ConnectionPtr tracked_ ;
+
+     /// Request latency and traffic counters.
+     detail::http_metrics &metrics_ ;
+
+     /// Connection number shown in traces.
+     std::size_t id_ ;
 
 };
 
@@ -1,9 +1,14 @@
 #ifndef __SERVER_CONNECTION_MANAGER_HPP__
 #define __SERVER_CONNECTION_MANAGER_HPP__
 
-#include <set>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/thread.hpp>
+
+#include <wspp/server/detail/io_service_pool.hpp>
 
 namespace wspp { namespace server {
 
@@ -13,28 +18,61 @@ typedef boost::shared_ptr<HttpConnection> ConnectionPtr;
 /// Manages open connections so that they may be cleanly stopped when the server
 /// needs to shut down.
 ///
+/// Connections are tracked per event loop in an intrusive list that is only touched from that loop, so opening and
+/// closing connections takes no lock. Counts are kept in atomics and may be read from any thread.
 class ConnectionManager
 {
 public:
     ConnectionManager(const ConnectionManager&) = delete;
     ConnectionManager& operator=(const ConnectionManager&) = delete;
 
-    /// Construct a connection manager.
-    ConnectionManager();
+    /// Construct a connection manager for connections distributed over the event loops of the pool.
+    explicit ConnectionManager(detail::io_service_pool &pool);
+
+    /// Stops the connections still open.
+    ~ConnectionManager();
 
-    /// Add the specified connection to the manager and start it.
-    void start(ConnectionPtr c);
+    /// Add the specified connection to the manager and start it on its event loop. If max_connections is not zero
+    /// and that many connections are already open the connection is not started and false is returned.
+    bool start(ConnectionPtr c, std::size_t max_connections = 0);
 
-    /// Stop the specified connection.
+    /// Stop the specified connection. Must be called from the event loop serving it.
     void stop(ConnectionPtr c);
 
-    /// Stop all connections.
-    void stop_all();
+    /// Stop all connections. Each event loop stops its own connections; done is called on the loop that finishes
+    /// last, so the event loops must keep running until then.
+    void stop_all(std::function<void()> done = std::function<void()>());
+
+    /// Number of open connections served by each event loop.
+    std::vector<std::size_t> connections_per_loop() ;
+
+    /// Total number of connections accepted on each event loop.
+    std::vector<std::size_t> accepts_per_loop() ;
+
+    /// Index of the event loop currently serving the fewest connections.
+    std::size_t least_loaded_loop() ;
+
+    /// Number of open connections.
+    std::size_t count() const { return open_ ; }
 
 private:
-    /// The managed connections.
-    std::set<ConnectionPtr> connections_;
-    boost::mutex mutex_ ;
+    /// Connections of one event loop.
+    struct shard {
+        explicit shard(boost::asio::io_service &io_service): io_service_(io_service), head_(nullptr), open_(0), accepted_(0) {}
+
+        boost::asio::io_service &io_service_ ;
+        /// First connection of the list linked through HttpConnection::next_in_loop_.
+        HttpConnection *head_ ;
+        /// Open connections and connections accepted since startup.
+        std::atomic<std::size_t> open_, accepted_ ;
+    };
+
+    void link(shard &s, const ConnectionPtr &c) ;
+    bool unlink(shard &s, HttpConnection &c) ;
+    void stop_shard(shard &s) ;
+
+    std::vector<std::unique_ptr<shard>> shards_ ;
+    std::atomic<std::size_t> open_ ;
 };
 
 
@@ -42,4 +80,3 @@ private:
 } // namespace wspp
 
 #endif
-
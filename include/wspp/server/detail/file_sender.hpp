@@ -0,0 +1,58 @@
+#ifndef HTTP_SERVER_FILE_SENDER_HPP
+#define HTTP_SERVER_FILE_SENDER_HPP
+
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace wspp {
+namespace server {
+namespace detail {
+
+/// Sends a region of a file to a socket without copying it through user space. sendfile(2) is used where available;
+/// otherwise the region is memory mapped and written from the mapping.
+class file_sender
+        : private boost::noncopyable
+{
+public:
+    enum result {
+        done,        // the whole region has been sent
+        would_block, // the socket buffer is full, call send() again once the socket is writable
+        unsupported, // sendfile cannot be used with this file or socket, fall back to map()
+        error
+    };
+
+    file_sender();
+    ~file_sender();
+
+    /// Open the file and select the region to send. Returns false if the file cannot be opened.
+    bool open(const std::string &path, std::uint64_t offset, std::uint64_t length);
+
+    /// Select another region of the open file.
+    void select(std::uint64_t offset, std::uint64_t length);
+
+    /// Send as much of the remaining region as the (non-blocking) socket accepts.
+    result send(int socket_fd);
+
+    /// Map the remaining region to memory. The buffer is empty on failure and stays valid until close().
+    boost::asio::const_buffer map();
+
+    /// Close the file and release any mapping.
+    void close();
+
+    bool is_open() const { return fd_ != -1; }
+
+private:
+    int fd_;
+    std::uint64_t offset_, end_;
+    void *map_;
+    std::size_t map_size_;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
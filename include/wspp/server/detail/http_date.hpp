@@ -0,0 +1,49 @@
+#ifndef HTTP_SERVER_HTTP_DATE_HPP
+#define HTTP_SERVER_HTTP_DATE_HPP
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <atomic>
+#include <ctime>
+
+namespace wspp {
+namespace server {
+namespace detail {
+
+/// Process-wide clock for the Date header. A timer on one event loop advances it once a second so that serializing
+/// a response neither reads the system clock nor formats a date more than once a second per thread.
+class http_date
+        : private boost::noncopyable
+{
+public:
+    /// Construct the clock ticking on the given io_service.
+    explicit http_date(boost::asio::io_service &io_service);
+
+    /// Start ticking.
+    void start();
+
+    /// Stop ticking. now() reads the system clock again afterwards. May be called from any thread.
+    void stop();
+
+    /// The current time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT". The string belongs to the calling
+    /// thread and is valid until its next call. Falls back to the system clock when no server is running.
+    static boost::string_ref now();
+
+    /// Format t as an HTTP date into buf, which must have room for 30 characters. Returns the length written.
+    static std::size_t format(std::time_t t, char *buf);
+
+private:
+    void schedule();
+
+    boost::asio::deadline_timer timer_ ;
+    std::atomic<bool> stopped_ ;
+    static std::atomic<std::time_t> now_ ;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
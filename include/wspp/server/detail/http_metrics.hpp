@@ -0,0 +1,26 @@
+#ifndef HTTP_SERVER_HTTP_METRICS_HPP
+#define HTTP_SERVER_HTTP_METRICS_HPP
+
+#include <wspp/util/metrics.hpp>
+
+namespace wspp {
+namespace server {
+namespace detail {
+
+/// Request and traffic metrics updated by connections. The registry entries are looked up once.
+struct http_metrics
+{
+    /// Time from a request being parsed to its response being ready, by route and status.
+    util::MetricFamily<util::Histogram> &duration_ ;
+
+    util::Counter &received_bytes_ ;
+    util::Counter &sent_bytes_ ;
+
+    static http_metrics &get();
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
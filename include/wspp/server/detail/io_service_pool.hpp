@@ -37,6 +37,15 @@ public:
     /// Get an io_service to use.
     boost::asio::io_service& get_io_service();
 
+    /// Get the io_service with the given index.
+    boost::asio::io_service& get_io_service(std::size_t index);
+
+    /// Get the index of the next io_service to use in round-robin order.
+    std::size_t next_index();
+
+    /// Number of io_service objects in the pool.
+    std::size_t size() const { return io_services_.size(); }
+
 private:
     typedef boost::shared_ptr<boost::asio::io_service> io_service_ptr;
     typedef boost::shared_ptr<boost::asio::io_service::work> work_ptr;
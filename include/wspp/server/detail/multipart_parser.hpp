@@ -0,0 +1,61 @@
+#ifndef HTTP_SERVER_MULTIPART_PARSER_HPP
+#define HTTP_SERVER_MULTIPART_PARSER_HPP
+
+#include <wspp/server/request.hpp>
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace wspp { namespace server {
+namespace detail {
+
+/// Incremental parser of multipart/form-data request bodies. The body is fed in pieces as they arrive from the socket;
+/// form fields are collected in memory while uploaded files larger than the spill threshold are written to a
+/// temporary file instead of being kept in memory.
+
+class MultipartParser
+{
+public:
+    MultipartParser(const std::string &boundary, size_t spill_threshold, const std::string &upload_dir) ;
+
+    /// feed the next piece of the body. Returns false if the data are malformed or a temporary file cannot be written.
+    bool parse(const char *data, size_t size) ;
+
+    /// true once the closing boundary has been seen
+    bool is_complete() const { return state_ == Done ; }
+
+    /// move the parsed fields and files to the request
+    void decode(Request &req) ;
+
+private:
+
+    bool parse_part_headers(const std::string &headers) ;
+    bool part_data(const char *data, size_t size) ;
+    void end_part() ;
+
+    enum State { Preamble, AfterBoundary, Headers, Data, Done } ;
+
+    State state_ ;
+    std::string delimiter_ ; // CRLF--boundary
+    std::string buffer_ ;    // unprocessed bytes, at most a delimiter long between calls except for part headers
+
+    size_t spill_threshold_ ;
+    std::string upload_dir_ ;
+
+    // current part
+    std::string field_name_, field_value_ ;
+    Request::UploadedFile file_ ;
+    bool is_file_ ;
+    std::ofstream file_strm_ ;
+
+    Dictionary fields_ ;
+    std::map<std::string, Request::UploadedFile> files_ ;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
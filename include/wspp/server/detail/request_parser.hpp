@@ -13,9 +13,17 @@
 
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
-#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
 
 #include <wspp/server/detail/http_parser.h>
+#include <wspp/server/detail/multipart_parser.hpp>
+#include <wspp/server/detail/arena.hpp>
+#include <wspp/server/server_options.hpp>
+#include <wspp/server/response.hpp>
 
 namespace wspp { namespace server {
 
@@ -27,17 +35,37 @@ namespace detail {
 class RequestParser
 {
 public:
-    /// Construct ready to parse the request method.
-    RequestParser();
+    /// Construct ready to parse the request method. Body size limits and upload handling are taken from options.
+    /// Headers that have to be copied are kept in storage, which must not be reset before the requests are handled.
+    RequestParser(const ServerOptions &options, arena &storage);
 
     /// Reset to initial parser state.
     void reset();
 
-    /// call the parser with chunk of data while it is in indeterminate state
-    boost::tribool parse(const char *data, size_t buf_len) ;
+    /// call the parser with chunk of data while it is in indeterminate state. On return consumed holds the number of bytes
+    /// used. When a complete message is found parsing stops and any bytes following it (pipelined requests) are left unconsumed.
+    /// Headers and URL of a complete message reference data, which should stay untouched until the request is handled.
+    boost::tribool parse(const char *data, size_t buf_len, size_t &consumed) ;
+
+    // fill in the request structure. The body is moved to the request, so this should be called once per message.
+    bool decode_message(Request &req) ;
+
+    // continue with storage, copying there the fragments of a partially parsed message held in the current arena,
+    // so that the latter may be reset
+    void relocate(arena &storage) ;
+
+    // true if no part of a message has been seen since the last reset
+    bool is_idle() const { return !message_begun_ ; }
 
-    // fill in the request structure
-    bool decode_message(Request &req) const ;
+    // true once the headers of the current message have been parsed and only the body (if any) remains
+    bool headers_complete() const { return headers_complete_ ; }
+
+    // the status to reply with when parse() fails (bad request unless a limit was exceeded)
+    Response::Status error_status() const { return error_status_ ; }
+
+    // true if the connection may be reused after responding to the current request
+    // (HTTP/1.1 without "Connection: close" or HTTP/1.0 with "Connection: keep-alive")
+    bool should_keep_alive() const { return keep_alive_ ; }
 
 private:
 
@@ -49,13 +77,42 @@ private:
     static int on_url(http_parser * parser, const char *data, size_t size);
     static int on_body(http_parser * parser, const char *data, size_t size) ;
 
+    // account for size bytes of request line or headers, failing with status if a limit is exceeded
+    bool check_header_size(size_t size) ;
+
+    // decide how the body will be consumed once headers are known
+    bool begin_body() ;
+
+    // extend dst with the next fragment of a header or URL
+    void append_fragment(boost::string_ref &dst, const char *data, size_t size) ;
+
+    // copy views into [data, data + size) to the arena before the buffer is reused for the next read
+    void own_fragments(const char *data, size_t size) ;
+
+    boost::string_ref find_header(const char *name) const ;
+
 protected:
     http_parser parser_ ;
     http_parser_settings settings_ ;
 
-    std::string current_header_field_, current_header_value_, url_, body_, protocol_ ;
-    std::map<std::string, std::string> headers_ ;
-    bool is_complete_ ;
+    const ServerOptions &options_ ;
+
+    // multipart/form-data bodies are parsed as they arrive, other bodies are accumulated in body_
+    std::unique_ptr<MultipartParser> multipart_ ;
+    size_t body_size_ ;
+    Response::Status error_status_ ;
+
+    // headers and URL reference the input buffer, unless split over reads in which case they are copied to
+    // storage_. The vector keeps its capacity between requests.
+    std::vector<std::pair<boost::string_ref, boost::string_ref>> headers_ ;
+    arena *storage_ ;
+    boost::string_ref url_ ;
+    bool in_header_value_ ;
+    size_t header_bytes_ ;
+    bool message_begun_, headers_complete_ ;
+
+    std::string body_ ;
+    bool is_complete_, keep_alive_ ;
 };
 
 } // namespace detail
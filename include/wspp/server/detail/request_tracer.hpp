@@ -0,0 +1,80 @@
+#ifndef HTTP_SERVER_REQUEST_TRACER_HPP
+#define HTTP_SERVER_REQUEST_TRACER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <wspp/util/trace.hpp>
+
+namespace wspp {
+
+namespace util { class Logger ; }
+
+namespace server {
+
+class Request ;
+class Response ;
+struct ServerOptions ;
+
+namespace detail {
+
+/// Outputs of the per-request traces configured in ServerOptions: the slow request log and the Chrome trace file.
+/// Shared by all connections.
+class request_tracer
+{
+public:
+    explicit request_tracer(const ServerOptions &options) ;
+    ~request_tracer() ;
+
+    /// Whether requests have to be traced at all.
+    bool enabled() const { return enabled_ ; }
+
+    /// Add the Server-Timing header if enabled, with the spans closed so far and the total time.
+    void add_server_timing(Response &resp, const util::TraceContext &trace) const ;
+
+    /// Called once the response to a traced request has been written.
+    void finish(const Request &req, const Response &resp, const util::TraceContext &trace, std::size_t connection_id) ;
+
+private:
+
+    void log_slow_request(const Request &req, const Response &resp, const util::TraceContext &trace, int64_t total) ;
+    void write_events(const Request &req, const Response &resp, const util::TraceContext &trace, int64_t total,
+                      std::size_t connection_id) ;
+
+    // background thread writing the blocks of events to the trace file
+    void write_file() ;
+
+    bool enabled_ ;
+    bool server_timing_ ;
+
+    /// Slow request log: threshold in microseconds (0 if disabled), sampling and destination.
+    int64_t slow_request_us_ ;
+    std::size_t slow_request_sample_ ;
+    util::Logger *slow_request_logger_ ;
+
+    /// Slow requests seen so far, for sampling the log.
+    std::atomic<uint64_t> slow_requests_ ;
+
+    /// Chrome trace file and the events not yet written to it. Timestamps count from epoch_. Events are collected in
+    /// events_ and full blocks are handed to the writer thread, so the event loops never wait for the disk.
+    util::TraceContext::clock::time_point epoch_ ;
+    std::mutex mutex_ ;
+    FILE *trace_file_ ;
+    std::string events_ ;
+    bool first_event_ ;
+    std::deque<std::string> pending_ ;
+    bool stop_ ;
+    std::condition_variable wakeup_ ;
+    std::thread writer_ ;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
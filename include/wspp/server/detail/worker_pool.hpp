@@ -0,0 +1,59 @@
+#ifndef HTTP_SERVER_WORKER_POOL_HPP
+#define HTTP_SERVER_WORKER_POOL_HPP
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace wspp {
+namespace server {
+
+/// Snapshot of the worker pool load.
+struct WorkerPoolStats {
+    std::size_t queued_ ;      // jobs waiting for a free worker
+    std::size_t active_ ;      // jobs currently running
+    std::size_t max_queued_ ;  // highest queue depth observed
+    std::size_t completed_ ;   // jobs finished since startup
+};
+
+namespace detail {
+
+/// A fixed number of threads executing (possibly blocking) jobs posted from the event loops.
+class worker_pool
+        : private boost::noncopyable
+{
+public:
+    /// Construct a pool with the given number of threads.
+    explicit worker_pool(std::size_t pool_size);
+
+    /// Start the worker threads.
+    void run();
+
+    /// Stop the worker threads and wait for them to exit. Queued jobs are discarded.
+    void stop();
+
+    /// Queue a job for execution on one of the worker threads.
+    void post(const std::function<void()> &job);
+
+    /// Current load of the pool.
+    WorkerPoolStats stats() const;
+
+private:
+    boost::asio::io_service io_service_;
+    boost::shared_ptr<boost::asio::io_service::work> work_;
+    std::vector<boost::shared_ptr<boost::thread> > threads_;
+    std::size_t pool_size_;
+
+    std::atomic<std::size_t> queued_, active_, max_queued_, completed_;
+};
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
+
+#endif
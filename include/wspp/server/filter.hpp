@@ -9,7 +9,7 @@
 
 namespace wspp { namespace server {
 
-class FilterChain ;
+class FilterContext ;
 
 /// Middleware handler
 ///
@@ -20,8 +20,9 @@ public:
     explicit Filter() = default;
 
     /// Handle a request and produce a reply. Should call chain.next before or after to act as pre-post filter.
+    /// The same filter serves all connections concurrently, per-request state belongs in chain.
 
-    virtual void handle(Request &req, Response &resp, FilterChain &chain) = 0;
+    virtual void handle(Request &req, Response &resp, FilterContext &chain) = 0;
 };
 
 } // namespace server
@@ -1,6 +1,9 @@
 #ifndef __SERVER_FILTER_CHAIN_HPP__
 #define __SERVER_FILTER_CHAIN_HPP__
 
+#include <atomic>
+#include <functional>
+#include <utility>
 #include <vector>
 #include <memory>
 
@@ -12,6 +15,61 @@ class Filter ;
 class Request ;
 class Response ;
 class RequestHandler ;
+class FilterChain ;
+
+/// Position of a request in a FilterChain. A context is created for every request, so the chain itself holds no
+/// per-request state and is shared by all connections and threads.
+class FilterContext {
+public:
+
+    /// Pass the request to the next filter, or to the end point after the last filter.
+    void next(Request &req, Response &resp) ;
+
+    /// Keep the response open after the filter returns, e.g. to finish it on another thread. The returned function
+    /// has to be called exactly once when the filter is done with the response. Must be called from within the
+    /// filter's handle(), which should not throw afterwards.
+    std::function<void()> defer() ;
+
+    /// Post-process the response once it is complete. Filters call this after chain.next() instead of inspecting the
+    /// response right away, since a filter below may have deferred it. Without deferred filters fn runs at once,
+    /// otherwise once all deferred filters are done, before the response is written; hooks then run innermost
+    /// filter first, as they would without deferral. Must be called from within the filter's handle(), and fn
+    /// should not throw.
+    template <class F>
+    void onComplete(F fn) {
+        if ( !pending_ ) fn() ;
+        else addHook(std::function<void()>(std::move(fn))) ;
+    }
+
+private:
+
+    friend class FilterChain ;
+
+    void addHook(std::function<void()> fn) ;
+
+    /// Completion of a request with deferred filters.
+    struct Pending {
+        Pending(const std::function<void()> &done): count_(1), done_(done) {}
+
+        /// run the hooks and tell the connection that the response is complete
+        void complete() ;
+
+        std::atomic<int> count_ ;
+        std::function<void()> done_ ;
+
+        /// onComplete() hooks with the position of the filter adding them. Only added during the synchronous pass
+        /// through the chain, which holds a count, so they are not modified once complete() runs.
+        std::vector<std::pair<size_t, std::function<void()>>> hooks_ ;
+    };
+
+    FilterContext(const FilterChain &chain, size_t pos, std::shared_ptr<Pending> &pending,
+                  const std::function<void()> &done): chain_(chain), pos_(pos), pending_(pending), done_(done) {}
+
+    const FilterChain &chain_ ;
+    size_t pos_ ;
+    std::shared_ptr<Pending> &pending_ ; // created by the first defer()
+    const std::function<void()> &done_ ;
+};
 
 class FilterChain {
 public:
@@ -20,21 +78,23 @@ public:
 
     void setEndPoint(RequestHandler *end_point) ;
 
-    void next(Request &req, Response &resp) ;
-
     void add(Filter *) ;
 
-    void handle(Request &req, Response &resp) ;
+    /// Run the request through the filters and the end point. done is called once the response is complete: before
+    /// returning (also when an exception propagates), or if a filter deferred completion from the thread finishing
+    /// last. Filters and end point have to be set up before requests are handled.
+    void handle(Request &req, Response &resp, const std::function<void()> &done) const ;
 
 private:
 
-    void doHandle(Request &req, Response &resp) ;
+    friend class FilterContext ;
+
+    void doHandle(Request &req, Response &resp, FilterContext &ctx) const ;
 
     typedef std::vector<std::unique_ptr<Filter>> FilterList ;
 
     FilterList filters_ ;
-    FilterList::const_iterator current_ ;
-    RequestHandler *end_point_ ;
+    RequestHandler *end_point_ = nullptr ;
 };
 
 
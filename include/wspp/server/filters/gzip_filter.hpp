@@ -3,17 +3,82 @@
 
 #include <wspp/server/filter.hpp>
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace wspp { namespace server {
 
-class FilterChain ;
+class FilterContext ;
 class Request ;
 class Response ;
 
+// What GZipFilter compresses and how.
+
+struct GZipOptions {
+
+    // zlib compression level, from 1 (fastest) to 9 (smallest), or -1 for the zlib default
+    int level_ = -1 ;
+
+    // bodies of this size or smaller are sent as they are
+    size_t min_size_ = 200 ;
+
+    // larger file responses are sent uncompressed straight from disk
+    size_t max_file_size_ = 1024 * 1024 ;
+
+    // content types to compress, compared without parameters and ignoring case. A trailing '*' matches any suffix.
+    std::vector<std::string> mime_types_ = { "text/*", "application/x-javascript", "application/javascript",
+                                             "application/xhtml+xml", "application/xml" } ;
+
+    // bytes of compressed bodies kept in memory, keyed by the path and the ETag of the compressed variant or else by
+    // a hash of the body, so that unchanged pages and assets are not compressed again (0 disables the cache)
+    size_t max_cache_size_ = 0 ;
+
+    // larger compressed bodies are not cached
+    size_t max_cache_entry_size_ = 256 * 1024 ;
+};
+
+// Compresses responses for clients accepting gzip. Each thread keeps a deflate stream that is reset between
+// responses rather than set up again.
+//
+// Responses of compressible types get "Vary: Accept-Encoding", and the compressed variant gets an ETag of its own
+// (the opaque tag with a "-gz" suffix) so that revalidation and If-Range never mix up the two encodings.
+
 class GZipFilter: public Filter {
 public:
-    GZipFilter() {}
+    explicit GZipFilter(const GZipOptions &options = GZipOptions()): options_(options) {}
+
+    void handle(Request &req, Response &resp, FilterContext &chain) override;
+
+private:
+
+    struct CacheEntry {
+        std::string source_ ; // uncompressed body, kept to rule out hash collisions when there is no ETag
+        std::shared_ptr<const std::string> data_ ;
+    } ;
+
+    typedef std::shared_ptr<const CacheEntry> CacheEntryPtr ;
+
+    bool compressible(const std::string &mime) const ;
+
+    // compress the complete response if the client accepts gzip, or answer a revalidation of the compressed variant
+    void encode(const Request &req, Response &resp) ;
+
+    // compress the body of resp in place, using the cache under key if enabled (an empty key hashes the body)
+    bool compress(Response &resp, const std::string &key) ;
+
+    CacheEntryPtr lookup(const std::string &key) ;
+    void store(const std::string &key, const CacheEntryPtr &entry) ;
+
+    GZipOptions options_ ;
 
-    void handle(Request &req, Response &resp, FilterChain &chain) override;
+    std::mutex mutex_ ;
+    size_t cache_size_ = 0 ;
+    std::unordered_map<std::string, std::pair<CacheEntryPtr, std::list<std::string>::iterator>> cache_ ;
+    std::list<std::string> lru_ ; // most recently used first
 };
 
 }
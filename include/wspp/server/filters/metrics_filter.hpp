@@ -0,0 +1,29 @@
+#ifndef __SERVER_METRICS_FILTER_HPP__
+#define __SERVER_METRICS_FILTER_HPP__
+
+#include <wspp/server/filter.hpp>
+
+#include <string>
+
+namespace wspp { namespace server {
+
+class FilterContext ;
+class Request ;
+class Response ;
+
+// Answers GET requests for path_ with the process metrics (see wspp/util/metrics.hpp) in the Prometheus text
+// format. Other requests are passed down the chain.
+
+class MetricsFilter: public Filter {
+public:
+    MetricsFilter(const std::string &path = "/metrics"): path_(path) {}
+
+    void handle(Request &req, Response &resp, FilterContext &chain) override;
+
+    std::string path_ ;
+};
+
+}
+}
+
+#endif
@@ -6,7 +6,7 @@
 
 namespace wspp { namespace server {
 
-class FilterChain ;
+class FilterContext ;
 class Request ;
 class Response ;
 
@@ -16,7 +16,7 @@ class RequestLoggerFilter: public Filter {
 public:
     RequestLoggerFilter(Logger &logger): logger_(logger) {}
 
-    void handle(Request &req, Response &resp, FilterChain &chain) override;
+    void handle(Request &req, Response &resp, FilterContext &chain) override;
 
     Logger &logger_ ;
 };
@@ -3,19 +3,57 @@
 
 #include <wspp/server/filter.hpp>
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 namespace wspp { namespace server {
 
-class FilterChain ;
+class FilterContext ;
 class Request ;
 class Response ;
 
+// Serves files under root_ for requests not handled by the rest of the chain, i.e. left with or throwing 404 by the
+// filters after it and the request handler. Small files are kept in memory,
+// a precompressed <file>.gz is sent to clients accepting gzip and revalidations (If-None-Match, If-Modified-Since)
+// of unchanged files are answered with 304.
+
 class StaticFileHandler: public Filter {
 public:
-    StaticFileHandler(const std::string &route_dir): root_(route_dir) {}
+    // files up to max_file_size bytes are cached, up to max_cache_size bytes in total (0 disables the cache)
+    StaticFileHandler(const std::string &route_dir, size_t max_cache_size = 32 * 1024 * 1024,
+                      size_t max_file_size = 256 * 1024):
+        root_(route_dir), max_cache_size_(max_cache_size), max_file_size_(max_file_size) {}
 
-    void handle(Request &req, Response &resp, FilterChain &chain) override;
+    void handle(Request &req, Response &resp, FilterContext &chain) override;
 
     std::string root_ ;
+
+private:
+
+    struct CacheEntry {
+        time_t mtime_ ;
+        uint64_t size_ ;
+        Dictionary headers_ ; // file headers except Date
+        std::shared_ptr<const std::string> data_ ; // shared with the responses (see Response::shared_content_)
+    } ;
+
+    typedef std::shared_ptr<const CacheEntry> CacheEntryPtr ;
+
+    // answer with the file at the request path, if there is one
+    bool serve(const Request &req, Response &resp) ;
+
+    // get the cached copy of the file, loading it if missing or out of date. Returns null for files not cached.
+    CacheEntryPtr fetch(const std::string &path, time_t mtime, uint64_t size, const std::string &encoding) ;
+
+    void evict(size_t required) ;
+
+    size_t max_cache_size_, max_file_size_, cache_size_ = 0 ;
+
+    std::mutex mutex_ ;
+    std::unordered_map<std::string, std::pair<CacheEntryPtr, std::list<std::string>::iterator>> cache_ ;
+    std::list<std::string> lru_ ; // most recently used first
 };
 
 }
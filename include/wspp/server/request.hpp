@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+
+#include <boost/utility/string_ref.hpp>
 
 #include <wspp/util/dictionary.hpp>
 #include <wspp/server/route.hpp>
@@ -11,6 +14,7 @@ namespace wspp { namespace server {
 
 using util::Dictionary ;
 
+
 /// A request received from a client.
 class Request
 {
@@ -21,20 +25,45 @@ public:
     bool matches(const std::string &method, const std::string &pattern, Dictionary &attributes) const ;
     bool matches(const std::string &method, const std::string &pattern) const;
 
+    // bit mask of the standard methods (GET, POST, PUT, DELETE, HEAD, OPTIONS, PATCH) named in methods,
+    // separated by | or spaces (e.g. "GET|POST")
+    static unsigned int methodMask(boost::string_ref methods) ;
+
     bool supportsGzip() ;
 
+    // empty all fields so that the object can be reused for the next request
+    void clear() ;
+
+    // value of the request header with the given (case insensitive) name or defaultVal if missing
+    std::string header(const std::string &name, const std::string &defaultVal = std::string()) const ;
+
+    // same as above but without making a copy; see headers_ for the lifetime of the result
+    boost::string_ref headerRef(const std::string &name) const ;
+
 public:
     Dictionary SERVER_ ; // Server variables
     Dictionary GET_ ;	 // Query variables for GET requests
     Dictionary POST_ ;   // Post variables for POST requests
     Dictionary COOKIE_ ; // Cookies
 
+    // A temporary file removed from disk when destroyed
+    struct TemporaryFile {
+        TemporaryFile(const std::string &path): path_(path) {}
+        ~TemporaryFile() ;
+
+        std::string path_ ;
+    } ;
+
     struct UploadedFile {
         std::string name_ ;	// The original filename
-        std::string path_ ; // The path of a local temporary copy of the uploaded file
+        std::string path_ ; // The path of a local temporary copy of the uploaded file (large files only)
         std::string mime_ ;	// MIME information of the uploaded file
         size_t size_ ;
         std::string data_ ; // This member variable contains the file contents for small files
+
+        // Keeps the temporary copy alive while the request (or any copy of this record) exists. Move or copy
+        // the file at path_ to keep it.
+        std::shared_ptr<TemporaryFile> tmp_file_ ;
     } ;
 
     std::map<std::string, UploadedFile> FILE_ ;	// Uploaded files
@@ -50,6 +79,16 @@ public:
     std::string query_ ;
     std::string protocol_ ;
 
+    typedef std::pair<boost::string_ref, boost::string_ref> HeaderRef ;
+
+    // Request headers and raw request target (e.g. /path?query) as received. These point into memory of the
+    // connection and are only valid until the response has been sent; copy what has to be kept longer.
+    // Unless ServerOptions::header_views_ is set the headers are also copied to SERVER_.
+    std::vector<HeaderRef> headers_ ;
+    boost::string_ref url_ ;
+
+    // pattern of the Router route that handled the request, empty if none did. Used to label request metrics.
+    mutable boost::string_ref route_ ;
 
 private:
 
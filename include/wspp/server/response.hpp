@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <cstdint>
+#include <memory>
 
 #include <wspp/util/dictionary.hpp>
 #include <wspp/util/variant.hpp>
@@ -23,6 +26,7 @@ struct Response
         created = 201,
         accepted = 202,
         no_content = 204,
+        partial_content = 206,
         multiple_choices = 300,
         moved_permanently = 301,
         moved_temporarily = 302,
@@ -31,6 +35,11 @@ struct Response
         unauthorized = 401,
         forbidden = 403,
         not_found = 404,
+        request_timeout = 408,
+        payload_too_large = 413,
+        uri_too_long = 414,
+        range_not_satisfiable = 416,
+        request_header_fields_too_large = 431,
         internal_server_error = 500,
         not_implemented = 501,
         bad_gateway = 502,
@@ -43,9 +52,45 @@ struct Response
     /// The content to be sent in the reply.
     std::string content_;
 
+    /// Content shared with a cache, sent instead of content_ when set so that cached bodies are not copied. Code that
+    /// inspects the content should use body().
+    std::shared_ptr<const std::string> shared_content_ ;
+
+    const std::string &body() const { return shared_content_ ? *shared_content_ : content_ ; }
+
+    // Producer of streamed content. It is called each time the previous chunk has been written to the socket and should
+    // store the next piece of content in chunk. Return false when there is no more data.
+    typedef std::function<bool (std::string &chunk)> ContentGenerator ;
+
+    /// If set, the body is produced by this generator instead of being taken from content_.
+    ContentGenerator generator_ ;
+
+    // A region of a file sent as the body instead of content_. The connection transmits it straight from the file
+    // (sendfile(2), or a memory mapping where that is not available) without reading it into memory.
+    struct FileBody {
+        std::string path_ ;        // empty if the response has no file body
+        std::uint64_t offset_ = 0 ;
+        std::uint64_t length_ = 0 ;
+
+        // multipart/byteranges bodies: regions of the file each preceded by its part header, then the closing
+        // delimiter. offset_ and length_ are not used in this case.
+        struct Part {
+            std::string header_ ;
+            std::uint64_t offset_, length_ ;
+        } ;
+
+        std::vector<Part> parts_ ;
+        std::string trailer_ ;
+    } ;
+
+    FileBody file_ ;
+
     /// Get a stock reply.
     void stockReply(Status status);
 
+    /// Empty all fields so that the object can be reused for the next request.
+    void clear();
+
     // This will correctly fill in the reply headers for sending over a file payload. It will also set status to OK.
     // If encoding is empty it will try to guess from the payload (gzip only supported)
 
@@ -55,14 +100,22 @@ struct Response
                      const time_t mod_time
                      ) ;
 
-    // This will load the file given its path name and call encode_file_data above.
-    // If no mime is provided it will try to guess from the file extension
+    // This will fill in the reply headers for the file given its path name and set it as the body to be sent (see
+    // file_). If no mime is provided it will try to guess from the file extension
 
     void encodeFile(const std::string &path_name,
                      const std::string &encoding = std::string(),
                      const std::string &mime = std::string()
                      ) ;
 
+    // Restrict a file response (see encodeFile/encodeFileData) to the byte ranges requested with a Range header,
+    // turning it into a 206 (or 416) response. Ranges are ignored if the If-Range validator does not match.
+    // Called by the connection for GET requests, so handlers do not normally need it.
+    void applyRange(const std::string &range, const std::string &if_range = std::string()) ;
+
+    // Guess the MIME type of a file from its extension (the one before .gz for compressed files)
+    static std::string fileMimeType(const std::string &path) ;
+
     // Calls write() appropriately setting the content type
     void writeJSON(const std::string &json) ;
     // Same as above taking as input a Variant converted to JSON string
@@ -71,6 +124,10 @@ struct Response
     // Will write a string and set content type and content length. It will also set status to OK.
     void write(const std::string &content, const std::string &mime = "text/html") ;
 
+    // Stream the content produced by the generator using chunked transfer encoding. Use this for large responses so that
+    // they do not have to be built in memory before sending. It will also set status to OK.
+    void writeStream(const ContentGenerator &gen, const std::string &mime = "text/html") ;
+
     // This should be used for incrementally outputting text. Content type and length have to provided afterwards
     void append(const std::string &content) ;
 
@@ -1,7 +1,9 @@
 #ifndef __SERVER_ROUTE_HPP__
 #define __SERVER_ROUTE_HPP__
 
+#include <memory>
 #include <string>
+#include <vector>
 #include <wspp/util/dictionary.hpp>
 
 
@@ -14,7 +16,8 @@ struct RouteImpl ;
 class Route {
 public:
 
-    // Create a uri path route from the given pattern.
+    // Create a uri path route from the given pattern. The pattern is compiled here and the route is not modified
+    // afterwards, so it may be matched from several threads without locking.
 
     Route(const std::string &pattern) ;
     ~Route() ;
@@ -34,6 +37,20 @@ public:
 
     std::string url(const Dictionary &params, bool relative = true) const  ;
 
+    // a path element of the pattern: a parameter if name_ is not empty, pattern_ is its regex (empty for any
+    // characters but /) or the literal text of the element
+
+    struct Element {
+        Element(const std::string &name, const std::string &pattern, bool optional):
+            name_(name), pattern_(pattern), optional_(optional) {}
+
+        std::string name_ ;
+        std::string pattern_ ;
+        bool optional_ ;
+    };
+
+    const std::vector<Element> &elements() const ;
+
 private:
 
     std::unique_ptr<RouteImpl> impl_ ;
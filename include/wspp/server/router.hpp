@@ -4,21 +4,76 @@
 #include <wspp/server/request.hpp>
 #include <wspp/server/response.hpp>
 #include <wspp/server/request_handler.hpp>
+#include <wspp/server/route.hpp>
 
 #include <functional>
+#include <map>
+#include <memory>
+#include <vector>
 #include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 namespace wspp { namespace server {
 
-class Router {
+// Maps requests to handlers by method and path.
+//
+// Route patterns (see Route) are compiled into a tree with one level per path element, so a request is resolved by
+// walking its path once instead of trying every pattern in turn. Literal elements are looked up directly, parameter
+// elements are tested against their regex. When several routes match, the one added first wins, as with a sequence of
+// Request::matches tests.
+//
+// Unlike Route::matches, a parameter is matched against a single path element, so a regex that may span slashes
+// (e.g. {path:.*}) only does so as the last element of a route, where it may take the rest of the path.
+//
+// Routes are added before the server starts; lookups do not modify the router and may run concurrently.
+
+class Router: public RequestHandler {
 public:
-    Router() {}
 
-    void addHandler() ;
+    typedef std::function<void(const Request &req, Response &resp, const Dictionary &params)> Handler ;
+
+    Router() ;
+    ~Router() ;
+
+    // add a route for the given methods (e.g. "GET|POST") and pattern. A name may be given for reverse routing
+    // with url(). Throws std::runtime_error, without adding the route, if the pattern contains an invalid regex.
+
+    void addRoute(const std::string &methods, const std::string &pattern, Handler handler,
+                  const std::string &name = std::string()) ;
+
+    // call the handler of the route matching the request, if any
+
+    bool dispatch(const Request &req, Response &resp) const ;
+
+    // dispatch the request, replying with 404 when no route matches
 
+    void handle(const Request &req, Response &resp) override ;
+
+    // generate the url of the named route replacing parameters (see Route::url)
+
+    std::string url(const std::string &name, const Dictionary &params, bool relative = true) const ;
 
 private:
 
+    struct Node ;
+    struct Match ;
+
+    void insert(Node &node, const std::vector<Route::Element> &elements, size_t pos, size_t route, bool optional) ;
+    void find(const Node &node, boost::string_ref path, unsigned int method, Match &m) const ;
+
+    struct Entry {
+        Entry(const std::string &pattern, unsigned int methods, Handler handler):
+            pattern_(pattern), route_(pattern), methods_(methods), handler_(handler) {}
+
+        std::string pattern_ ;
+        Route route_ ;
+        unsigned int methods_ ;
+        Handler handler_ ;
+    };
+
+    std::vector<std::unique_ptr<Entry>> routes_ ;
+    std::map<std::string, size_t> named_ ;
+    std::unique_ptr<Node> root_ ;
 };
 
 } // namespace server
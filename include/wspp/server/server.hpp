@@ -18,8 +18,14 @@
 #include <boost/shared_ptr.hpp>
 
 #include <wspp/server/filter_chain.hpp>
+#include <wspp/server/server_options.hpp>
 #include <wspp/server/detail/connection.hpp>
 #include <wspp/server/detail/io_service_pool.hpp>
+#include <wspp/server/detail/worker_pool.hpp>
+#include <wspp/server/detail/allocation_counter.hpp>
+#include <wspp/server/detail/admission_controller.hpp>
+#include <wspp/server/detail/http_date.hpp>
+#include <wspp/server/detail/request_tracer.hpp>
 #include <wspp/server/detail/connection_manager.hpp>
 
 
@@ -33,7 +39,10 @@ public:
     /// Construct the server to listen on the specified TCP address and port, and
     /// serve up files from the given directory.
     explicit Server(const std::string& address, const std::string& port,
-                    std::size_t io_service_pool_size = 4);
+                    std::size_t io_service_pool_size = 4,
+                    const ServerOptions &options = ServerOptions());
+
+    ~Server();
 
     // intercept filter/middleware to the service chain
 
@@ -49,34 +58,79 @@ public:
     /// Stop server loop
     void stop() ;
 
+    /// Number of open connections served by each thread of the io_service pool
+    std::vector<std::size_t> connectionsPerLoop() ;
+
+    /// Total number of connections accepted by each thread of the io_service pool
+    std::vector<std::size_t> acceptsPerLoop() ;
+
+    /// Queue depth and load of the request handler pool (all zero if handlers run on the event loop)
+    WorkerPoolStats workerPoolStats() const ;
+
+    /// Heap allocations per request (requires building with WSPP_COUNT_ALLOCATIONS)
+    AllocationStats allocationStats() const ;
+
+    /// Requests in flight, event loop lag and number of requests refused by load shedding
+    AdmissionStats admissionStats() const ;
+
 private:
-    /// Initiate an asynchronous accept operation.
-    void start_accept();
 
-    /// Handle completion of an asynchronous accept operation.
-    void handle_accept(const boost::system::error_code& e);
+    /// An acceptor together with the connection waiting to be accepted on it.
+    struct Listener {
+        Listener(boost::asio::io_service &io_service, std::size_t loop_index):
+            acceptor_(io_service), loop_index_(loop_index) {}
+
+        boost::asio::ip::tcp::acceptor acceptor_;
+
+        /// The event loop that owns the acceptor.
+        std::size_t loop_index_ ;
+
+        /// The next connection to be accepted.
+        ConnectionPtr new_connection_;
+    };
+
+    /// Open and bind a listener on the given event loop
+    void open_listener(std::size_t loop_index, const boost::asio::ip::tcp::endpoint &endpoint) ;
+
+    /// Initiate an asynchronous accept operation.
+    void start_accept(Listener &listener);
 
     /// Handle a request to stop the server.
     void handle_stop();
 
     void do_await_stop() ;
 
+    /// Export connection, admission and worker pool state with the process metrics.
+    void register_metrics() ;
+
     /// The pool of io_service objects used to perform asynchronous operations.
     detail::io_service_pool io_service_pool_;
 
     /// The signal_set is used to register for process termination notifications.
     boost::asio::signal_set signals_;
 
-    /// Acceptor used to listen for incoming connections.
-    boost::asio::ip::tcp::acceptor acceptor_;
+    /// Acceptors used to listen for incoming connections. There is a single one unless SO_REUSEPORT mode is enabled,
+    /// in which case each event loop has its own.
+    std::vector<std::unique_ptr<Listener>> listeners_;
 
     ConnectionManager connection_manager_;
 
-     /// The next socket to be accepted.
-    boost::asio::ip::tcp::socket socket_;
+    /// Refuses requests when the server is overloaded.
+    detail::admission_controller admission_ ;
+
+    /// Slow request log and trace file of the traced requests.
+    detail::request_tracer tracer_ ;
+
+    /// Keeps the Date header of responses current.
+    detail::http_date date_ ;
+
+    /// Threads running the request handlers when ServerOptions::worker_threads_ is set.
+    std::unique_ptr<detail::worker_pool> workers_ ;
 
     std::unique_ptr<RequestHandler> handler_ ;
     FilterChain filters_ ;
+
+    ServerOptions options_ ;
 };
 
 } // namespace server
@@ -0,0 +1,101 @@
+#ifndef __WSPP_SERVER_OPTIONS_HPP__
+#define __WSPP_SERVER_OPTIONS_HPP__
+
+#include <cstddef>
+#include <string>
+
+namespace wspp {
+
+namespace util { class Logger ; }
+
+namespace server {
+
+// Tunable parameters of the HTTP server. Pass an instance to the Server constructor.
+
+struct ServerOptions {
+
+    // enable HTTP/1.1 persistent connections. If false every connection is closed after the first response.
+    bool keep_alive_ = true ;
+
+    // seconds an idle persistent connection is kept open while waiting for the next request
+    size_t keep_alive_timeout_ = 5 ;
+
+    // maximum number of requests served over a single connection (0 for no limit)
+    size_t max_keep_alive_requests_ = 100 ;
+
+    // how accepted connections are assigned to the event loops of the io_service pool
+    enum Scheduling {
+        RoundRobin, // cycle through the loops
+        LeastLoaded // pick the loop currently serving the fewest connections
+    } scheduling_ = RoundRobin ;
+
+    // open one SO_REUSEPORT listening socket per event loop and let the kernel spread incoming connections
+    // between them instead of accepting everything on a single acceptor. Ignored where SO_REUSEPORT is not available.
+    bool reuse_port_ = false ;
+
+    // number of threads of a separate pool running the filter chain and request handler. With 0 handlers run
+    // directly on the event loop, which is fine for handlers that never block.
+    size_t worker_threads_ = 0 ;
+
+    // maximum size in bytes of a request body. Larger requests are refused with 413 as soon as this is known.
+    size_t max_body_size_ = 32 * 1024 * 1024 ;
+
+    // uploaded files larger than this are written to a temporary file (see Request::UploadedFile::path_)
+    size_t upload_spill_threshold_ = 1024 * 1024 ;
+
+    // directory for temporary upload files. If empty the system temporary directory is used.
+    std::string upload_dir_ ;
+
+    // seconds allowed for receiving the request line and headers once a request has started, or the first request
+    // after the connection has been accepted. Clients that are too slow get 408. 0 for no limit.
+    size_t header_timeout_ = 10 ;
+
+    // seconds the body of a request may stall between reads before 408 is sent (0 for no limit)
+    size_t body_timeout_ = 30 ;
+
+    // seconds a response write may stall before the connection is dropped (0 for no limit)
+    size_t write_timeout_ = 30 ;
+
+    // limits on the request line and headers. Requests exceeding them get 414 (URL) or 431 (headers).
+    size_t max_url_size_ = 8192 ;
+    size_t max_header_size_ = 16 * 1024 ; // total size of header names and values
+    size_t max_header_count_ = 100 ;
+
+    // maximum number of open connections (0 for no limit). Connections accepted beyond it are closed immediately.
+    size_t max_connections_ = 0 ;
+
+    // load shedding: requests arriving while max_in_flight_requests_ are being handled, or while the event loop
+    // receiving them lags more than max_loop_lag_ms_ behind, are refused with 503 and a Retry-After of retry_after_
+    // seconds (0 disables either check)
+    size_t max_in_flight_requests_ = 0 ;
+    size_t max_loop_lag_ms_ = 0 ;
+    size_t retry_after_ = 1 ;
+
+    // do not copy request headers to Request::SERVER_. Handlers should use Request::header() or Request::headers_,
+    // which reference the connection buffer instead of allocating a string per header.
+    bool header_views_ = false ;
+
+    // where exceptions escaping request handlers and content generators are reported (not reported if null)
+    util::Logger *error_logger_ = nullptr ;
+
+    // request tracing (see util::TraceContext). Each request records the time spent parsing, waiting for a worker, in the
+    // handler and the spans it opens (session, SQL, templates, gzip), and writing the response.
+
+    // add a Server-Timing header with the stages of the request to every response
+    bool server_timing_ = false ;
+
+    // log the stages of requests taking longer than slow_request_ms_ as warnings to slow_request_logger_, one in
+    // slow_request_sample_ of them (0 disables the log)
+    size_t slow_request_ms_ = 0 ;
+    size_t slow_request_sample_ = 1 ;
+    util::Logger *slow_request_logger_ = nullptr ;
+
+    // append the trace of every request to this file in the Chrome trace event format, to be opened with
+    // chrome://tracing or Perfetto. Meant for offline analysis, not for production.
+    std::string trace_file_ ;
+};
+
+} // namespace server
+} // namespace wspp
+
+#endif
@@ -2,12 +2,33 @@
 #define __UTIL_FILESYSTEM_HPP__
 
 #include <string>
+#include <cstddef>
 
 namespace wspp { namespace util {
 
 // read whole file to memory
 std::string readFileToString(const std::string &fileName) ;
 
+// read only memory map of a whole file, to parse large files without copying them
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &fileName) ;
+    ~MappedFile() ;
+
+    // false if the file could not be opened or mapped
+    bool isOpen() const { return data_ != nullptr ; }
+
+    const char *data() const { return data_ ; }
+    size_t size() const { return size_ ; }
+
+private:
+    MappedFile(const MappedFile &) = delete ;
+    MappedFile &operator=(const MappedFile &) = delete ;
+
+    const char *data_ ;
+    size_t size_ ;
+};
+
 }}
 
 
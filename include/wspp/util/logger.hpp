@@ -5,7 +5,13 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 #include <cassert>
+#include <cstdint>
+#include <ctime>
+#include <deque>
 #include <vector>
 #include <sstream>
 
@@ -15,12 +21,16 @@ namespace wspp { namespace util {
 struct LogContext
 {
     LogContext(const char *file_, int line_, const char *func_):
-        file_(file_), line_(line_), function_(func_), thread_id_( 0 ) {}
+        file_(file_), line_(line_), function_(func_), thread_id_( 0 ), time_(0), clock_(0) {}
 
     int line_ ;
     std::string function_ ;
     std::string file_ ;
     uint64_t thread_id_ ; // currently not implemented since there is no portable way of getting a numerical representation
+
+    // time and processor clock of the message if taken before formatting (by LogAsyncAppender), otherwise 0
+    time_t time_ ;
+    clock_t clock_ ;
 } ;
 
 enum LogLevel { Trace = 0, Debug = 1, Info = 2, Warning = 3, Error = 4, Fatal = 5 };
@@ -69,7 +79,18 @@ protected:
 
 private:
 
+    // a literal or a % directive of the pattern together with its format modifier
+    struct Token {
+        enum Kind { Text, Level, LevelUpper, Function, FilePath, FileName, Line, Date, Clock, Thread, Message } kind_ = Text ;
+        std::string text_ ; // literal text, or the strftime format of a date
+        bool left_align_ = false ;
+        size_t min_length_ = 0, max_length_ = std::string::npos ;
+    };
+
+    void compile(const std::string &pattern) ;
+
     std::string pattern_ ;
+    std::vector<Token> tokens_ ;
 };
 
 // a simple formatter that disregards context and logging level
@@ -104,6 +125,8 @@ public:
         return level >= threshold_ ;
     }
 
+    LogLevel threshold() const { return threshold_ ; }
+
 protected:
 
     std::string formattedMessage(LogLevel level, const LogContext &ctx, const std::string &message) {
@@ -112,8 +135,16 @@ protected:
 
 
     friend class Logger ;
+    friend class LogAsyncAppender ;
     virtual void append(LogLevel level, const LogContext &ctx, const std::string &message) = 0;
 
+    // whether appendFormatted() is implemented
+    virtual bool supportsFormatted() const { return false ; }
+
+    // write messages formatted with formattedMessage(), each followed by a newline, with a single write to the
+    // device. Only called if supportsFormatted() returns true.
+    virtual void appendFormatted(const std::string &) {}
+
 private:
 
     LogLevel threshold_ ;
@@ -131,13 +162,16 @@ public:
 protected:
 
     virtual void append(LogLevel level, const LogContext &ctx, const std::string &message) ;
+    virtual bool supportsFormatted() const { return true ; }
+    virtual void appendFormatted(const std::string &lines) ;
 
 private:
 
     std::ostream &strm_ ;
 };
 
-// Append to file
+// Append to file. When the file grows past max_file_size it is renamed and a new one is started at once; compressing
+// the old file into <file>.1.gz and shifting older backups is done by a background thread.
 
 class LogFileAppender: public LogAppender {
 public:
@@ -146,19 +180,87 @@ public:
                     size_t max_file_size = 1024*1024, // max size of file after which rotation happens
                     int max_backup_file_index = 100,   // maximum number of rotated files to keep
                     bool append = true) ;          // append messages to current file instead of starting a new record for a new instance of the appender
+    // waits for pending compressions to finish
     ~LogFileAppender() ;
 
 protected:
 
     virtual void append(LogLevel level, const LogContext &ctx, const std::string &message) ;
+    virtual bool supportsFormatted() const { return true ; }
+    virtual void appendFormatted(const std::string &lines) ;
 
 private:
 
+    void open() ;
+    void rotate() ;
+
+    // queue files renamed but not compressed by an earlier run, and number new ones after them
+    void find_rotated() ;
+
+    // background thread compressing rotated files
+    void compress_rotated() ;
+    void backup(const std::string &rotated) ;
+
     unsigned int max_file_size_ ;
     int fd_ ;
+    size_t size_ ; // bytes in the current file
     bool append_ ;
     std::string file_name_ ;
     int last_backup_file_index_, max_backup_index_;
+
+    unsigned int rotations_ = 0 ;
+    std::deque<std::string> rotated_ ; // renamed files waiting to be compressed
+    bool stop_ = false ;
+    std::mutex mutex_ ;
+    std::condition_variable wakeup_ ;
+    std::thread compressor_ ;
+};
+
+// Hands messages over to a bounded lock-free queue that a background thread drains in batches into another
+// appender, so that logging threads never wait for the device. The time of a message is taken when it is logged.
+// The writer formats the queued messages into one buffer and hands it to the appender's appendFormatted(), falling
+// back to append() per message for appenders that do not support it. The queue holds capacity messages (rounded up
+// to a power of two); what happens when it fills up is set by the overflow policy.
+
+class LogAsyncAppender: public LogAppender {
+public:
+
+    enum OverflowPolicy {
+        Block,  // wait for room in the queue, nothing is lost
+        Drop,   // discard messages that do not fit
+        Sample  // once the queue is half full keep only one in sample_rate messages, discard the rest when full
+    } ;
+
+    LogAsyncAppender(const std::shared_ptr<LogAppender> &appender, size_t capacity = 8192,
+                     OverflowPolicy policy = Block, size_t sample_rate = 10) ;
+
+    // writes out the messages still queued before returning
+    ~LogAsyncAppender() ;
+
+    // number of messages discarded so far because the queue was full
+    uint64_t dropped() const { return dropped_ ; }
+
+protected:
+
+    virtual void append(LogLevel level, const LogContext &ctx, const std::string &message) ;
+
+private:
+
+    struct Queue ;
+
+    void run() ;
+
+    std::shared_ptr<LogAppender> appender_ ;
+    std::unique_ptr<Queue> queue_ ;
+    bool batched_ ; // whether appender_ supports appendFormatted()
+    OverflowPolicy policy_ ;
+    size_t sample_rate_ ;
+
+    std::atomic<uint64_t> dropped_, sampled_ ;
+    std::atomic<bool> sleeping_, stop_ ;
+    std::mutex mutex_ ;
+    std::condition_variable wakeup_ ;
+    std::thread writer_ ;
 };
 
 // Main logger class. Forwards messages to appenders.
@@ -167,19 +269,32 @@ class Logger
 {
 
 public:
+    Logger(): min_level_(Fatal + 1), level_(Trace) {}
+
      // write a log message
 
     void write(LogLevel level, const LogContext &ctx, const char *format, ...) ;
     void addAppender(const std::shared_ptr<LogAppender> &appender);
 
+    // messages below this level are discarded, in addition to those no appender accepts
+    void setLevel(LogLevel level) ;
+
+    // true if some appender would take a message of this level. The LOG_* macros check this before building the
+    // message.
+    bool isEnabled(LogLevel level) const { return level >= min_level_.load(std::memory_order_relaxed) ; }
+
 protected:
 
     friend class LoggerStream ;
 
     void write_impl(LogLevel level, const LogContext &ctx, const std::string &message) ;
 
+    void update_min_level() ;
+
     std::mutex lock_ ;
     std::vector<std::shared_ptr<LogAppender>> appenders_ ;
+    std::atomic<int> min_level_ ;
+    LogLevel level_ ;
 };
 
 // Helper class for encapsulated a single formatted message and implement stream like log output
@@ -214,10 +329,18 @@ private:
 // this should be defined per application to return the current logger object
 extern Logger &get_current_logger() ;
 
-#define LOG_X_STREAM(logger, level, msg) LoggerStream(logger, level, LogContext(__FILE__, __LINE__, __FUNCTION__)) << msg ;
+// messages below LOG_MIN_LEVEL are compiled out, e.g. -DLOG_MIN_LEVEL=2 keeps Info and above
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// checked before the message and its context are built
+#define LOG_X_ENABLED(logger, level) ( (level) >= LOG_MIN_LEVEL && (logger).isEnabled(level) )
+
+#define LOG_X_STREAM(logger, level, msg) if ( !LOG_X_ENABLED(logger, level) ) ; else LoggerStream(logger, level, LogContext(__FILE__, __LINE__, __FUNCTION__)) << msg ;
 #define LOG_X_STREAM_IF(logger, level, condition, msg) if ( ! (condition) ) ; else LOG_X_STREAM(logger, level, msg) ;
-#define LOG_X_FORMAT(logger, level, format, ...) logger.write(level, LogContext(__FILE__, __LINE__, __FUNCTION__), format, ##__VA_ARGS__) ;
-#define LOG_X_FORMAT_IF(logger, level, condition, format, ...) if ( !(condition)) ; else logger.write(level, LogContext(__FILE__, __LINE__, __FUNCTION__), format, ##__VA_ARGS__) ;
+#define LOG_X_FORMAT(logger, level, format, ...) if ( !LOG_X_ENABLED(logger, level) ) ; else logger.write(level, LogContext(__FILE__, __LINE__, __FUNCTION__), format, ##__VA_ARGS__) ;
+#define LOG_X_FORMAT_IF(logger, level, condition, format, ...) if ( !(condition)) ; else LOG_X_FORMAT(logger, level, format, ##__VA_ARGS__) ;
 
 #define LOG_X_STREAM_EVERY_N(logger, level, n, msg)\
 do {\
@@ -0,0 +1,206 @@
+#ifndef __WSPP_UTIL_METRICS_HPP__
+#define __WSPP_UTIL_METRICS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace wspp { namespace util {
+
+// Process-wide counters, gauges and latency histograms, exported in the Prometheus text format.
+//
+// Counters and histograms are split in per-thread shards, so that updating them is a relaxed atomic add on a cache
+// line that other threads rarely touch. Shards are only summed when the values are read.
+
+namespace detail {
+
+static const size_t metric_shards = 8 ;
+
+// shard used by the calling thread
+size_t metric_shard() ;
+
+}
+
+// Monotonically increasing count
+
+class Counter {
+public:
+    Counter() ;
+
+    void inc(uint64_t n = 1) {
+        shards_[detail::metric_shard()].value_.fetch_add(n, std::memory_order_relaxed) ;
+    }
+
+    uint64_t value() const ;
+
+private:
+    struct Shard {
+        std::atomic<uint64_t> value_ ;
+        char pad_[64 - sizeof(std::atomic<uint64_t>)] ;
+    };
+
+    Shard shards_[detail::metric_shards] ;
+};
+
+// Value that can go up and down
+
+class Gauge {
+public:
+    Gauge(): value_(0) {}
+
+    void inc(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed) ; }
+    void dec(int64_t n = 1) { value_.fetch_sub(n, std::memory_order_relaxed) ; }
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed) ; }
+
+    int64_t value() const { return value_.load(std::memory_order_relaxed) ; }
+
+private:
+    std::atomic<int64_t> value_ ;
+};
+
+// Distribution of durations in microseconds, from 1us to over four hours. Buckets are HDR style: each power of two is
+// split in 8 linear sub-buckets, so any value is known within 12.5%.
+
+class Histogram {
+public:
+    static const unsigned sub_buckets = 8 ;
+    static const unsigned num_buckets = 32 * sub_buckets ;
+
+    Histogram() ;
+
+    void observe(uint64_t micros) {
+        Shard &s = shards_[detail::metric_shard()] ;
+        s.buckets_[bucket(micros)].fetch_add(1, std::memory_order_relaxed) ;
+        s.sum_.fetch_add(micros, std::memory_order_relaxed) ;
+    }
+
+    void observe(std::chrono::steady_clock::duration d) {
+        observe(std::chrono::duration_cast<std::chrono::microseconds>(d).count()) ;
+    }
+
+    // bucket counts summed over all shards
+    std::vector<uint64_t> buckets() const ;
+
+    uint64_t count() const ;
+    uint64_t sum() const ; // in microseconds
+
+    // estimated value below which the given fraction of the observations falls, in microseconds
+    uint64_t quantile(double q) const ;
+
+    static unsigned bucket(uint64_t micros) ;
+
+    // values of a bucket are below this bound
+    static uint64_t upper_bound(unsigned bucket) ;
+
+private:
+    struct Shard {
+        std::atomic<uint64_t> buckets_[num_buckets] ;
+        std::atomic<uint64_t> sum_ ;
+    };
+
+    std::unique_ptr<Shard[]> shards_ ;
+};
+
+// Records the time from its construction to its destruction in a histogram
+
+class MetricTimer {
+public:
+    explicit MetricTimer(Histogram &h): histogram_(h), start_(std::chrono::steady_clock::now()) {}
+    ~MetricTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_) ; }
+
+private:
+    Histogram &histogram_ ;
+    std::chrono::steady_clock::time_point start_ ;
+};
+
+// All metrics of a name, one per combination of label values. Metrics are created on first use and live as long as
+// the registry. A thread caches the metrics it has used so that with() does not lock after the first time.
+
+template <class M>
+class MetricFamily {
+public:
+
+    // metric for the given label values, in the order of the label names of the family
+    M &with(std::initializer_list<boost::string_ref> values) ;
+
+private:
+
+    friend class MetricsRegistry ;
+
+    MetricFamily(const std::string &name, const std::string &help, const std::vector<std::string> &labels):
+        name_(name), help_(help), labels_(labels) {}
+
+    std::string name_, help_ ;
+    std::vector<std::string> labels_ ;
+
+    mutable std::mutex mutex_ ;
+    std::map<std::vector<std::string>, std::unique_ptr<M>> metrics_ ;
+};
+
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels ;
+
+class MetricsRegistry {
+public:
+
+    static MetricsRegistry &instance() ;
+
+    // get or create the family with the given name. The label names have to be the same every time.
+    MetricFamily<Counter> &counters(const std::string &name, const std::string &help, const std::vector<std::string> &labels) ;
+    MetricFamily<Gauge> &gauges(const std::string &name, const std::string &help, const std::vector<std::string> &labels) ;
+    MetricFamily<Histogram> &histograms(const std::string &name, const std::string &help, const std::vector<std::string> &labels) ;
+
+    // metrics without labels
+    Counter &counter(const std::string &name, const std::string &help) { return counters(name, help, {}).with({}) ; }
+    Gauge &gauge(const std::string &name, const std::string &help) { return gauges(name, help, {}).with({}) ; }
+    Histogram &histogram(const std::string &name, const std::string &help) { return histograms(name, help, {}).with({}) ; }
+
+    // values computed when the metrics are exported, e.g. read from another component. The callback fills in the
+    // samples of a gauge (or counter); it runs until removeCollectors() is called with the same owner.
+    typedef std::function<void(std::vector<std::pair<MetricLabels, double>> &)> Collector ;
+
+    void addCollector(const void *owner, const std::string &name, const std::string &help, const Collector &c,
+                      const std::string &type = "gauge") ;
+    void removeCollectors(const void *owner) ;
+
+    // all metrics in the Prometheus text exposition format (version 0.0.4)
+    std::string prometheusText() const ;
+
+private:
+
+    MetricsRegistry() {}
+
+    template <class M>
+    MetricFamily<M> &family(std::map<std::string, std::unique_ptr<MetricFamily<M>>> &families, const std::string &name,
+                            const std::string &help, const std::vector<std::string> &labels) ;
+
+    struct CollectorEntry {
+        const void *owner_ ;
+        std::string name_, help_, type_ ;
+        Collector collector_ ;
+    };
+
+    mutable std::mutex mutex_ ;
+    std::map<std::string, std::unique_ptr<MetricFamily<Counter>>> counters_ ;
+    std::map<std::string, std::unique_ptr<MetricFamily<Gauge>>> gauges_ ;
+    std::map<std::string, std::unique_ptr<MetricFamily<Histogram>>> histograms_ ;
+    std::vector<CollectorEntry> collectors_ ;
+};
+
+extern template class MetricFamily<Counter> ;
+extern template class MetricFamily<Gauge> ;
+extern template class MetricFamily<Histogram> ;
+
+} // namespace util
+} // namespace wspp
+
+#endif
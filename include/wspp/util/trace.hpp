@@ -0,0 +1,112 @@
+#ifndef __WSPP_UTIL_TRACE_HPP__
+#define __WSPP_UTIL_TRACE_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wspp { namespace util {
+
+// Timeline of a single request: a list of named, possibly nested, timed spans.
+//
+// The server makes the trace of a request current on the thread running its handler, so that code called from the
+// handler (session storage, database statements, template rendering or user code) can add spans with TraceSpan
+// without being passed the trace. When tracing is disabled there is no current trace and spans cost a thread local
+// load.
+
+class TraceContext {
+public:
+    typedef std::chrono::steady_clock clock ;
+
+    struct Span {
+        std::string name_ ;
+        unsigned depth_ ;    // number of spans enclosing this one
+        int64_t start_ ;     // microseconds since the start of the trace
+        int64_t duration_ ;  // in microseconds, -1 while the span is open
+    };
+
+    TraceContext(): size_(0), depth_(0) {}
+
+    // clear the spans and start timing at t. The memory of the spans is kept for the next use.
+    void start(clock::time_point t = clock::now()) ;
+    void clear() { size_ = depth_ = 0 ; }
+
+    clock::time_point startTime() const { return start_ ; }
+
+    // microseconds elapsed since the start of the trace
+    int64_t elapsed(clock::time_point t = clock::now()) const ;
+
+    // open a span nested in the ones currently open, returning its index for close()
+    size_t open(const char *name) ;
+    void close(size_t index) ;
+
+    // add a closed span measured elsewhere
+    void add(const char *name, clock::time_point start, clock::time_point end) ;
+
+    size_t size() const { return size_ ; }
+    const Span &operator[](size_t i) const { return spans_[i] ; }
+
+    // closed spans in the format of the Server-Timing header, durations of spans of the same name added up
+    // e.g. "parse;dur=0.05, sql;desc=\"3x\";dur=1.27, render;dur=4.8"
+    std::string serverTiming() const ;
+
+    // spans with their durations in milliseconds, nested spans in braces
+    // e.g. "parse 0.05, handler 6.41 { session_read 0.3, sql 1.27, render 4.8 }, write 0.02"
+    std::string summary() const ;
+
+    // trace of the calling thread, or null
+    static TraceContext *current() ;
+
+    // makes a trace current on the calling thread for the lifetime of the object, restoring the previous one
+    class Scope {
+    public:
+        explicit Scope(TraceContext *trace) ;
+        ~Scope() ;
+
+    private:
+        Scope(const Scope &) = delete ;
+        Scope &operator=(const Scope &) = delete ;
+
+        TraceContext *previous_ ;
+    };
+
+private:
+
+    Span &next_span(const char *name) ;
+
+    clock::time_point start_ ;
+    std::vector<Span> spans_ ; // only the first size_ are in use
+    size_t size_ ;
+    unsigned depth_ ;
+};
+
+// Times its own lifetime as a span of the current trace, if any:
+//
+//    {
+//        TraceSpan span("geocode") ;
+//        ...
+//    }
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name): trace_(TraceContext::current()) {
+        if ( trace_ ) index_ = trace_->open(name) ;
+    }
+
+    ~TraceSpan() {
+        if ( trace_ ) trace_->close(index_) ;
+    }
+
+private:
+    TraceSpan(const TraceSpan &) = delete ;
+    TraceSpan &operator=(const TraceSpan &) = delete ;
+
+    TraceContext *trace_ ;
+    size_t index_ ;
+};
+
+} // namespace util
+} // namespace wspp
+
+#endif
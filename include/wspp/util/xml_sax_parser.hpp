@@ -20,6 +20,8 @@ public:
     enum ErrorCode { InvalidChar, NoClosingQuote, InvalidHeader, TagMismatch, TagInvalid, AttrValueInvalid, InvalidXml } ;
 
     XMLSAXParser(const std::string &src) ;
+    // parse a buffer that has to outlive the parser, e.g. a memory mapped file
+    XMLSAXParser(const char *src, size_t size) ;
 
     // parse input stream and return true if succesfull, errors are reported through an error callback
 
@@ -47,7 +49,7 @@ public:
 private:
 
     struct Cursor {
-        Cursor(const std::string &src): cursor_(src.begin()), end_(src.end()) {}
+        Cursor(const char *src, size_t size): cursor_(src), end_(src + size) {}
 
         operator bool () const { return cursor_ != end_ ; }
         char operator * () const { return *cursor_ ; }
@@ -69,7 +71,7 @@ private:
             cursor_ ++ ;
         }
 
-        std::string::const_iterator cursor_, end_ ;
+        const char *cursor_, *end_ ;
         uint column_ = 1;
         uint line_ = 1;
     } ;
@@ -93,7 +95,6 @@ private:
     bool expect(const char *str) ;
     bool escapeString(std::string &value);
 
-    const std::string &src_ ;
     Cursor cursor_ ;
 
 };
@@ -34,9 +34,11 @@
 #include <boost/filesystem.hpp>
 
 #include <wspp/server/route.hpp>
+#include <wspp/server/router.hpp>
 #include <wspp/server/filters/request_logger.hpp>
 #include <wspp/server/filters/static_file_handler.hpp>
 #include <wspp/server/filters/gzip_filter.hpp>
+#include <wspp/server/filters/metrics_filter.hpp>
 
 #include <spatialite.h>
 #include <wspp/util/i18n.hpp>
@@ -84,7 +86,9 @@ class DefaultLogger: public Logger
 public:
     DefaultLogger(const std::string &log_file, bool debug) {
         if ( debug ) addAppender(std::make_shared<LogStreamAppender>(Trace, make_shared<LogPatternFormatter>("%In function %c, %F:%l: %m"), std::cerr)) ;
-        addAppender(std::make_shared<LogFileAppender>(Info, make_shared<LogPatternFormatter>("%V [%d{%c}]: %m"), log_file)) ;
+        // request threads only queue the message, the file is written by a background thread
+        addAppender(std::make_shared<LogAsyncAppender>(
+                        std::make_shared<LogFileAppender>(Info, make_shared<LogPatternFormatter>("%V [%d{%c}]: %m"), log_file))) ;
     }
 };
 
@@ -112,54 +116,225 @@ public:
             return Variant(engine_.renderString(unpacked[0].toString(), unpacked[1].toObject() ), true) ;
         }) ;
 
+        setupRoutes() ;
     }
 
     void handle(const Request &req, Response &resp) override {
 
-        Connection con("sqlite:db=" + root_ + "/routes.sqlite") ; // establish connection with database
+        // request router
 
-        Session session(session_handler_, req, resp) ; // start a new session
+        if ( router_.dispatch(req, resp) ) return ;
 
-        DefaultAuthorizationModel auth(Variant::fromJSONFile(root_ + "templates/acm.json")) ;
-        User user(req, resp, session, con, auth) ; // setup authentication
+        // not matched : static files are served by the StaticFileHandler filter, which checks for a 404 status. This
+        // path is taken for every asset, so it does not throw.
+        resp.stockReply(Response::not_found) ;
 
-        PageView page(user, Variant::fromJSONFile(root_ + "templates/menu.json")) ; // global page data
+    }
 
-        // request router
 
-        if ( RouteController(req, resp, con, user, engine_, page).dispatch() ) return ;
-        if ( req.matches("GET", "/map/") ) {
+private:
+
+    // per request state shared by the controllers
+
+    struct Context {
+        Context(RoutesApp &app, const Request &req, Response &resp):
+            con_("sqlite:db=" + app.root_ + "/routes.sqlite"), // establish connection with database
+            session_(app.session_handler_, req, resp), // start a new session
+            auth_(Variant::fromJSONFile(app.root_ + "templates/acm.json")),
+            user_(req, resp, session_, con_, auth_), // setup authentication
+            page_(user_, Variant::fromJSONFile(app.root_ + "templates/menu.json")) // global page data
+        {}
+
+        // require a logged in user, with the given permission if any
+        void authorize(const char *action = nullptr) {
+            if ( !user_.check() || ( action && !user_.can(action) ) )
+                throw HttpResponseException(Response::unauthorized) ;
+        }
+
+        Connection con_ ;
+        Session session_ ;
+        DefaultAuthorizationModel auth_ ;
+        User user_ ;
+        PageView page_ ;
+    };
+
+    typedef std::function<void(Context &ctx, const Request &req, Response &resp, const Dictionary &params)> Handler ;
+
+    void route(const char *methods, const char *pattern, Handler handler) {
+        router_.addRoute(methods, pattern, [this, handler](const Request &req, Response &resp, const Dictionary &params) {
+            Context ctx(*this, req, resp) ;
+            handler(ctx, req, resp, params) ;
+        }) ;
+    }
+
+    // all application urls, matched in this order
+
+    void setupRoutes() {
+
+        // routes
+
+        route("GET", "/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).browse(std::string()) ;
+        }) ;
+        route("GET", "/mountain/{mountain:[\\w]+}?", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).browse(params.get("mountain")) ;
+        }) ;
+        route("GET", "/routes/edit/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).edit() ;
+        }) ;
+        route("GET", "/routes/list/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).list() ;
+        }) ;
+        route("GET|POST", "/routes/add/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).create() ;
+        }) ;
+        route("GET|POST", "/routes/update/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).update() ;
+        }) ;
+        route("GET", "/route/edit/{id}/", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).edit(params.get("id")) ;
+        }) ;
+        route("POST", "/route/publish/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).publish() ;
+        }) ;
+        route("POST", "/routes/delete/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).remove() ;
+        }) ;
+        route("POST", "/query/route", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).query() ;
+        }) ;
+        route("GET", "/download/track/{format:gpx|kml}/{id}", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).download(params.get("format"), params.get("id")) ;
+        }) ;
+        route("GET", "/track/{id}/", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).track(params.get("id")) ;
+        }) ;
+        route("GET", "/view/{id}/", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            RouteController(req, resp, c.con_, c.user_, engine_, c.page_).view(params.get("id")) ;
+        }) ;
+
+        route("GET", "/map/", [this](Context &c, const Request &, Response &resp, const Dictionary &) {
             Variant::Object ctx{
-                         { "page", page.data("map", _("Routes Map")) }
+                         { "page", c.page_.data("map", _("Routes Map")) }
             } ;
 
             resp.write(engine_.render("map", ctx)) ;
-            return ;
+        }) ;
 
-        }
-        if ( AttachmentController(req, resp, con, user, engine_, root_ + "/data/uploads/").dispatch() ) return ;
-        if ( WaypointController(req, resp, con, user, engine_).dispatch() ) return ;
-        if ( PageController(req, resp, con, user, engine_, page).dispatch() ) return ;
-        if ( UsersController(req, resp, con, user, engine_, page).dispatch() ) return ;
-        if ( LoginController(user, req, resp, engine_).dispatch() ) return ;
-
-        // not matched : try static file
-        fs::path p(root_ + req.path_)  ;
-        if ( fs::exists(p) && fs::is_regular_file(p) ) {
-            resp.encodeFile(p.string());
-            return ;
-        }
+        // attachments
 
-        throw HttpResponseException(Response::not_found) ;
+        const string uploads = root_ + "/data/uploads/" ;
 
-    }
+        route("GET", "/attachments/{id:\\d+}/list", [this, uploads](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            AttachmentController(req, resp, c.con_, c.user_, engine_, uploads).list(params.get("id")) ;
+        }) ;
+        route("GET|POST", "/attachments/{id:\\d+}/add", [this, uploads](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            AttachmentController(req, resp, c.con_, c.user_, engine_, uploads).create(params.get("id")) ;
+        }) ;
+        route("GET|POST", "/attachments/{id:\\d+}/update", [this, uploads](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            AttachmentController(req, resp, c.con_, c.user_, engine_, uploads).update(params.get("id")) ;
+        }) ;
+        route("POST", "/attachments/{id:\\d+}/delete", [this, uploads](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            AttachmentController(req, resp, c.con_, c.user_, engine_, uploads).remove(params.get("id")) ;
+        }) ;
 
+        // waypoints
 
-private:
+        route("GET", "/wpts/{id:\\d+}/list", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            WaypointController(req, resp, c.con_, c.user_, engine_).list(params.get("id")) ;
+        }) ;
+        route("GET|POST", "/wpts/{id:\\d+}/update", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            WaypointController(req, resp, c.con_, c.user_, engine_).update(params.get("id")) ;
+        }) ;
+        route("POST", "/wpts/{id:\\d+}/delete", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            WaypointController(req, resp, c.con_, c.user_, engine_).remove(params.get("id")) ;
+        }) ;
+
+        // pages
+
+        route("GET", "/pages/edit/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("pages.edit") ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).edit() ;
+        }) ;
+        route("GET", "/pages/list/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).fetch() ;
+        }) ;
+        route("GET|POST", "/pages/add/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).create() ;
+        }) ;
+        route("GET|POST", "/pages/update/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).update() ;
+        }) ;
+        route("GET", "/page/edit/{id}/", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).edit(params.get("id")) ;
+        }) ;
+        route("POST", "/page/publish/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).publish() ;
+        }) ;
+        route("POST", "/pages/delete/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize() ;
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).remove() ;
+        }) ;
+        route("GET", "/page/{id}/", [this](Context &c, const Request &req, Response &resp, const Dictionary &params) {
+            PageController(req, resp, c.con_, c.user_, engine_, c.page_).show(params.get("id")) ;
+        }) ;
+
+        // users
+
+        route("GET", "/users/edit/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("users.edit") ;
+            UsersController(req, resp, c.con_, c.user_, engine_, c.page_).edit() ;
+        }) ;
+        route("GET", "/users/list/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("users.list") ;
+            UsersController(req, resp, c.con_, c.user_, engine_, c.page_).fetch() ;
+        }) ;
+        route("GET|POST", "/users/add/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("users.add") ;
+            UsersController(req, resp, c.con_, c.user_, engine_, c.page_).create() ;
+        }) ;
+        route("GET|POST", "/users/update/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("users.modify") ;
+            UsersController(req, resp, c.con_, c.user_, engine_, c.page_).update() ;
+        }) ;
+        route("POST", "/users/delete/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            c.authorize("users.delete") ;
+            UsersController(req, resp, c.con_, c.user_, engine_, c.page_).remove() ;
+        }) ;
+
+        // login
+
+        route("GET|POST", "/user/login/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            LoginController(c.user_, req, resp, engine_).login() ;
+        }) ;
+        route("POST", "/user/logout/", [this](Context &c, const Request &req, Response &resp, const Dictionary &) {
+            LoginController(c.user_, req, resp, engine_).logout() ;
+        }) ;
+    }
 
     SessionHandler &session_handler_ ;
     string root_ ;
     TemplateRenderer engine_ ;
+    Router router_ ;
 };
 
 
@@ -178,11 +353,15 @@ int main(int argc, char *argv[]) {
     i18n::instance().addDomain("messages") ;
     i18n::instance().addPath(".") ;
 
-    Server server("127.0.0.1", "5000") ;
+    DefaultLogger logger("/tmp/logger", true) ;
+
+    ServerOptions options ;
+    options.error_logger_ = &logger ;
+
+    Server server("127.0.0.1", "5000", 4, options) ;
   //  Server server("127.0.0.1", "5000") ;
 
     FileSystemSessionHandler sh ;
-    DefaultLogger logger("/tmp/logger", true) ;
 
     const string root = "/home/malasiot/source/ws/data/routes/" ;
     RoutesApp *service = new RoutesApp(root, sh) ;
@@ -191,6 +370,8 @@ int main(int argc, char *argv[]) {
 
     server.addFilter(new RequestLoggerFilter(logger)) ;
     server.addFilter(new GZipFilter()) ;
+    server.addFilter(new MetricsFilter()) ;
+    server.addFilter(new StaticFileHandler(root)) ;
 
     server.run() ;
 }
@@ -5,17 +5,13 @@
 
 #include <wspp/views/table.hpp>
 #include <wspp/server/exceptions.hpp>
+#include <wspp/util/filesystem.hpp>
 
 using namespace std ;
 using namespace wspp::util ;
 using namespace wspp::web ;
 using namespace wspp::server ;
 
-static Route route_list("/attachments/{id:\\d+}/list") ;
-static Route route_add("/attachments/{id:\\d+}/add") ;
-static Route route_update("/attachments/{id:\\d+}/update") ;
-static Route route_delete("/attachments/{id:\\d+}/delete") ;
-
 AttachmentCreateForm::AttachmentCreateForm(const Request &req, RouteModel &routes, const string &route_id,
                                            const string &upload_folder):
     request_(req), routes_(routes), upload_folder_(upload_folder), route_id_(route_id) {
@@ -31,8 +27,15 @@ AttachmentCreateForm::AttachmentCreateForm(const Request &req, RouteModel &route
 void AttachmentCreateForm::onSuccess(const Request &request)
 {
    auto it = request.FILE_.find("attachment-file") ;
-
-   routes_.createAttachment(route_id_, it->second.name_, getValue("type"), it->second.data_, upload_folder_) ;
+   const Request::UploadedFile &up = it->second ;
+
+   // large uploads are kept in a temporary file instead of data_, which is moved to the upload folder
+   if ( !up.path_.empty() ) {
+       if ( !routes_.createAttachment(route_id_, up.name_, getValue("type"), boost::filesystem::path(up.path_), upload_folder_) )
+           throw HttpResponseException(Response::internal_server_error) ;
+   }
+   else
+       routes_.createAttachment(route_id_, up.name_, getValue("type"), up.data_, upload_folder_) ;
 }
 
 
@@ -111,34 +114,6 @@ void AttachmentController::remove(const std::string &route_id)
     }
 }
 
-bool AttachmentController::dispatch()
-{
-    Dictionary attributes ;
-
-    bool logged_in = user_.check() ;
-
-    if ( request_.matches("GET", route_list, attributes) ) {
-        if ( logged_in ) list(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", route_add, attributes) ) {
-        if ( logged_in ) create(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", route_update, attributes) ) {
-        if ( logged_in ) update(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", route_delete, attributes) ) {
-        if ( logged_in ) remove(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    } else return false ;
-}
-
 void AttachmentController::list(const std::string &route_id)
 {
     AttachmentTableView view(con_, route_id) ;
@@ -50,8 +50,6 @@ public:
                    Connection &con, User &user, TemplateRenderer &engine, const std::string &upload_folder): routes_(con), con_(con),
     request_(req), response_(resp), user_(user), engine_(engine), upload_folder_(upload_folder) {}
 
-    bool dispatch() ;
-
     void list(const std::string &route_id) ;
     void create(const std::string &route_id) ;
     void remove(const std::string &route_id) ;
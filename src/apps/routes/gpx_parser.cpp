@@ -8,6 +8,9 @@ using namespace std ;
 GpxParser::GpxParser(const string &src, RouteGeometry &geom): XMLSAXParser(src), geom_(geom) {
 }
 
+GpxParser::GpxParser(const char *src, size_t size, RouteGeometry &geom): XMLSAXParser(src, size), geom_(geom) {
+}
+
 void GpxParser::startElement(const std::string &qname, const XMLSAXParser::AttributeList &attrs) {
     if ( qname == "gpx" ) {
         is_gpx_document_ = true ;
@@ -12,6 +12,7 @@ struct RouteGeometry ;
 class GpxParser: public XMLSAXParser {
 public:
     GpxParser(const std::string &src, RouteGeometry &geom);
+    GpxParser(const char *src, size_t size, RouteGeometry &geom);
 
     virtual void startElement(const std::string &qname, const AttributeList &attrs) override ;
 
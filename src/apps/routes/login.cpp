@@ -83,14 +83,6 @@ void LoginForm::onSuccess(const Request &request) {
     auth_.persist(username, user_id, role, remember_me) ;
 }
 
-bool LoginController::dispatch()
-{
-    if ( request_.matches("GET|POST", "/user/login/") ) login() ;
-    else if ( request_.matches("POST", "/user/logout/") ) logout() ;
-    else return false ;
-    return true ;
-}
-
 void LoginController::login()
 {
     LoginForm form(user_) ;
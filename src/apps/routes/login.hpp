@@ -21,7 +21,6 @@ public:
     LoginController(User &user, const Request &req, Response &resp, TemplateRenderer &engine):
     request_(req), response_(resp), user_(user), engine_(engine) {}
 
-    bool dispatch() ;
     void login() ;
     void logout() ;
 
@@ -157,57 +157,6 @@ void PageController::remove()
 
 }
 
-bool PageController::dispatch()
-{
-    if ( !boost::starts_with(request_.path_, "/page") ) return false ;
-
-    Dictionary attributes ;
-
-    bool logged_in = user_.check() ;
-
-    if ( request_.matches("GET", "/pages/edit/") ) { // load page list editor
-        if ( logged_in && user_.can("pages.edit")) edit() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET", "/pages/list/") ) { // fetch table data
-        if ( logged_in ) fetch() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/pages/add/") ) {
-        if ( logged_in ) create() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/pages/update/") ) {
-        if ( logged_in ) update() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/page/edit/{id}/", attributes) ) {
-        if ( logged_in ) edit(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/page/publish/") ) {
-        if ( logged_in ) publish() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/pages/delete/") ) {
-        if ( logged_in ) remove() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/page/{id}/", attributes) ) {
-        show(attributes.get("id")) ;
-        return true ;
-    }
-    else
-        return false ;
-}
-
 void PageController::show(const std::string &page_id)
 {
     QueryResult res = con_.query("SELECT id, title, content FROM pages WHERE permalink=?", page_id) ;
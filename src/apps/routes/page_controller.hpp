@@ -48,8 +48,6 @@ public:
                    PageView &page): con_(con),
     request_(req), response_(resp), user_(user), engine_(engine), page_(page) {}
 
-    bool dispatch() ;
-
     void show(const string &page_id) ;
 
     void create() ;
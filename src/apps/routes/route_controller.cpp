@@ -5,6 +5,7 @@
 
 #include <wspp/views/table.hpp>
 #include <wspp/server/exceptions.hpp>
+#include <wspp/util/filesystem.hpp>
 
 #include "gpx_parser.hpp"
 
@@ -29,9 +30,18 @@ RouteCreateForm::RouteCreateForm(const Request &req, RouteModel &routes): reques
 
             const Request::UploadedFile &up = it->second ;
 
-            GpxParser parser(up.data_, geom_) ;
-            if ( !parser.parse() )
-                throw FormFieldValidationError("Not valid GPX file") ;
+            // large uploads are kept in a temporary file instead of data_, which is parsed in place
+            if ( up.path_.empty() ) {
+                GpxParser parser(up.data_, geom_) ;
+                if ( !parser.parse() )
+                    throw FormFieldValidationError("Not valid GPX file") ;
+            }
+            else {
+                MappedFile file(up.path_) ;
+                GpxParser parser(file.data(), file.size(), geom_) ;
+                if ( !file.isOpen() || !parser.parse() )
+                    throw FormFieldValidationError("Not valid GPX file") ;
+            }
     }) ;
 }
 
@@ -218,75 +228,6 @@ void RouteController::remove()
     }
 }
 
-bool RouteController::dispatch()
-{
-    Dictionary attributes ;
-
-    bool logged_in = user_.check() ;
-
-    if ( request_.matches("GET", "/")  ) {
-        browse(std::string()) ;
-        return true ;
-    }
-    if ( request_.matches("GET", "/mountain/{mountain:[\\w]+}?", attributes)  ) {
-        browse(attributes.get("mountain")) ;
-        return true ;
-    }
-    if ( request_.matches("GET", "/routes/edit/") ) {
-        if ( logged_in ) edit() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET", "/routes/list/") ) {
-        if ( logged_in ) list() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/routes/add/") ) {
-        if ( logged_in ) create() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/routes/update/") ) {
-        if ( logged_in ) update() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/route/edit/{id}/", attributes) ) {
-        if ( logged_in ) edit(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/route/publish/") ) {
-        if ( logged_in ) publish() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/routes/delete/") ) {
-        if ( logged_in ) remove() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/query/route") ) {
-        query() ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/download/track/{format:gpx|kml}/{id}", attributes) ) {
-        download(attributes.get("format"), attributes.get("id")) ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/track/{id}/", attributes) ) {
-        track(attributes.get("id")) ;
-        return true ;
-    }
-    else if ( request_.matches("GET", "/view/{id}/", attributes) ) {
-        view(attributes.get("id")) ;
-        return true ;
-    }
-    else
-        return false ;
-}
-
 void RouteController::view(const std::string &route_id) {
 
     Variant route = routes_.fetch(route_id) ;
@@ -57,8 +57,6 @@ public:
                    PageView &page): routes_(con), con_(con),
     request_(req), response_(resp), user_(user), engine_(engine), page_(page) {}
 
-    bool dispatch() ;
-
     void view(const string &route_id) ;
     void browse(const std::string &mountain) ;
     void list() ;
@@ -15,6 +15,7 @@
 using namespace std ;
 using namespace wspp::util ;
 using namespace wspp::db ;
+namespace fs = boost::filesystem ;
 
 RouteModel::RouteModel(Connection &con): con_(con) {
     fetchMountains() ;
@@ -174,11 +175,16 @@ bool RouteModel::importRoute(const string &title, const string &mountain_id, con
     trans.commit() ;
 }
 
-bool RouteModel::createAttachment(const string &route_id, const string &name, const string &type_id, const string &data, const string &upload_folder) {
-    string extension, target ;
+// random file name keeping the extension of the original
+static string attachment_file_name(const string &name) {
+    string extension ;
     size_t pos = name.rfind('.') ;
     if ( pos != string::npos ) extension = name.substr(pos) ;
-    target = binToHex(randomBytes()) + extension ;
+    return binToHex(randomBytes()) + extension ;
+}
+
+bool RouteModel::createAttachment(const string &route_id, const string &name, const string &type_id, const string &data, const string &upload_folder) {
+    string target = attachment_file_name(name) ;
 
     ofstream ostrm(upload_folder + '/' + target) ;
     ostrm.write(&data[0], data.size()) ;
@@ -190,6 +196,25 @@ bool RouteModel::createAttachment(const string &route_id, const string &name, co
     return true ;
 }
 
+bool RouteModel::createAttachment(const string &route_id, const string &name, const string &type_id, const fs::path &file, const string &upload_folder) {
+    string target = attachment_file_name(name) ;
+    fs::path dest = fs::path(upload_folder) / target ;
+
+    // renaming fails if the file is on another file system than the upload folder
+    boost::system::error_code ec ;
+    fs::rename(file, dest, ec) ;
+    if ( ec ) {
+        fs::copy_file(file, dest, ec) ;
+        if ( ec ) return false ;
+    }
+
+    Statement stmt(con_, "INSERT INTO attachments (route, 'type', name, url) VALUES (?, ?, ?, ?)", route_id, type_id, name, target);
+
+    stmt.exec() ;
+
+    return true ;
+}
+
 Variant RouteModel::exportGeoJSON(const RouteGeometry &g) {
 
     Variant::Array track_features, wpt_features ;
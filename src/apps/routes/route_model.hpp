@@ -4,6 +4,8 @@
 #include <wspp/database/connection.hpp>
 #include <wspp/util/variant.hpp>
 
+#include <boost/filesystem.hpp>
+
 #include "route_geometry.hpp"
 
 using wspp::db::Connection ;
@@ -43,6 +45,8 @@ class RouteModel {
 
     bool importRoute(const std::string &title, const std::string &role_id, const RouteGeometry &geom) ;
     bool createAttachment(const std::string &route_id, const std::string &name, const std::string &type_id, const std::string &data, const std::string &upload_folder) ;
+    // same as above but the attachment is moved from a file, e.g. an upload spilled to disk
+    bool createAttachment(const std::string &route_id, const std::string &name, const std::string &type_id, const boost::filesystem::path &file, const std::string &upload_folder) ;
 
     void fetchGeometry(const std::string &route_id, RouteGeometry &geom) ;
 
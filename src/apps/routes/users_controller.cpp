@@ -172,43 +172,6 @@ void UsersController::remove()
 
 }
 
-bool UsersController::dispatch()
-{
-    if ( !boost::starts_with(request_.path_, "/users") ) return false ;
-
-    Dictionary attributes ;
-
-    bool logged_in = user_.check() ;
-
-    if ( request_.matches("GET", "/users/edit/") ) { // load users list editor
-        if ( logged_in && user_.can("users.edit")) edit() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET", "/users/list/") ) { // fetch table data
-        if ( logged_in && user_.can("users.list")) fetch() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/users/add/") ) {
-        if ( logged_in && user_.can("users.add")) create() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/users/update/") ) {
-        if ( logged_in && user_.can("users.modify")) update() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/users/delete/") ) {
-        if ( logged_in && user_.can("users.delete") ) remove() ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else
-        return false ;
-}
-
 
 
 
@@ -28,8 +28,6 @@ public:
                    PageView &page):
     request_(req), response_(resp), user_(user), engine_(engine), page_(page), con_(con) {}
 
-    bool dispatch() ;
-
     void create() ;
 
     void edit() ;
@@ -82,29 +82,6 @@ void WaypointController::remove(const std::string &route_id)
     }
 }
 
-bool WaypointController::dispatch()
-{
-    Dictionary attributes ;
-
-    bool logged_in = user_.check() ;
-
-    if ( request_.matches("GET", "/wpts/{id:\\d+}/list", attributes) ) {
-        if ( logged_in ) list(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    if ( request_.matches("GET|POST", "/wpts/{id:\\d+}/update", attributes) ) {
-        if ( logged_in ) update(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    }
-    else if ( request_.matches("POST", "/wpts/{id:\\d+}/delete", attributes) ) {
-        if ( logged_in ) remove(attributes.get("id")) ;
-        else throw HttpResponseException(Response::unauthorized) ;
-        return true ;
-    } else return false ;
-}
-
 void WaypointController::list(const std::string &route_id)
 {
     WaypointTableView view(con_, route_id) ;
@@ -31,8 +31,6 @@ public:
                    Connection &con, User &user, TemplateRenderer &engine): routes_(con), con_(con),
     request_(req), response_(resp), user_(user), engine_(engine) {}
 
-    bool dispatch() ;
-
     void list(const std::string &route_id) ;
 
     void remove(const std::string &route_id) ;
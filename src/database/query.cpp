@@ -1,5 +1,7 @@
 #include <wspp/database/query.hpp>
 #include <wspp/database/connection.hpp>
+#include <wspp/util/metrics.hpp>
+#include <wspp/util/trace.hpp>
 
 using namespace std ;
 namespace wspp { namespace db {
@@ -10,6 +12,12 @@ Query::Query(Connection &con, const string &sql):
 
 QueryResult Query::exec()
 {
+    // covers running the query up to the first row, not reading the rest of the result
+    static util::Histogram &duration = util::MetricsRegistry::instance().histograms("db_statement_duration_seconds",
+            "Time spent executing database statements", {"kind"}).with({"query"}) ;
+
+    util::MetricTimer timer(duration) ;
+    util::TraceSpan span("sql") ;
     return stmt_->execQuery() ;
 }
 
@@ -1,5 +1,7 @@
 #include <wspp/database/statement.hpp>
 #include <wspp/database/connection.hpp>
+#include <wspp/util/metrics.hpp>
+#include <wspp/util/trace.hpp>
 
 #include <boost/algorithm/string.hpp>
 
@@ -12,6 +14,15 @@ Statement::Statement(Connection &con, const std::string & sql) {
     stmt_ = con.handle()->createStatement(sql) ;
 }
 
+void Statement::exec() {
+    static util::Histogram &duration = util::MetricsRegistry::instance().histograms("db_statement_duration_seconds",
+            "Time spent executing database statements", {"kind"}).with({"exec"}) ;
+
+    util::MetricTimer timer(duration) ;
+    util::TraceSpan span("sql") ;
+    stmt_->exec() ;
+}
+
 std::string escapeName(const std::string &unescaped) {
     string e = boost::algorithm::replace_all_copy(unescaped, "\"", "\"\"") ;
     return '"' + e + '"' ;
@@ -0,0 +1,88 @@
+#include <wspp/server/detail/admission_controller.hpp>
+
+#include <algorithm>
+
+namespace wspp { namespace server {
+namespace detail {
+
+// how often the lag of each loop is measured
+static const long probe_interval_ms = 100 ;
+
+admission_controller::admission_controller(const ServerOptions &options, std::size_t num_loops)
+    : max_in_flight_(options.max_in_flight_requests_), max_loop_lag_(options.max_loop_lag_ms_),
+      probes_(num_loops), in_flight_(0), admitted_(0), rejected_(0)
+{
+    // refused requests should cost next to nothing so the response is formatted once
+    overload_response_ = "HTTP/1.1 503 Service Unavailable\r\n"
+                         "Retry-After: " + std::to_string(options.retry_after_) + "\r\n"
+                         "Content-Length: 0\r\n"
+                         "Connection: close\r\n\r\n" ;
+}
+
+void admission_controller::monitor(boost::asio::io_service &io_service, std::size_t loop_index)
+{
+    probes_[loop_index].reset(new probe(io_service)) ;
+    probe &p = *probes_[loop_index] ;
+    p.timer_.expires_from_now(boost::posix_time::milliseconds(probe_interval_ms)) ;
+    schedule(p) ;
+}
+
+void admission_controller::schedule(probe &p)
+{
+    p.timer_.async_wait([this, &p](const boost::system::error_code &e) {
+        if ( e ) return ;
+
+        // the timer should have fired at its expiry time, anything more is time spent on other handlers
+        boost::posix_time::ptime now = boost::asio::deadline_timer::traits_type::now() ;
+        p.lag_ = std::max<long>(0, (now - p.timer_.expires_at()).total_milliseconds()) ;
+
+        p.timer_.expires_at(now + boost::posix_time::milliseconds(probe_interval_ms)) ;
+        schedule(p) ;
+    }) ;
+}
+
+bool admission_controller::admit(std::size_t loop_index)
+{
+    const probe *p = probes_[loop_index].get() ;
+
+    if ( p && max_loop_lag_ && p->lag_ > max_loop_lag_ ) {
+        ++rejected_ ;
+        return false ;
+    }
+
+    if ( ++in_flight_ > max_in_flight_ && max_in_flight_ ) {
+        --in_flight_ ;
+        ++rejected_ ;
+        return false ;
+    }
+
+    ++admitted_ ;
+    return true ;
+}
+
+void admission_controller::release()
+{
+    --in_flight_ ;
+}
+
+std::size_t admission_controller::loop_lag(std::size_t loop_index) const
+{
+    const probe *p = probes_[loop_index].get() ;
+    return p ? p->lag_.load() : 0 ;
+}
+
+AdmissionStats admission_controller::stats() const
+{
+    AdmissionStats s ;
+    s.in_flight_ = in_flight_.load() ;
+    s.max_loop_lag_ = 0 ;
+    for( const auto &p: probes_ )
+        if ( p ) s.max_loop_lag_ = std::max(s.max_loop_lag_, p->lag_.load()) ;
+    s.admitted_ = admitted_.load() ;
+    s.rejected_ = rejected_.load() ;
+    return s ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
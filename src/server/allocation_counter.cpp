@@ -0,0 +1,63 @@
+#include <wspp/server/detail/allocation_counter.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef WSPP_COUNT_ALLOCATIONS
+
+static thread_local std::uint64_t allocation_count = 0 ;
+
+// the array and nothrow forms call this one
+
+void *operator new(std::size_t size)
+{
+    ++allocation_count ;
+
+    void *p = std::malloc(size ? size : 1) ;
+    if ( !p ) throw std::bad_alloc() ;
+    return p ;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p) ;
+}
+
+#endif
+
+namespace wspp { namespace server {
+namespace detail {
+
+static std::atomic<std::uint64_t> requests_measured(0), total_allocations(0), max_request_allocations(0) ;
+
+std::uint64_t thread_allocations()
+{
+#ifdef WSPP_COUNT_ALLOCATIONS
+    return allocation_count ;
+#else
+    return 0 ;
+#endif
+}
+
+void record_request_allocations(std::uint64_t count)
+{
+#ifdef WSPP_COUNT_ALLOCATIONS
+    ++requests_measured ;
+    total_allocations += count ;
+
+    std::uint64_t current = max_request_allocations ;
+    while ( count > current && !max_request_allocations.compare_exchange_weak(current, count) ) ;
+#else
+    (void)count ;
+#endif
+}
+
+AllocationStats allocation_stats()
+{
+    return AllocationStats{ requests_measured, total_allocations, max_request_allocations } ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
@@ -0,0 +1,90 @@
+#include <wspp/server/detail/arena.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace wspp { namespace server {
+namespace detail {
+
+static const std::size_t arena_alignment = alignof(std::max_align_t);
+
+arena::arena(std::size_t block_size)
+    : block_size_(block_size), offset_(0), bytes_used_(0), last_(nullptr)
+{
+}
+
+char *arena::allocate_block(std::size_t size)
+{
+    block b;
+    b.size_ = std::max(size, block_size_);
+    b.data_.reset(new char[b.size_]);
+    blocks_.push_back(std::move(b));
+    offset_ = 0;
+    return blocks_.back().data_.get();
+}
+
+void *arena::allocate(std::size_t size)
+{
+    std::size_t start = (offset_ + arena_alignment - 1) & ~(arena_alignment - 1);
+
+    char *p;
+    if ( blocks_.empty() || start + size > blocks_.back().size_ ) {
+        p = allocate_block(size);
+        offset_ = size;
+    }
+    else {
+        p = blocks_.back().data_.get() + start;
+        offset_ = start + size;
+    }
+
+    bytes_used_ += size;
+    last_ = p;
+    return p;
+}
+
+boost::string_ref arena::copy(boost::string_ref src)
+{
+    char *p = static_cast<char *>(allocate(src.size()));
+    memcpy(p, src.data(), src.size());
+    return boost::string_ref(p, src.size());
+}
+
+boost::string_ref arena::append(boost::string_ref src, const char *data, std::size_t size)
+{
+    // grow the last allocation if there is room after it
+    if ( src.data() == last_ && !blocks_.empty() ) {
+        const block &b = blocks_.back();
+        if ( src.data() + src.size() == b.data_.get() + offset_ && offset_ + size <= b.size_ ) {
+            memcpy(b.data_.get() + offset_, data, size);
+            offset_ += size;
+            bytes_used_ += size;
+            return boost::string_ref(src.data(), src.size() + size);
+        }
+    }
+
+    char *p = static_cast<char *>(allocate(src.size() + size));
+    memcpy(p, src.data(), src.size());
+    memcpy(p + src.size(), data, size);
+    return boost::string_ref(p, src.size() + size);
+}
+
+bool arena::owns(const char *p) const
+{
+    for( const block &b: blocks_ ) {
+        if ( p >= b.data_.get() && p < b.data_.get() + b.size_ ) return true;
+    }
+    return false;
+}
+
+void arena::reset()
+{
+    if ( blocks_.size() > 1 ) blocks_.resize(1);
+    offset_ = 0;
+    bytes_used_ = 0;
+    last_ = nullptr;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
@@ -11,34 +11,129 @@
 #include <wspp/server/detail/connection_manager.hpp>
 #include <wspp/server/detail/connection.hpp>
 
+#include <algorithm>
+
 namespace wspp { namespace server {
 
-ConnectionManager::ConnectionManager()
+ConnectionManager::ConnectionManager(detail::io_service_pool &pool): open_(0)
+{
+    for( std::size_t i = 0 ; i < pool.size() ; i++ )
+        shards_.emplace_back(new shard(pool.get_io_service(i))) ;
+}
+
+ConnectionManager::~ConnectionManager()
 {
+    // the event loops have stopped, connections left over have to be released here
+    for( auto &s: shards_ )
+        stop_shard(*s) ;
 }
 
-void ConnectionManager::start(ConnectionPtr c)
+bool ConnectionManager::start(ConnectionPtr c, std::size_t max_connections)
 {
-    boost::unique_lock<boost::mutex> lock(mutex_) ;
+    if ( max_connections ) {
+        std::size_t n = open_.load() ;
+        do {
+            if ( n >= max_connections ) return false ;
+        } while ( !open_.compare_exchange_weak(n, n + 1) ) ;
+    }
+    else
+        ++open_ ;
 
-    connections_.insert(c);
-    c->start();
+    shard &s = *shards_[c->loop_index_] ;
+    ++s.open_ ;
+    ++s.accepted_ ;
+
+    // the list is only modified on the loop serving the connection
+    s.io_service_.post([this, c, &s]() {
+        link(s, c) ;
+        c->start() ;
+    }) ;
+
+    return true ;
 }
 
 void ConnectionManager::stop(ConnectionPtr c)
 {
-    boost::unique_lock<boost::mutex> lock(mutex_) ;
-    if ( connections_.count(c) )
-          connections_.erase(c);
+    shard &s = *shards_[c->loop_index_] ;
+    if ( unlink(s, *c) ) {
+        --s.open_ ;
+        --open_ ;
+    }
     c->stop();
 }
 
-void ConnectionManager::stop_all()
+void ConnectionManager::stop_all(std::function<void()> done)
+{
+    auto pending = std::make_shared<std::atomic<std::size_t>>(shards_.size()) ;
+
+    for( auto &s: shards_ ) {
+        shard *sp = s.get() ;
+        sp->io_service_.post([this, sp, pending, done]() {
+            stop_shard(*sp) ;
+            if ( --*pending == 0 && done ) done() ;
+        }) ;
+    }
+}
+
+void ConnectionManager::stop_shard(shard &s)
+{
+    while ( s.head_ ) {
+        ConnectionPtr c = s.head_->tracked_ ;
+        unlink(s, *c) ;
+        --s.open_ ;
+        --open_ ;
+        c->stop() ;
+    }
+}
+
+void ConnectionManager::link(shard &s, const ConnectionPtr &c)
+{
+    c->prev_in_loop_ = nullptr ;
+    c->next_in_loop_ = s.head_ ;
+    if ( s.head_ ) s.head_->prev_in_loop_ = c.get() ;
+    s.head_ = c.get() ;
+
+    // the list keeps the connection alive
+    c->tracked_ = c ;
+}
+
+bool ConnectionManager::unlink(shard &s, HttpConnection &c)
+{
+    if ( !c.tracked_ ) return false ;
+
+    if ( c.prev_in_loop_ ) c.prev_in_loop_->next_in_loop_ = c.next_in_loop_ ;
+    else s.head_ = c.next_in_loop_ ;
+    if ( c.next_in_loop_ ) c.next_in_loop_->prev_in_loop_ = c.prev_in_loop_ ;
+
+    c.prev_in_loop_ = c.next_in_loop_ = nullptr ;
+
+    // callers hold their own reference, so this does not destroy the connection
+    c.tracked_.reset() ;
+    return true ;
+}
+
+std::vector<std::size_t> ConnectionManager::connections_per_loop()
+{
+    std::vector<std::size_t> counts ;
+    for( const auto &s: shards_ )
+        counts.push_back(s->open_.load()) ;
+    return counts ;
+}
+
+std::vector<std::size_t> ConnectionManager::accepts_per_loop()
+{
+    std::vector<std::size_t> counts ;
+    for( const auto &s: shards_ )
+        counts.push_back(s->accepted_.load()) ;
+    return counts ;
+}
+
+std::size_t ConnectionManager::least_loaded_loop()
 {
-    boost::unique_lock<boost::mutex> lock(mutex_) ;
-    for (auto c: connections_)
-        c->stop();
-    connections_.clear();
+    std::size_t best = 0 ;
+    for( std::size_t i = 1 ; i < shards_.size() ; i++ )
+        if ( shards_[i]->open_ < shards_[best]->open_ ) best = i ;
+    return best ;
 }
 
 } // namespace server
@@ -0,0 +1,100 @@
+#include <wspp/server/detail/file_sender.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace wspp { namespace server {
+namespace detail {
+
+file_sender::file_sender(): fd_(-1), offset_(0), end_(0), map_(nullptr), map_size_(0)
+{
+}
+
+file_sender::~file_sender()
+{
+    close();
+}
+
+bool file_sender::open(const std::string &path, std::uint64_t offset, std::uint64_t length)
+{
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if ( fd_ == -1 ) return false;
+
+    offset_ = offset;
+    end_ = offset + length;
+
+    return true;
+}
+
+void file_sender::select(std::uint64_t offset, std::uint64_t length)
+{
+    if ( map_ ) ::munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+
+    offset_ = offset;
+    end_ = offset + length;
+}
+
+file_sender::result file_sender::send(int socket_fd)
+{
+#ifdef __linux__
+    while ( offset_ < end_ ) {
+        off_t offset = offset_;
+        ssize_t n = ::sendfile(socket_fd, fd_, &offset, end_ - offset_);
+
+        if ( n > 0 ) offset_ = offset;
+        else if ( n == 0 ) return error; // file truncated while sending
+        else if ( errno == EINTR ) continue;
+        else if ( errno == EAGAIN || errno == EWOULDBLOCK ) return would_block;
+        else if ( errno == EINVAL || errno == ENOSYS ) return unsupported;
+        else return error;
+    }
+    return done;
+#else
+    (void)socket_fd;
+    return unsupported;
+#endif
+}
+
+boost::asio::const_buffer file_sender::map()
+{
+    if ( fd_ == -1 || offset_ >= end_ ) return boost::asio::const_buffer();
+
+    // mappings have to start at a page boundary
+    static const std::uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+    std::uint64_t start = offset_ - offset_ % page_size;
+
+    map_size_ = end_ - start;
+    map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd_, start);
+
+    if ( map_ == MAP_FAILED ) {
+        map_ = nullptr;
+        map_size_ = 0;
+        return boost::asio::const_buffer();
+    }
+
+    return boost::asio::const_buffer(static_cast<const char *>(map_) + (offset_ - start), end_ - offset_);
+}
+
+void file_sender::close()
+{
+    if ( map_ ) ::munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+
+    if ( fd_ != -1 ) ::close(fd_);
+    fd_ = -1;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
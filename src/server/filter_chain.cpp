@@ -1,29 +1,86 @@
 #include <wspp/server/filter_chain.hpp>
 #include <wspp/server/request_handler.hpp>
+#include <wspp/server/exceptions.hpp>
+#include <wspp/util/metrics.hpp>
+
+#include <algorithm>
 
 namespace wspp { namespace server {
 
-void FilterChain::setEndPoint(RequestHandler *end_point) {
-    end_point_ = end_point ;
+void FilterContext::next(Request &req, Response &resp) {
+    FilterContext ctx(chain_, pos_ + 1, pending_, done_) ;
+    chain_.doHandle(req, resp, ctx) ;
+}
+
+std::function<void()> FilterContext::defer() {
+    // the count starts at one for the synchronous pass through the chain
+    if ( !pending_ ) pending_ = std::make_shared<Pending>(done_) ;
+    ++pending_->count_ ;
+
+    std::shared_ptr<Pending> pending = pending_ ;
+    return [pending]() {
+        if ( --pending->count_ == 0 ) pending->complete() ;
+    } ;
+}
+
+void FilterContext::addHook(std::function<void()> fn) {
+    pending_->hooks_.emplace_back(pos_, std::move(fn)) ;
+}
+
+void FilterContext::Pending::complete() {
+    // inner filters post-process first, as when the chain unwinds synchronously
+    std::stable_sort(hooks_.begin(), hooks_.end(),
+                     [](const std::pair<size_t, std::function<void()>> &a, const std::pair<size_t, std::function<void()>> &b) {
+        return a.first > b.first ;
+    }) ;
+
+    for( auto &h: hooks_ ) h.second() ;
+    hooks_.clear() ;
+
+    done_() ;
 }
 
-void FilterChain::next(Request &req, Response &resp) {
-    current_++ ;
-    doHandle(req, resp) ;
+void FilterChain::setEndPoint(RequestHandler *end_point) {
+    end_point_ = end_point ;
 }
 
 void FilterChain::add(Filter *f) {
     filters_.emplace_back(f) ;
 }
 
-void FilterChain::handle(Request &req, Response &resp) {
-    current_ = filters_.begin() ;
-    doHandle(req, resp) ;
+void FilterChain::handle(Request &req, Response &resp, const std::function<void()> &done) const {
+
+    // requests without deferred filters complete without allocating the shared state
+    std::shared_ptr<FilterContext::Pending> pending ;
+
+    struct Completion {
+        std::shared_ptr<FilterContext::Pending> &pending_ ;
+        const std::function<void()> &done_ ;
+
+        ~Completion() {
+            if ( !pending_ ) done_() ;
+            else if ( --pending_->count_ == 0 ) pending_->complete() ;
+        }
+    } completion{pending, done} ;
+
+    FilterContext ctx(*this, 0, pending, done) ;
+
+    try {
+        doHandle(req, resp, ctx) ;
+    }
+    catch ( ... ) {
+        static util::MetricFamily<util::Counter> &exceptions = util::MetricsRegistry::instance().counters(
+                    "http_handler_exceptions_total", "Exceptions thrown out of filters and request handlers", {"type"}) ;
+
+        try { throw ; }
+        catch ( HttpResponseException & ) { exceptions.with({"http_status"}).inc() ; throw ; }
+        catch ( ... ) { exceptions.with({"other"}).inc() ; throw ; }
+    }
 }
 
-void FilterChain::doHandle(Request &req, Response &resp) {
-    if ( current_ != filters_.end() )
-        (*current_)->handle(req, resp, *this) ;
+void FilterChain::doHandle(Request &req, Response &resp, FilterContext &ctx) const {
+    if ( ctx.pos_ < filters_.size() )
+        filters_[ctx.pos_]->handle(req, resp, ctx) ;
     else if ( end_point_ )
         end_point_->handle(req, resp) ;
 }
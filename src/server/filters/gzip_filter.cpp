@@ -1,55 +1,267 @@
 #include <wspp/server/filters/gzip_filter.hpp>
 #include <wspp/server/filter_chain.hpp>
-#include <wspp/util/zstream.hpp>
+#include <wspp/util/trace.hpp>
 
-#include <boost/regex.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <vector>
+#include <zlib.h>
 
 using namespace std ;
-using namespace wspp::util ;
+using wspp::util::Dictionary ;
 
 namespace wspp { namespace server {
 
-static boost::regex gzip_include_mime_rx("(text/.*)|(application/x-javascript.*)|(application/xhtml+xml)|(application/xml)") ;
-static const size_t gzip_min_content_length = 200 ;
+namespace {
+
+// gzip deflate stream owned by a thread. It is set up once and reset between bodies, which avoids allocating the
+// zlib state (some 256KB) for every response.
+
+class deflater {
+public:
+    deflater() { memset(&strm_, 0, sizeof(strm_)) ; }
+    ~deflater() { if ( ready_ ) deflateEnd(&strm_) ; }
+
+    bool compress(const string &src, string &dst, int level) {
+        if ( src.size() > UINT_MAX ) return false ;
+
+        if ( ready_ && level == level_ )
+            deflateReset(&strm_) ;
+        else {
+            if ( ready_ ) deflateEnd(&strm_) ;
+            memset(&strm_, 0, sizeof(strm_)) ;
+            ready_ = deflateInit2(&strm_, level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) == Z_OK ;
+            if ( !ready_ ) return false ;
+            level_ = level ;
+        }
+
+        // the bound includes the gzip header so a single call finishes the stream
+        dst.resize(deflateBound(&strm_, src.size())) ;
+
+        strm_.next_in = (Bytef *)src.data() ;
+        strm_.avail_in = src.size() ;
+        strm_.next_out = (Bytef *)&dst[0] ;
+        strm_.avail_out = dst.size() ;
+
+        if ( deflate(&strm_, Z_FINISH) != Z_STREAM_END ) return false ;
+
+        dst.resize(strm_.total_out) ;
+        return true ;
+    }
+
+private:
+    z_stream strm_ ;
+    bool ready_ = false ;
+    int level_ = 0 ;
+};
+
+thread_local deflater thread_deflater ;
+
+}
+
+// load the file body of the response in memory
+static bool read_file_body(Response &resp) {
+    ifstream strm(resp.file_.path_, ios::binary) ;
+    if ( !strm ) return false ;
+
+    string data(resp.file_.length_, 0) ;
+    strm.seekg(resp.file_.offset_) ;
+    if ( !strm.read(&data[0], data.size()) ) return false ;
+
+    resp.content_.swap(data) ;
+    resp.file_ = Response::FileBody() ;
+    return true ;
+}
+
+bool GZipFilter::compressible(const string &mime) const {
+    boost::string_ref type(mime) ;
+    size_t pos = type.find(';') ;
+    if ( pos != boost::string_ref::npos ) type = type.substr(0, pos) ;
+    while ( !type.empty() && type.back() == ' ' ) type.remove_suffix(1) ;
+
+    for( const string &t: options_.mime_types_ ) {
+        if ( !t.empty() && t.back() == '*' ) {
+            if ( type.size() >= t.size() - 1 &&
+                 boost::iequals(type.substr(0, t.size() - 1), boost::string_ref(t.data(), t.size() - 1)) )
+                return true ;
+        }
+        else if ( boost::iequals(type, t) )
+            return true ;
+    }
 
-bool content_benefits_from_compression(const string &mime) {
-    if ( boost::regex_match(mime,  gzip_include_mime_rx) ) return true ;
     return false ;
 }
 
-void GZipFilter::handle(Request &req, Response &resp, FilterChain &chain)
-{
-    chain.next(req, resp) ;
+// ETag of the compressed variant: the opaque tag with a "-gz" suffix, keeping a weak prefix
 
-    string saccept = req.SERVER_.get("Accept-Encoding") ;
+static string variant_etag(const string &etag) {
+    if ( etag.size() < 2 || etag.back() != '"' ) return string() ;
+    return etag.substr(0, etag.size() - 1) + "-gz\"" ;
+}
+
+// weak comparison of etag with the tags listed in If-None-Match
+
+static bool etag_matches(const string &if_none_match, const string &etag) {
+    if ( if_none_match.empty() ) return false ;
+    if ( if_none_match == "*" ) return true ;
 
-    string encoding = resp.headers_.get("Content-Encoding") ;
-    string mime = resp.headers_.get("Content-Type") ;
+    boost::string_ref opaque(etag) ;
+    if ( opaque.starts_with("W/") ) opaque.remove_prefix(2) ;
 
-    if ( resp.status_ == Response::ok &&
-         boost::algorithm::contains(saccept, "gzip") &&
-         encoding != "gzip" &&
-         !resp.content_.empty() &&
-         resp.content_.length() > gzip_min_content_length &&
-         content_benefits_from_compression(mime) ) {
+    vector<string> tags ;
+    boost::split(tags, if_none_match, boost::is_any_of(","), boost::token_compress_on) ;
+    for( string &tag: tags ) {
+        boost::trim(tag) ;
+        if ( boost::starts_with(tag, "W/") ) tag = tag.substr(2) ;
+        if ( opaque == tag ) return true ;
+    }
+    return false ;
+}
+
+static void add_vary(Dictionary &headers) {
+    string vary = headers.get("Vary") ;
+    if ( vary.empty() )
+        headers.add("Vary", "Accept-Encoding") ;
+    else if ( !boost::algorithm::icontains(vary, "Accept-Encoding") )
+        headers.replace("Vary", vary + ", Accept-Encoding") ;
+}
+
+static void set_shared_body(Response &resp, const shared_ptr<const string> &body) {
+    resp.file_ = Response::FileBody() ;
+    resp.content_.clear() ;
+    resp.shared_content_ = body ;
+}
+
+GZipFilter::CacheEntryPtr GZipFilter::lookup(const string &key) {
+    lock_guard<mutex> lock(mutex_) ;
+
+    auto it = cache_.find(key) ;
+    if ( it == cache_.end() ) return nullptr ;
+
+    lru_.splice(lru_.begin(), lru_, it->second.second) ;
+    return it->second.first ;
+}
 
-        ostringstream compressed(ios::binary) ;
-        {
-            ozstream zstrm(compressed) ;
-            zstrm.write(&resp.content_[0], resp.content_.size()) ;
+void GZipFilter::store(const string &key, const CacheEntryPtr &entry) {
+    size_t entry_size = entry->data_->size() + entry->source_.size() ;
+
+    lock_guard<mutex> lock(mutex_) ;
+
+    auto it = cache_.find(key) ;
+    if ( it != cache_.end() ) {
+        cache_size_ -= it->second.first->data_->size() + it->second.first->source_.size() ;
+        lru_.erase(it->second.second) ;
+        cache_.erase(it) ;
+    }
+
+    while ( !lru_.empty() && cache_size_ + entry_size > options_.max_cache_size_ ) {
+        auto victim = cache_.find(lru_.back()) ;
+        cache_size_ -= victim->second.first->data_->size() + victim->second.first->source_.size() ;
+        cache_.erase(victim) ;
+        lru_.pop_back() ;
+    }
+
+    lru_.push_front(key) ;
+    cache_.emplace(key, make_pair(entry, lru_.begin())) ;
+    cache_size_ += entry_size ;
+}
+
+bool GZipFilter::compress(Response &resp, const string &etag_key) {
+
+    util::TraceSpan span("gzip") ;
+
+    bool use_cache = options_.max_cache_size_ != 0 ;
+    string key = etag_key ;
+
+    // a variant cached under its ETag is used without reading the file
+    if ( use_cache && !key.empty() ) {
+        if ( CacheEntryPtr entry = lookup(key) ) {
+            set_shared_body(resp, entry->data_) ;
+            return true ;
         }
+    }
 
-        resp.content_.assign(compressed.str()) ;
-        resp.headers_.replace("Content-Encoding", "gzip") ;
-        resp.setContentLength();
+    if ( !resp.file_.path_.empty() && !read_file_body(resp) ) return false ;
+
+    bool by_hash = use_cache && key.empty() ;
+
+    if ( by_hash ) {
+        // hashing is still far cheaper than deflating. Entries are immutable so the bodies are compared unlocked.
+        key = "#" + to_string(std::hash<string>()(resp.body())) + "-" + to_string(resp.body().size()) ;
+
+        CacheEntryPtr entry = lookup(key) ;
+        if ( entry && entry->source_ == resp.body() ) {
+            set_shared_body(resp, entry->data_) ;
+            return true ;
+        }
+    }
 
+    string compressed ;
+    if ( !thread_deflater.compress(resp.body(), compressed, options_.level_) ) return false ;
+
+    if ( use_cache && compressed.size() <= options_.max_cache_entry_size_ ) {
+        auto entry = make_shared<CacheEntry>() ;
+        if ( by_hash ) entry->source_ = resp.body() ;
+        entry->data_ = make_shared<const string>(std::move(compressed)) ;
+        store(key, entry) ;
+        set_shared_body(resp, entry->data_) ;
+    }
+    else {
+        resp.shared_content_.reset() ;
+        resp.content_.swap(compressed) ;
     }
 
+    return true ;
+}
+
+void GZipFilter::handle(Request &req, Response &resp, FilterContext &chain)
+{
+    chain.next(req, resp) ;
+
+    chain.onComplete([this, &req, &resp]() { encode(req, resp) ; }) ;
 }
 
+void GZipFilter::encode(const Request &req, Response &resp)
+{
+    if ( resp.status_ != Response::ok ) return ;
+
+    if ( resp.headers_.get("Content-Encoding") == "gzip" ) return ;
+    if ( !compressible(resp.headers_.get("Content-Type")) ) return ;
+
+    // caches must not hand this response to clients that accept a different encoding
+    add_vary(resp.headers_) ;
 
+    if ( !boost::algorithm::contains(req.header("Accept-Encoding"), "gzip") ) return ;
 
+    bool is_file = !resp.file_.path_.empty() ;
+    if ( is_file && resp.file_.length_ > options_.max_file_size_ ) return ;
+    if ( ( is_file ? resp.file_.length_ : resp.body().length() ) <= options_.min_size_ ) return ;
+
+    string etag = variant_etag(resp.headers_.get("Etag")) ;
+
+    // the handler validated against the identity ETag, the client may hold the compressed variant
+    if ( !etag.empty() && etag_matches(req.header("If-None-Match"), etag) ) {
+        resp.headers_.replace("Etag", etag) ;
+        resp.stockReply(Response::not_modified) ;
+        return ;
+    }
+
+    // ETags are only unique per resource
+    string key ;
+    if ( !etag.empty() ) key = req.path_ + ' ' + etag ;
+
+    if ( compress(resp, key) ) {
+        resp.headers_.replace("Content-Encoding", "gzip") ;
+        resp.headers_.remove("Accept-Ranges") ; // ranges would refer to the uncompressed file
+        if ( !etag.empty() ) resp.headers_.replace("Etag", etag) ;
+        resp.setContentLength();
+    }
+}
 
 } // namespace server
 } // namespace wspp
@@ -0,0 +1,20 @@
+#include <wspp/server/filters/metrics_filter.hpp>
+
+#include <wspp/server/request.hpp>
+#include <wspp/server/response.hpp>
+#include <wspp/server/filter_chain.hpp>
+#include <wspp/util/metrics.hpp>
+
+namespace wspp { namespace server {
+
+void MetricsFilter::handle(Request &req, Response &resp, FilterContext &chain) {
+    if ( req.path_ == path_ && ( req.method_ == "GET" || req.method_ == "HEAD" ) ) {
+        resp.write(util::MetricsRegistry::instance().prometheusText(), "text/plain; version=0.0.4") ;
+        resp.headers_.add("Cache-Control", "no-cache") ;
+    }
+    else
+        chain.next(req, resp) ;
+}
+
+} // namespace server
+} // namespace wspp
@@ -11,16 +11,20 @@ using namespace wspp::util ;
 
 namespace wspp { namespace server {
 
-void RequestLoggerFilter::handle(Request &req, Response &resp, FilterChain &chain) {
+void RequestLoggerFilter::handle(Request &req, Response &resp, FilterContext &chain) {
     try {
         chain.next(req, resp) ;
-        LOG_X_STREAM(logger_, Info, "Response to " <<
-                 req.SERVER_.get("REMOTE_ADDR", "127.0.0.1")
-                 << ": \"" << req.method_ << " " << req.path_
-                 << ((req.query_.empty()) ? "" : "?" + req.query_) << " "
-                 << req.protocol_ << "\" "
-                 << resp.status_ << " " << resp.headers_.value<int>("Content-Length", 0)
-                 ) ;
+
+        // a filter below may finish the response later
+        chain.onComplete([this, &req, &resp]() {
+            LOG_X_STREAM(logger_, Info, "Response to " <<
+                     req.SERVER_.get("REMOTE_ADDR", "127.0.0.1")
+                     << ": \"" << req.method_ << " " << req.path_
+                     << ((req.query_.empty()) ? "" : "?" + req.query_) << " "
+                     << req.protocol_ << "\" "
+                     << resp.status_ << " " << resp.headers_.value<int>("Content-Length", 0)
+                     ) ;
+        }) ;
     }
     catch ( HttpResponseException &e ) {
         LOG_X_STREAM(logger_, Error, "Response to " <<
@@ -3,24 +3,194 @@
 #include <wspp/server/request.hpp>
 #include <wspp/server/response.hpp>
 #include <wspp/server/filter_chain.hpp>
+#include <wspp/server/exceptions.hpp>
 
 #include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <fstream>
+#include <time.h>
+#include <sys/stat.h>
 
 namespace fs = boost::filesystem ;
 
+using namespace std ;
 using namespace wspp::util ;
 
 namespace wspp { namespace server {
 
-void StaticFileHandler::handle(Request &req, Response &resp, FilterChain &chain) {
+static bool stat_file(const string &path, time_t &mtime, uint64_t &size) {
+    struct stat st ;
+    if ( ::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ) return false ;
+    mtime = st.st_mtime ;
+    size = st.st_size ;
+    return true ;
+}
+
+static bool read_file(const string &path, uint64_t size, string &data) {
+    ifstream strm(path, ios::binary) ;
+    data.resize(size) ;
+    return strm && strm.read(&data[0], size) ;
+}
+
+// true if the client copy, identified by the conditional headers of the request, is still valid
+
+static bool not_modified(const Request &req, const Dictionary &headers) {
+
+    string if_none_match = req.header("If-None-Match") ;
+
+    if ( !if_none_match.empty() ) {
+        string etag = headers.get("Etag") ;
+        if ( if_none_match == "*" ) return true ;
+
+        vector<string> tags ;
+        boost::split(tags, if_none_match, boost::is_any_of(","), boost::token_compress_on) ;
+        for( string &tag: tags ) {
+            boost::trim(tag) ;
+            if ( boost::starts_with(tag, "W/") ) tag = tag.substr(2) ;
+            if ( tag == etag ) return true ;
+        }
+        return false ;
+    }
+
+    string if_modified_since = req.header("If-Modified-Since") ;
+
+    if ( !if_modified_since.empty() ) {
+        struct tm since ;
+        memset(&since, 0, sizeof(since)) ;
+        if ( !strptime(if_modified_since.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &since) ) return false ;
+
+        struct tm modified ;
+        memset(&modified, 0, sizeof(modified)) ;
+        if ( !strptime(headers.get("Last-Modified").c_str(), "%a, %d %b %Y %H:%M:%S GMT", &modified) ) return false ;
+
+        return timegm(&modified) <= timegm(&since) ;
+    }
+
+    return false ;
+}
+
+StaticFileHandler::CacheEntryPtr StaticFileHandler::fetch(const string &path, time_t mtime, uint64_t size, const string &encoding) {
+
+    if ( size > max_file_size_ || size > max_cache_size_ ) return nullptr ;
+
+    {
+        lock_guard<mutex> lock(mutex_) ;
+
+        auto it = cache_.find(path) ;
+        if ( it != cache_.end() ) {
+            const CacheEntryPtr &entry = it->second.first ;
+
+            if ( entry->mtime_ == mtime && entry->size_ == size ) {
+                lru_.splice(lru_.begin(), lru_, it->second.second) ;
+                return entry ;
+            }
+
+            // the file has changed
+            cache_size_ -= entry->size_ ;
+            lru_.erase(it->second.second) ;
+            cache_.erase(it) ;
+        }
+    }
+
+    // load outside the lock, a concurrent request for the same file at worst loads it twice
+
+    Response resp ;
+    string data ;
+    if ( !read_file(path, size, data) ) return nullptr ;
+    resp.encodeFileData(data, encoding, Response::fileMimeType(path), mtime) ;
+
+    auto entry = make_shared<CacheEntry>() ;
+    entry->mtime_ = mtime ;
+    entry->size_ = size ;
+    entry->headers_ = std::move(resp.headers_) ;
+    entry->data_ = make_shared<const string>(std::move(resp.content_)) ;
+
+    lock_guard<mutex> lock(mutex_) ;
 
-    if ( resp.status_ != Response::ok && req.method_ == "GET" ) {
-        fs::path p(root_ + req.path_)  ;
-        if ( fs::exists(p) )
-                resp.encodeFile(p.string());
+    if ( cache_.count(path) ) return entry ;
+
+    evict(size) ;
+
+    lru_.push_front(path) ;
+    cache_.emplace(path, make_pair(entry, lru_.begin())) ;
+    cache_size_ += size ;
+
+    return entry ;
+}
+
+void StaticFileHandler::evict(size_t required) {
+    while ( !lru_.empty() && cache_size_ + required > max_cache_size_ ) {
+        auto it = cache_.find(lru_.back()) ;
+        cache_size_ -= it->second.first->size_ ;
+        cache_.erase(it) ;
+        lru_.pop_back() ;
+    }
+}
+
+bool StaticFileHandler::serve(const Request &req, Response &resp) {
+
+    if ( req.method_ != "GET" && req.method_ != "HEAD" ) return false ;
+
+    string path = root_ + req.path_ ;
+    time_t mtime ;
+    uint64_t size ;
+
+    if ( !stat_file(path, mtime, size) ) return false ;
+
+    // drop whatever the handler left in the 404 response
+    resp.clear() ;
+
+    string encoding ;
+
+    // prefer a precompressed copy if the client accepts it
+    string gz_path = path + ".gz" ;
+    time_t gz_mtime ;
+    uint64_t gz_size ;
+
+    bool has_gz = stat_file(gz_path, gz_mtime, gz_size) ;
+
+    if ( has_gz && boost::algorithm::contains(req.header("Accept-Encoding"), "gzip") ) {
+        path = gz_path ;
+        mtime = gz_mtime ;
+        size = gz_size ;
+        encoding = "gzip" ;
+    }
+
+    CacheEntryPtr entry = fetch(path, mtime, size, encoding) ;
+
+    if ( entry ) {
+        resp.headers_ = entry->headers_ ;
+        resp.shared_content_ = entry->data_ ;
+        resp.status_ = Response::ok ;
+    }
+    else {
+        resp.encodeFile(path, encoding, Response::fileMimeType(path)) ;
+    }
+
+    if ( has_gz ) resp.headers_.add("Vary", "Accept-Encoding") ;
+
+    if ( not_modified(req, resp.headers_) )
+        resp.stockReply(Response::not_modified) ;
+
+    return true ;
+}
+
+void StaticFileHandler::handle(Request &req, Response &resp, FilterContext &chain) {
+
+    try {
+        chain.next(req, resp) ;
+    }
+    catch ( HttpResponseException &e ) {
+        if ( e.code_ != Response::not_found ) throw ;
+        resp.status_ = Response::not_found ;
+        if ( !serve(req, resp) ) throw ;
+        return ;
     }
 
-    chain.next(req, resp) ;
+    chain.onComplete([this, &req, &resp]() {
+        if ( resp.status_ == Response::not_found ) serve(req, resp) ;
+    }) ;
 }
 
 
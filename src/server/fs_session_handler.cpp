@@ -1,5 +1,6 @@
 #include <wspp/server/fs_session_handler.hpp>
 #include <wspp/database/transaction.hpp>
+#include <wspp/util/trace.hpp>
 
 #include <boost/filesystem.hpp>
 
@@ -191,6 +192,7 @@ bool FileSystemSessionHandler::contains(const string &id) {
 }
 
 bool FileSystemSessionHandler::write(const Session &session) {
+    TraceSpan span("session_write") ;
     string id = session.id() ;
     string data = serializeData(session.data()) ;
     return writeSessionData(id, data) ;
@@ -198,10 +200,12 @@ bool FileSystemSessionHandler::write(const Session &session) {
 
 
 bool FileSystemSessionHandler::read(Session &session) {
+    TraceSpan span("session_read") ;
     string id = session.id(), data ;
     if ( !readSessionData(id, data) ) return false ;
     deserializeData(data, session.data()) ;
     gc() ;
+    return true ;
 }
 
 // php like session garbage collection
@@ -0,0 +1,73 @@
+#include <wspp/server/detail/http_date.hpp>
+
+#include <time.h>
+
+namespace wspp { namespace server {
+namespace detail {
+
+std::atomic<std::time_t> http_date::now_(0) ;
+
+http_date::http_date(boost::asio::io_service &io_service): timer_(io_service), stopped_(false) {}
+
+void http_date::start()
+{
+    stopped_ = false ;
+    now_ = std::time(nullptr) ;
+    timer_.expires_from_now(boost::posix_time::seconds(1)) ;
+    schedule() ;
+}
+
+void http_date::schedule()
+{
+    timer_.async_wait([this](const boost::system::error_code &e) {
+        if ( e || stopped_ ) return ;
+
+        now_ = std::time(nullptr) ;
+
+        // stop() may have run since the check above, do not leave the clock frozen
+        if ( stopped_ ) {
+            now_ = 0 ;
+            return ;
+        }
+
+        timer_.expires_at(timer_.expires_at() + boost::posix_time::seconds(1)) ;
+        schedule() ;
+    }) ;
+}
+
+void http_date::stop()
+{
+    stopped_ = true ;
+    now_ = 0 ;
+
+    // the timer is only touched from its own event loop
+    timer_.get_io_service().post([this]() { timer_.cancel() ; }) ;
+}
+
+boost::string_ref http_date::now()
+{
+    static thread_local std::time_t formatted = 0 ;
+    static thread_local char buf[32] ;
+    static thread_local std::size_t len = 0 ;
+
+    std::time_t t = now_.load(std::memory_order_relaxed) ;
+    if ( t == 0 ) t = std::time(nullptr) ;
+
+    if ( t != formatted ) {
+        len = format(t, buf) ;
+        formatted = t ;
+    }
+
+    return boost::string_ref(buf, len) ;
+}
+
+std::size_t http_date::format(std::time_t t, char *buf)
+{
+    struct tm tm ;
+    gmtime_r(&t, &tm) ;
+    return strftime(buf, 30, "%a, %d %b %Y %H:%M:%S GMT", &tm) ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
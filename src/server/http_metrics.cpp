@@ -0,0 +1,22 @@
+#include <wspp/server/detail/http_metrics.hpp>
+
+namespace wspp { namespace server {
+namespace detail {
+
+http_metrics &http_metrics::get()
+{
+    util::MetricsRegistry &registry = util::MetricsRegistry::instance() ;
+
+    static http_metrics metrics{
+        registry.histograms("http_request_duration_seconds", "Time to produce a response, by route and status",
+                            {"route", "status"}),
+        registry.counter("http_received_bytes_total", "Bytes read from clients"),
+        registry.counter("http_sent_bytes_total", "Bytes written to clients")
+    } ;
+
+    return metrics ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
@@ -59,13 +59,23 @@ void io_service_pool::stop()
 }
 
 boost::asio::io_service& io_service_pool::get_io_service()
+{
+    return *io_services_[next_index()];
+}
+
+boost::asio::io_service& io_service_pool::get_io_service(std::size_t index)
+{
+    return *io_services_[index];
+}
+
+std::size_t io_service_pool::next_index()
 {
     // Use a round-robin scheme to choose the next io_service to use.
-    boost::asio::io_service& io_service = *io_services_[next_io_service_];
+    std::size_t index = next_io_service_;
     ++next_io_service_;
     if (next_io_service_ == io_services_.size())
         next_io_service_ = 0;
-    return io_service;
+    return index;
 }
 
 } // namespace detail
@@ -0,0 +1,222 @@
+#include <wspp/server/detail/multipart_parser.hpp>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/regex.hpp>
+
+using namespace std ;
+namespace fs = boost::filesystem ;
+
+namespace wspp { namespace server {
+namespace detail {
+
+// maximum size of the header block of a single part
+static const size_t max_part_headers_size = 8192 ;
+
+fs::path get_temporary_path(const std::string &dir, const std::string &prefix, const std::string &ext)
+{
+    fs::path directory ;
+
+    if ( ! dir.empty() ) directory = dir;
+    else directory = boost::filesystem::temp_directory_path() ;
+
+    std::string varname ="%%%%-%%%%-%%%%-%%%%";
+
+    if ( !prefix.empty() )
+        directory /= prefix + '-' + varname + '.' + ext ;
+    else
+        directory /= "tmp-" + varname + '.' + ext ;
+
+    boost::filesystem::path temp = boost::filesystem::unique_path(directory);
+
+    return temp;
+}
+
+MultipartParser::MultipartParser(const string &boundary, size_t spill_threshold, const string &upload_dir):
+    state_(Preamble), delimiter_("\r\n--" + boundary), spill_threshold_(spill_threshold), upload_dir_(upload_dir),
+    is_file_(false)
+{
+    // the first boundary may appear at the very start of the body i.e. without the leading CRLF
+    buffer_ = "\r\n" ;
+}
+
+bool MultipartParser::parse(const char *data, size_t size)
+{
+    buffer_.append(data, size) ;
+
+    size_t pos = 0 ;
+
+    while ( true ) {
+        if ( state_ == Preamble ) {
+            size_t idx = buffer_.find(delimiter_, pos) ;
+            if ( idx == string::npos ) {
+                // keep enough bytes to match a delimiter split between calls
+                if ( buffer_.size() - pos >= delimiter_.size() )
+                    pos = buffer_.size() - delimiter_.size() + 1 ;
+                break ;
+            }
+            pos = idx + delimiter_.size() ;
+            state_ = AfterBoundary ;
+        }
+        else if ( state_ == AfterBoundary ) {
+            if ( buffer_.size() - pos < 2 ) break ;
+
+            if ( buffer_.compare(pos, 2, "--") == 0 ) {
+                state_ = Done ;
+                pos = buffer_.size() ;
+                break ;
+            }
+            else if ( buffer_.compare(pos, 2, "\r\n") == 0 ) {
+                pos += 2 ;
+                state_ = Headers ;
+            }
+            else return false ;
+        }
+        else if ( state_ == Headers ) {
+            size_t idx = buffer_.find("\r\n\r\n", pos) ;
+            if ( idx == string::npos ) {
+                if ( buffer_.size() - pos > max_part_headers_size ) return false ;
+                break ;
+            }
+
+            if ( !parse_part_headers(buffer_.substr(pos, idx - pos)) ) return false ;
+            pos = idx + 4 ;
+            state_ = Data ;
+        }
+        else if ( state_ == Data ) {
+            size_t idx = buffer_.find(delimiter_, pos) ;
+            if ( idx == string::npos ) {
+                // everything except a possible partial delimiter at the end belongs to the part
+                if ( buffer_.size() - pos >= delimiter_.size() ) {
+                    size_t n = buffer_.size() - pos - delimiter_.size() + 1 ;
+                    if ( !part_data(buffer_.data() + pos, n) ) return false ;
+                    pos += n ;
+                }
+                break ;
+            }
+
+            if ( !part_data(buffer_.data() + pos, idx - pos) ) return false ;
+            end_part() ;
+
+            pos = idx + delimiter_.size() ;
+            state_ = AfterBoundary ;
+        }
+        else {
+            // ignore epilogue
+            pos = buffer_.size() ;
+            break ;
+        }
+    }
+
+    buffer_.erase(0, pos) ;
+    return true ;
+}
+
+bool MultipartParser::parse_part_headers(const string &headers)
+{
+    static const boost::regex disposition_rx(R"#(form-data;\s*name="(.*?)(?=")"(?:\s*;\s*filename="(.*?)(?=")")?)#") ;
+
+    field_name_.clear() ;
+    field_value_.clear() ;
+    file_ = Request::UploadedFile() ;
+    file_.size_ = 0 ;
+    is_file_ = false ;
+
+    vector<string> lines ;
+    boost::split(lines, headers, boost::is_any_of("\r\n"), boost::token_compress_on) ;
+
+    for( const string &s: lines ) {
+        size_t pos = s.find(':') ;
+
+        if ( pos == string::npos ) continue ;
+
+        string key, val ;
+        key.assign(s, 0, pos) ;
+        boost::trim(key) ;
+        val.assign(s, pos+1, s.length() - pos) ;
+        boost::trim(val) ;
+
+        boost::smatch subm ;
+        if ( boost::iequals(key, "Content-Disposition") ) {
+            if ( boost::regex_match(val, subm, disposition_rx) )
+            {
+                field_name_ = subm[1] ;
+                if ( subm[2].matched ) {
+                    file_.name_ = subm[2] ;
+                    is_file_ = !file_.name_.empty() ;
+                }
+            }
+        }
+        else if ( boost::iequals(key, "Content-Type") )
+            file_.mime_ = val ;
+    }
+
+    return !field_name_.empty() ;
+}
+
+bool MultipartParser::part_data(const char *data, size_t size)
+{
+    if ( size == 0 ) return true ;
+
+    if ( !is_file_ ) {
+        field_value_.append(data, size) ;
+        return true ;
+    }
+
+    file_.size_ += size ;
+
+    if ( file_strm_.is_open() ) {
+        file_strm_.write(data, size) ;
+        return !file_strm_.fail() ;
+    }
+
+    file_.data_.append(data, size) ;
+
+    if ( file_.data_.size() > spill_threshold_ ) {
+        // too large to keep in memory, move to a temporary file and write the rest of the part there
+
+        fs::path server_path = get_temporary_path(upload_dir_, "up", "tmp") ;
+
+        file_strm_.open(server_path.string(), ios::binary) ;
+        if ( !file_strm_ ) return false ;
+
+        file_.path_ = server_path.string() ;
+        file_.tmp_file_ = make_shared<Request::TemporaryFile>(file_.path_) ;
+
+        file_strm_.write(file_.data_.data(), file_.data_.size()) ;
+        string().swap(file_.data_) ;
+
+        return !file_strm_.fail() ;
+    }
+
+    return true ;
+}
+
+void MultipartParser::end_part()
+{
+    if ( is_file_ ) {
+        if ( file_strm_.is_open() ) file_strm_.close() ;
+        files_.insert({field_name_, std::move(file_)}) ;
+    }
+    else
+        fields_[field_name_] = std::move(field_value_) ;
+
+    field_value_.clear() ;
+    file_ = Request::UploadedFile() ;
+}
+
+void MultipartParser::decode(Request &req)
+{
+    for( auto &f: fields_ )
+        req.POST_[f.first] = std::move(f.second) ;
+
+    for( auto &f: files_ )
+        req.FILE_.insert({f.first, std::move(f.second)}) ;
+
+    fields_.clear() ;
+    files_.clear() ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
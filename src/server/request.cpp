@@ -4,20 +4,36 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/tokenizer.hpp>
+#include <boost/filesystem.hpp>
+
+#include <memory>
+#include <unordered_map>
 
 using namespace std ;
 
 namespace wspp { namespace server {
 
+// Patterns given as strings are compiled on first use and kept in a per-thread cache, so matching neither compiles a
+// regex per call nor takes a lock. Patterns are expected to be literals of the application, which keeps the cache small.
+
+static const Route &cached_route(const string &pattern)
+{
+    static thread_local unordered_map<string, unique_ptr<Route>> routes ;
+
+    auto it = routes.find(pattern) ;
+    if ( it == routes.end() )
+        it = routes.emplace(pattern, unique_ptr<Route>(new Route(pattern))).first ;
+    return *it->second ;
+}
+
 bool Request::matches(const string &method, const string &pattern, Dictionary &attributes) const
 {
-    return matchesMethod(method) && Route(pattern).matches(path_, attributes) ;
+    return matchesMethod(method) && cached_route(pattern).matches(path_, attributes) ;
 }
 
 bool Request::matches(const string &method, const string &pattern) const
 {
-    Dictionary attributes ;
-    return matchesMethod(method) && Route(pattern).matches(path_, attributes) ;
+    return matchesMethod(method) && cached_route(pattern).matches(path_) ;
 }
 
 bool Request::matches(const string &method, const Route &pattern, Dictionary &attributes) const
@@ -27,15 +43,87 @@ bool Request::matches(const string &method, const Route &pattern, Dictionary &at
 
 bool Request::matches(const string &method, const Route &pattern) const
 {
-    Dictionary attributes ;
-    return matchesMethod(method) && pattern.matches(path_, attributes) ;
+    return matchesMethod(method) && pattern.matches(path_) ;
+}
+
+void Request::clear()
+{
+    // strings and vectors keep their capacity
+    SERVER_.clear() ;
+    GET_.clear() ;
+    POST_.clear() ;
+    COOKIE_.clear() ;
+    FILE_.clear() ;
+    content_.clear() ;
+    content_type_.clear() ;
+    method_.clear() ;
+    path_.clear() ;
+    query_.clear() ;
+    protocol_.clear() ;
+    headers_.clear() ;
+    url_.clear() ;
+    route_.clear() ;
+}
+
+boost::string_ref Request::headerRef(const string &name) const
+{
+    for( const HeaderRef &h: headers_ ) {
+        if ( boost::iequals(h.first, name) ) return h.second ;
+    }
+
+    return boost::string_ref() ;
+}
+
+string Request::header(const string &name, const string &defaultVal) const
+{
+    for( const HeaderRef &h: headers_ ) {
+        if ( boost::iequals(h.first, name) ) return h.second.to_string() ;
+    }
+
+    return SERVER_.get(name, defaultVal) ;
+}
+
+Request::TemporaryFile::~TemporaryFile()
+{
+    boost::system::error_code ec ;
+    boost::filesystem::remove(path_, ec) ;
+}
+
+static const char *method_names[] = { "GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS", "PATCH" } ;
+static const unsigned int num_methods = sizeof(method_names)/sizeof(method_names[0]) ;
+
+unsigned int Request::methodMask(boost::string_ref methods)
+{
+    unsigned int mask = 0 ;
+
+    while ( !methods.empty() ) {
+        size_t sep = methods.find_first_of(" |") ;
+        boost::string_ref m = methods.substr(0, sep) ;
+
+        for( unsigned int i = 0 ; i < num_methods ; i++ )
+            if ( m == method_names[i] ) mask |= 1u << i ;
+
+        if ( sep == boost::string_ref::npos ) break ;
+        methods.remove_prefix(sep + 1) ;
+    }
+
+    return mask ;
 }
 
 bool Request::matchesMethod(const string &method) const
 {
-    vector<string> methods ;
-    boost::split( methods, method, boost::is_any_of(" |"), boost::token_compress_on );
-    return std::find(methods.begin(), methods.end(), method_) != methods.end() ;
+    unsigned int request_mask = methodMask(method_) ;
+    if ( request_mask ) return ( methodMask(method) & request_mask ) != 0 ;
+
+    // not one of the standard methods, compare names
+    boost::string_ref methods(method) ;
+    while ( !methods.empty() ) {
+        size_t sep = methods.find_first_of(" |") ;
+        if ( methods.substr(0, sep) == method_ ) return true ;
+        if ( sep == boost::string_ref::npos ) break ;
+        methods.remove_prefix(sep + 1) ;
+    }
+    return false ;
 }
 
 } // namespace server
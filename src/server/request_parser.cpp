@@ -15,16 +15,13 @@
 #include <wspp/server/request.hpp>
 
 #include <algorithm>
+#include <climits>
 #include <cstring>
 #include <utility>
-#include <fstream>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
-#include <boost/algorithm/string.hpp>
 #include <boost/tokenizer.hpp>
-#include <boost/iostreams/stream.hpp>
 
 
 using namespace std ;
@@ -33,7 +30,7 @@ using namespace wspp::server ;
 namespace wspp { namespace server {
 namespace detail {
 
-RequestParser::RequestParser()
+RequestParser::RequestParser(const ServerOptions &options, arena &storage): options_(options), storage_(&storage)
 {
     memset(&settings_, 0, sizeof(settings_));
     settings_.on_url = &on_url;
@@ -55,9 +52,16 @@ void RequestParser::reset()
 
     parser_.data = this ;
     url_.clear() ;
-    current_header_field_.clear() ;
-    current_header_value_.clear() ;
+    headers_.clear() ;
+    in_header_value_ = false ;
+    header_bytes_ = 0 ;
+    message_begun_ = headers_complete_ = false ;
     body_.clear() ;
+    is_complete_ = false ;
+    keep_alive_ = false ;
+    multipart_.reset() ;
+    body_size_ = 0 ;
+    error_status_ = Response::bad_request ;
 }
 
 
@@ -65,6 +69,7 @@ int RequestParser::on_message_begin(http_parser *parser)
 {
     RequestParser &rp = *static_cast<RequestParser*>(parser->data);
     rp.is_complete_ = false ;
+    rp.message_begun_ = true ;
     return 0;
 }
 
@@ -81,23 +86,95 @@ int RequestParser::on_message_complete(http_parser * parser)
     return 0;
 }
 
+void RequestParser::append_fragment(boost::string_ref &dst, const char *data, size_t size)
+{
+    if ( dst.empty() )
+        dst = boost::string_ref(data, size) ;
+    else if ( dst.data() + dst.size() == data ) // continues in the same buffer
+        dst = boost::string_ref(dst.data(), dst.size() + size) ;
+    else
+        dst = storage_->append(dst, data, size) ;
+}
+
+void RequestParser::own_fragments(const char *data, size_t size)
+{
+    auto own = [&](boost::string_ref &s) {
+        if ( s.data() >= data && s.data() < data + size )
+            s = storage_->copy(s) ;
+    } ;
+
+    own(url_) ;
+
+    for( auto &h: headers_ ) {
+        own(h.first) ;
+        own(h.second) ;
+    }
+}
+
+void RequestParser::relocate(arena &storage)
+{
+    arena &previous = *storage_ ;
+    storage_ = &storage ;
+
+    auto own = [&](boost::string_ref &s) {
+        if ( !s.empty() && previous.owns(s.data()) )
+            s = storage_->copy(s) ;
+    } ;
+
+    own(url_) ;
+
+    for( auto &h: headers_ ) {
+        own(h.first) ;
+        own(h.second) ;
+    }
+}
+
+bool RequestParser::check_header_size(size_t size)
+{
+    header_bytes_ += size ;
+    if ( header_bytes_ > options_.max_header_size_ ) {
+        error_status_ = Response::request_header_fields_too_large ;
+        return false ;
+    }
+    return true ;
+}
+
+boost::string_ref RequestParser::find_header(const char *name) const
+{
+    for( const auto &h: headers_ ) {
+        if ( boost::iequals(h.first, name) ) return h.second ;
+    }
+
+    return boost::string_ref() ;
+}
+
 int RequestParser::on_header_field(http_parser *parser, const char *data, size_t size)
 {
     RequestParser &rp = *static_cast<RequestParser*>(parser->data);
 
-    if ( !rp.current_header_value_.empty() ) {
-        rp.headers_[rp.current_header_field_] = rp.current_header_value_ ;
-        rp.current_header_field_.clear() ;
-        rp.current_header_value_.clear() ;
+    if ( !rp.check_header_size(size) ) return -1 ;
+
+    if ( rp.headers_.empty() || rp.in_header_value_ ) {
+        if ( rp.headers_.size() >= rp.options_.max_header_count_ ) {
+            rp.error_status_ = Response::request_header_fields_too_large ;
+            return -1 ;
+        }
+        rp.headers_.emplace_back() ;
+        rp.in_header_value_ = false ;
     }
-    rp.current_header_field_.append(data, size);
+
+    rp.append_fragment(rp.headers_.back().first, data, size) ;
     return 0 ;
 }
 
 int RequestParser::on_header_value(http_parser *parser, const char *data, size_t size)
 {
     RequestParser& rp = *static_cast<RequestParser*>(parser->data);
-    rp.current_header_value_.append(data, size);
+
+    if ( !rp.check_header_size(size) ) return -1 ;
+
+    rp.in_header_value_ = true ;
+    rp.append_fragment(rp.headers_.back().second, data, size) ;
     return 0 ;
 }
 
@@ -105,20 +182,15 @@ int RequestParser::on_headers_complete(http_parser * parser)
 {
     RequestParser &rp = *static_cast<RequestParser*>(parser->data);
 
-    if ( !rp.current_header_value_.empty() ) {
-        rp.headers_[rp.current_header_field_] = rp.current_header_value_ ;
-        rp.current_header_field_.clear() ;
-        rp.current_header_value_.clear() ;
-    }
-
     // Force the parser to stop after the headers are parsed so clients
     // can process the Request (or response).  This is to properly
     // handle HTTP/1.1 pipelined Requests.
     http_parser_pause(parser, 1);
 
-    ostringstream strm ;
-    strm << "HTTP/" << parser->http_major << "." << parser->http_minor ;
-    rp.protocol_ = strm.str() ;
+    rp.keep_alive_ = http_should_keep_alive(parser) ;
+    rp.headers_complete_ = true ;
+
+    if ( !rp.begin_body() ) return -1 ;
 
     return 0;
 }
@@ -126,50 +198,105 @@ int RequestParser::on_headers_complete(http_parser * parser)
 int RequestParser::on_url(http_parser *parser, const char *data, size_t size)
 {
     RequestParser& rp = *static_cast<RequestParser*>(parser->data);
-    rp.url_.assign(data, size);
+
+    if ( rp.url_.size() + size > rp.options_.max_url_size_ ) {
+        rp.error_status_ = Response::uri_too_long ;
+        return -1 ;
+    }
+
+    rp.append_fragment(rp.url_, data, size) ;
 
     return 0;
 }
 
 int RequestParser::on_body(http_parser * parser, const char *data, size_t size)
 {
-    static_cast<RequestParser*>(parser->data)->body_.append(data, size) ;
+    RequestParser &rp = *static_cast<RequestParser*>(parser->data);
+
+    // chunked bodies have no length up front so check the limit as data arrive
+    rp.body_size_ += size ;
+    if ( rp.body_size_ > rp.options_.max_body_size_ ) {
+        rp.error_status_ = Response::payload_too_large ;
+        return -1 ;
+    }
+
+    if ( rp.multipart_ ) {
+        if ( !rp.multipart_->parse(data, size) ) return -1 ;
+    }
+    else
+        rp.body_.append(data, size) ;
+
     return 0;
 }
 
+bool RequestParser::begin_body()
+{
+    // refuse oversized requests before reading the body
+
+    if ( parser_.content_length != ULLONG_MAX && parser_.content_length > options_.max_body_size_ ) {
+        error_status_ = Response::payload_too_large ;
+        return false ;
+    }
+
+    if ( parser_.method != HTTP_POST ) return true ;
 
+    boost::string_ref content_type = find_header("Content-Type") ;
+    if ( content_type.empty() ) return true ;
 
-boost::tribool RequestParser::parse(const char *data, size_t size)
+    static const boost::regex multipart_rx("multipart/form-data;\\s*boundary=\"?([^\";]+)\"?.*", boost::regex::icase) ;
+
+    boost::cmatch subm ;
+    if ( boost::regex_match(content_type.begin(), content_type.end(), subm, multipart_rx) )
+        multipart_.reset(new MultipartParser(subm[1], options_.upload_spill_threshold_, options_.upload_dir_)) ;
+    else if ( parser_.content_length != ULLONG_MAX )
+        body_.reserve(parser_.content_length) ;
+
+    return true ;
+}
+
+
+
+boost::tribool RequestParser::parse(const char *data, size_t size, size_t &consumed)
 {
-    std::size_t used = http_parser_execute(&parser_, &settings_, data, size);
-
-    const http_errno error = static_cast< http_errno >(parser_.http_errno);
-
-  // The 'on_message_complete' and 'on_headers_complete' callbacks fail
-  // on purpose to force the parser to stop between pipelined Requests.
-  // This allows the clients to reliably detect the end of headers and
-  // the end of the message.  Make sure the parser is always unpaused
-  // for the next call to 'feed'.
-
-  if (error == HPE_PAUSED) {
-      http_parser_pause(&parser_, 0);
-  }
-
-  if (used < size)
-  {
-      if (error == HPE_PAUSED)
-      {
-          // Make sure the byte that triggered the pause
-          // after the headers is properly processed.
-          if ( !is_complete_ )
-              used += http_parser_execute(&parser_, &settings_, data + used, size - used);
-      }
-      else {
-          return false ;
-      }
-  }
-
-  return ( is_complete_ ? boost::tribool(true) : boost::indeterminate ) ;
+    std::size_t used = 0 ;
+
+    while ( used < size ) {
+
+        used += http_parser_execute(&parser_, &settings_, data + used, size - used);
+
+        const http_errno error = static_cast< http_errno >(parser_.http_errno);
+
+        // The 'on_message_complete' and 'on_headers_complete' callbacks fail
+        // on purpose to force the parser to stop between pipelined Requests.
+        // This allows the clients to reliably detect the end of headers and
+        // the end of the message.  Make sure the parser is always unpaused
+        // for the next call to 'feed'.
+
+        if ( error == HPE_PAUSED ) {
+            http_parser_pause(&parser_, 0);
+
+            // stop at the message boundary, the rest belongs to the next request
+            if ( is_complete_ ) break ;
+        }
+        else if ( error != HPE_OK ) {
+            consumed = used ;
+            return false ;
+        }
+        else if ( parser_.upgrade ) {
+            // protocol upgrades are not supported
+            consumed = used ;
+            return false ;
+        }
+    }
+
+    consumed = used ;
+
+    if ( is_complete_ ) return true ;
+
+    // the rest of the message comes with the next read, which overwrites data
+    own_fragments(data, size) ;
+
+    return boost::indeterminate ;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -183,22 +310,21 @@ static int hex_decode(char c)
     else return 0 ;
 }
 
-std::string url_decode(const char *str)
+static std::string url_decode(boost::string_ref src)
 {
-    const char *p = str ;
+    const char *p = src.begin(), *end = src.end() ;
 
     std::string ret ;
-    while ( *p )
+    ret.reserve(src.size()) ;
+
+    while ( p != end )
     {
         if( *p == '+' ) ret += ' ' ;
-        else if ( *p == '%' )
+        else if ( *p == '%' && end - p > 2 )
         {
-            ++p ;
-            char tmp[4];
-            unsigned char val = 16 * ( hex_decode(*p++) )  ;
-            val += hex_decode(*p) ;
-            sprintf(tmp,"%c", val);
-            ret += tmp ;
+            unsigned char val = 16 * hex_decode(p[1]) + hex_decode(p[2]) ;
+            ret += static_cast<char>(val) ;
+            p += 2 ;
         } else ret += *p ;
         ++p ;
     }
@@ -211,9 +337,9 @@ static bool has_url_field( http_parser_url &url, http_parser_url_fields field )
     return ((url.field_set & (1 << int(field))) != 0);
 }
 
-static std::string get_url_field ( const string &data, http_parser_url &url, http_parser_url_fields field ) {
-    if ( !has_url_field(url, field) ) return string() ;
-    return ( data.substr(url.field_data[int(field)].off, url.field_data[int(field)].len) );
+static boost::string_ref get_url_field ( boost::string_ref data, http_parser_url &url, http_parser_url_fields field ) {
+    if ( !has_url_field(url, field) ) return boost::string_ref() ;
+    return data.substr(url.field_data[int(field)].off, url.field_data[int(field)].len) ;
 }
 
 // fix invalid paths
@@ -222,6 +348,11 @@ static string normalize_path( const string &src ) {
 
     if ( src.empty() ) return "/" ;
 
+    // most paths are already in canonical form
+    if ( src[0] == '/' && src.find("//") == string::npos && src.find("/.") == string::npos &&
+         ( src.size() == 1 || src.back() != '/' ) )
+        return src ;
+
     std::vector<std::string> src_segments, dst_segments;
     boost::split(src_segments, src, [](char ch) {
          return ch == '/';
@@ -244,19 +375,19 @@ static string normalize_path( const string &src ) {
     return res ;
 }
 
-static bool parse_url(Request &req, const string url)
+static bool parse_url(Request &req, boost::string_ref url)
 {
     http_parser_url u ;
 
-    int result = http_parser_parse_url(url.c_str(), url.length(), 0, &u);
+    int result = http_parser_parse_url(url.data(), url.length(), 0, &u);
 
     if ( result ) return false ;
 
-    string uri = get_url_field(url, u, UF_PATH) ;
-    string query = get_url_field(url, u, UF_QUERY) ;
+    boost::string_ref uri = get_url_field(url, u, UF_PATH) ;
+    boost::string_ref query = get_url_field(url, u, UF_QUERY) ;
 
-    req.path_ = normalize_path(url_decode(uri.c_str())) ;
-    req.query_ = url_decode(query.c_str()) ;
+    req.path_ = normalize_path(url_decode(uri)) ;
+    req.query_ = url_decode(query) ;
 
     if ( !req.query_.empty() )
     {
@@ -292,7 +423,7 @@ static bool parse_cookie(Request &session, const std::string &data)
 
     if ( pos == -1 ) return false ;
 
-    boost::regex rx("[ \n\r\t\f\v]*") ;
+    static const boost::regex rx("[ \n\r\t\f\v]*") ;
     boost::smatch rm ;
 
     boost::regex_search(data, rm, rx) ;
@@ -306,13 +437,11 @@ static bool parse_cookie(Request &session, const std::string &data)
     return true ;
 }
 
-static bool parse_cookies(Request &session)
+static bool parse_cookies(Request &session, boost::string_ref header)
 {
-    const char *ck = "Cookie" ;
+    if ( header.data() == nullptr ) return true ;
 
-    if ( session.SERVER_.count(ck) == 0 ) return true ;
-
-    std::string data = session.SERVER_[ck] ;
+    std::string data = header.to_string() ;
 
     if ( data.empty() ) return false ;
 
@@ -341,249 +470,75 @@ static bool parse_cookies(Request &session)
     return true ;
 }
 
-static std::string get_next_line(std::istream &strm, int maxc = 1000)
-{
-    std::string res ;
-    char b0, b1 ;
-    int count = 0 ;
-
-    while ( count < maxc && !strm.eof() )
-    {
-        b0 = strm.get() ;
-        count ++ ;
-
-        if ( b0 == '\r' )
-        {
-            b1 = strm.get() ;
-            count ++ ;
-
-            if ( b1 == '\n' ) return res ;
-            else {
-                res += b0 ;
-                res += b1 ;
-            }
-        }
-        else res += b0 ;
-
-    }
-
-    return res ;
-}
-
-namespace fs = boost::filesystem ;
-
-fs::path get_temporary_path(const std::string &dir, const std::string &prefix, const std::string &ext)
+static void parse_urlencoded(const string &data, Dictionary &dict)
 {
-    std::string retVal ;
+    // parse name value pairs
 
-    fs::path directory ;
+    typedef boost::tokenizer<boost::char_separator<char>>   tokenizer;
 
-    if ( ! dir.empty() ) directory = dir;
-    else directory = boost::filesystem::temp_directory_path() ;
+    boost::char_separator<char> sep("&");
+    tokenizer tokens(data, sep);
 
-    std::string varname ="%%%%-%%%%-%%%%-%%%%";
-
-    if ( !prefix.empty() )
-        directory /= prefix + '-' + varname + '.' + ext ;
-    else
-        directory /= "tmp-" + varname + '.' + ext ;
-
-    boost::filesystem::path temp = boost::filesystem::unique_path(directory);
-
-    return temp;
-}
-
-
-static bool parse_mime_data(Request &session, istream &strm, const string &fld, const string &file_name,
-                          const string &content_type,
-                          const string trans_encoding,
-                          const string &bnd)
-{
-    std::string data ;
-    char b[4] = {0} ;
-
-    while ( strm )
+    for (tokenizer::iterator it = tokens.begin(); it != tokens.end(); ++it)
     {
-        char c = strm.get();
-        b[0] = b[1] ; b[1] = b[2] ; b[2] = b[3] ; b[3] = c ;
-
-        if ( b[0] == '\r' && b[1] == '\n' && b[2] == '-' && b[3] == '-') {
-            data.resize(data.size() - 3) ;
-            int bndlen = bnd.length();
-            string buf ;
-            buf.resize(bndlen) ;
+        const std::string &str = (*it) ;
 
-            strm.read(&buf[0], bndlen) ;
+        size_t pos = str.find('=') ;
+        if ( pos == string::npos ) continue ;
 
-            if ( buf == bnd ) {
-                strm.get() ; strm.get() ;
-                break ;
-            }
-        }
-        else data.push_back(c) ;
+        std::string key, val ;
+        key = str.substr(0, pos) ;
+        val = str.substr(pos+1) ;
+        dict[url_decode(key)] = url_decode(val) ;
     }
-
-    if ( file_name.empty() ) session.POST_[fld] = data ;
-    else
-    {
-        static const size_t file_upload_max_size = 20 * 1024 * 1024 ;
-        static const size_t file_upload_persist_file_size = 1 * 1024 * 1024 ;
-
-        size_t dsize = data.size() ;
-
-        if ( dsize <= file_upload_max_size ) {
-            Request::UploadedFile file_info ;
-
-            file_info.mime_ = content_type ;
-            file_info.name_ = file_name ;
-            file_info.data_ = data ;
-
-/*
-            if ( dsize > file_upload_persist_file_size ) {
-                boost::filesystem::path server_path = get_temporary_path(string(), "up", "tmp") ;
-
-                ofstream strm(server_path.string(), ios::binary) ;
-                strm.write(&data[0], data.size()) ;
-
-                file_info.path_ = server_path.string() ;
-            } else {
-            */
-
-            /*}*/
-
-            file_info.size_ = data.size() ;
-            session.FILE_.insert({fld, file_info}) ;
-        }
-    }
-
-    return true ;
 }
 
-
-static bool parse_multipart_data(Request &session, istream &strm, const string &bnd)
+static const char *protocol_str(const http_parser &parser)
 {
-    std::string s = get_next_line(strm) ;
-    if ( s.empty() ) return false ;
-
-    if ( s.compare(2, bnd.length(), bnd ) != 0 ) return false ;
-
-    while ( 1 )
-    {
-
-        std::string form_field, file_name, content_type, trans_encoding;
-
-        while ( 1 )
-        {
-            s = get_next_line(strm) ;
-            if ( s.empty() ) break ;
-
-            size_t pos = s.find(':') ;
-
-            if ( pos != string::npos ) {
-                std::string key, val ;
-                key.assign(s, 0, pos) ;
-                boost::trim(key) ;
-                val.assign(s, pos+1, s.length() - pos) ;
-                boost::trim(val) ;
-
-                boost::smatch subm ;
-                if ( key == "Content-Disposition" ) {
-                    if ( boost::regex_match(val, subm, boost::regex(R"#(form-data;\s*name="(.*?)(?=")"(?:\s*;\s*filename="(.*?)(?=")")?)#") ) )
-                    {
-                        form_field = subm[1] ;
-                        file_name = subm[2] ;
-                    }
-                }
-                else if ( key.compare(0, 12, "Content-Type") == 0 )
-                    content_type = val ;
-                else if ( key.compare(0, 25, "Content-Transfer-Encoding") == 0 )
-                    trans_encoding = val ;
-            }
-        }
-
-        if ( form_field.empty() ) break;
-
-        // Parse content
-
-        if ( ! parse_mime_data(session, strm, form_field, file_name, content_type, trans_encoding, bnd) ) return false ;
-
-
-    }
-
-    return true ;
+    if ( parser.http_major == 1 && parser.http_minor == 1 ) return "HTTP/1.1" ;
+    else if ( parser.http_major == 1 && parser.http_minor == 0 ) return "HTTP/1.0" ;
+    else if ( parser.http_major == 0 && parser.http_minor == 9 ) return "HTTP/0.9" ;
+    else return "HTTP/1.1" ;
 }
 
+bool RequestParser::decode_message(Request &req) {
 
-static bool parse_form_data(Request &session, istream &strm)
-{
-    size_t content_length = session.SERVER_.value<int>("Content-Length", 0) ;
-
-    std::string content_type = session.SERVER_.get("Content-Type") ;
-
-    if ( content_type.empty() && content_length > 0 )
-        return false ;
-
-    boost::smatch subm ;
-
-    if ( boost::starts_with(content_type, "application/x-www-form-urlencoded") )
-    {
-        // parse name value pairs
-
-        std::string s = get_next_line(strm, content_length) ;
-
-        typedef boost::tokenizer<boost::char_separator<char>>   tokenizer;
+    req.headers_.assign(headers_.begin(), headers_.end()) ;
+    req.url_ = url_ ;
 
-        boost::char_separator<char> sep("&");
-        tokenizer tokens(s, sep);
-
-        for (tokenizer::iterator it = tokens.begin(); it != tokens.end(); ++it)
-        {
-            std::string str = (*it) ;
-
-            size_t pos = str.find('=') ;
-            if ( pos == string::npos ) return false ;
-
-            std::string key, val ;
-            key = str.substr(0, pos) ;
-            val = str.substr(pos+1) ;
-            session.POST_[url_decode(key.c_str())] = url_decode(val.c_str()) ;
-        }
+    if ( !options_.header_views_ ) {
+        for( const auto &hdr: headers_ )
+            req.SERVER_.add(hdr.first.to_string(), hdr.second.to_string()) ;
     }
-    else if ( boost::regex_match(content_type, subm, boost::regex("multipart/form-data;\\s*boundary=(.*)")  )) {
-        std::string boundary = subm[1] ;
-        parse_multipart_data(session, strm, boundary) ;
-
-    }
-    else if ( content_length )  {
-        session.content_.resize(content_length) ;
-        strm.read(&session.content_[0], content_length) ;
-        session.content_type_ = content_type ;
-
-    }
-
-    return true ;
-}
-
-
-bool RequestParser::decode_message(Request &req) const {
-
-    for( auto hdr: headers_ )
-        req.SERVER_.add(hdr.first, hdr.second) ;
 
     req.method_ = req.SERVER_["REQUEST_METHOD"] =	http_method_str(static_cast<http_method>(parser_.method)) ;
-    req.protocol_ = protocol_ ;
-    req.content_ = body_ ;
+    req.protocol_ = protocol_str(parser_) ;
 
     if ( !parse_url(req, url_) ||
-        !parse_cookies(req) ) return false ;
+        !parse_cookies(req, find_header("Cookie")) ) return false ;
+
+    if ( multipart_ ) {
+        if ( !multipart_->is_complete() ) return false ;
+        multipart_->decode(req) ;
+        return true ;
+    }
 
     if ( req.method_ == "POST" )
     {
-        stringstream reqstr(body_) ;
+        std::string content_type = find_header("Content-Type").to_string() ;
+
+        if ( content_type.empty() && !body_.empty() )
+            return false ;
 
-        if ( !parse_form_data(req, reqstr) ) return false ;
+        if ( boost::starts_with(content_type, "application/x-www-form-urlencoded") )
+            parse_urlencoded(body_, req.POST_) ;
+        else
+            req.content_type_ = content_type ;
     }
 
+    req.content_ = std::move(body_) ;
+    body_.clear() ;
+
     return true ;
 }
 
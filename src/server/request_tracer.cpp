@@ -0,0 +1,167 @@
+#include <wspp/server/detail/request_tracer.hpp>
+#include <wspp/server/server_options.hpp>
+#include <wspp/server/request.hpp>
+#include <wspp/server/response.hpp>
+#include <wspp/util/logger.hpp>
+
+#include <unistd.h>
+
+using namespace std ;
+using namespace wspp::util ;
+
+namespace wspp { namespace server {
+namespace detail {
+
+/// Events are buffered and handed to the writer thread in blocks of about this size.
+static const size_t trace_flush_size = 64 * 1024 ;
+
+request_tracer::request_tracer(const ServerOptions &options): server_timing_(options.server_timing_),
+    slow_request_us_(options.slow_request_logger_ ? options.slow_request_ms_ * 1000 : 0),
+    slow_request_sample_(options.slow_request_sample_), slow_request_logger_(options.slow_request_logger_),
+    slow_requests_(0), epoch_(TraceContext::clock::now()), trace_file_(nullptr), first_event_(true), stop_(false)
+{
+    if ( !options.trace_file_.empty() ) {
+        trace_file_ = fopen(options.trace_file_.c_str(), "w") ;
+        if ( trace_file_ ) {
+            fputs("[\n", trace_file_) ;
+            writer_ = std::thread(&request_tracer::write_file, this) ;
+        }
+    }
+
+    enabled_ = server_timing_ || slow_request_us_ || trace_file_ ;
+}
+
+request_tracer::~request_tracer() {
+    if ( !trace_file_ ) return ;
+
+    {
+        lock_guard<mutex> lock(mutex_) ;
+        if ( !events_.empty() ) pending_.push_back(std::move(events_)) ;
+        stop_ = true ;
+    }
+    wakeup_.notify_one() ;
+    writer_.join() ;
+
+    fputs("\n]\n", trace_file_) ;
+    fclose(trace_file_) ;
+}
+
+void request_tracer::write_file() {
+    for(;;) {
+        string block ;
+        {
+            unique_lock<mutex> lock(mutex_) ;
+            wakeup_.wait(lock, [this]() { return stop_ || !pending_.empty() ; }) ;
+            if ( pending_.empty() ) return ;
+            block = std::move(pending_.front()) ;
+            pending_.pop_front() ;
+        }
+
+        fwrite(block.data(), 1, block.size(), trace_file_) ;
+    }
+}
+
+void request_tracer::add_server_timing(Response &resp, const TraceContext &trace) const {
+    if ( !server_timing_ ) return ;
+
+    string timing = trace.serverTiming() ;
+
+    char total[48] ;
+    snprintf(total, sizeof(total), "%stotal;dur=%.2f", timing.empty() ? "" : ", ", trace.elapsed() / 1000.0) ;
+    timing += total ;
+
+    resp.headers_.replace("Server-Timing", timing) ;
+}
+
+void request_tracer::finish(const Request &req, const Response &resp, const TraceContext &trace, size_t connection_id) {
+    int64_t total = trace.elapsed() ;
+
+    if ( slow_request_us_ && total >= slow_request_us_ )
+        log_slow_request(req, resp, trace, total) ;
+
+    if ( trace_file_ )
+        write_events(req, resp, trace, total, connection_id) ;
+}
+
+void request_tracer::log_slow_request(const Request &req, const Response &resp, const TraceContext &trace, int64_t total) {
+    uint64_t n = slow_requests_++ ;
+    if ( slow_request_sample_ > 1 && n % slow_request_sample_ ) return ;
+
+    Logger &logger = *slow_request_logger_ ;
+    LOG_X_STREAM(logger, Warning, "Slow request " << req.method_ << " " << req.path_ << " " << (int)resp.status_ <<
+                 " in " << total / 1000.0 << " ms: " << trace.summary()) ;
+}
+
+static void append_json_string(string &out, const string &s) {
+    out += '"' ;
+    for( char c: s ) {
+        if ( c == '"' || c == '\\' ) {
+            out += '\\' ;
+            out += c ;
+        }
+        else if ( (unsigned char)c < 0x20 ) {
+            char buf[8] ;
+            snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c) ;
+            out += buf ;
+        }
+        else out += c ;
+    }
+    out += '"' ;
+}
+
+// complete ("X") event of the trace event format
+static void append_event(string &out, const string &name, int64_t ts, int64_t dur, long pid, size_t tid) {
+    out += "{\"name\":" ;
+    append_json_string(out, name) ;
+    out += ",\"ph\":\"X\",\"ts\":" ;
+    out += to_string(ts) ;
+    out += ",\"dur\":" ;
+    out += to_string(dur) ;
+    out += ",\"pid\":" ;
+    out += to_string(pid) ;
+    out += ",\"tid\":" ;
+    out += to_string(tid) ;
+}
+
+void request_tracer::write_events(const Request &req, const Response &resp, const TraceContext &trace, int64_t total,
+                                  size_t connection_id) {
+    static const long pid = getpid() ;
+
+    int64_t base = chrono::duration_cast<chrono::microseconds>(trace.startTime() - epoch_).count() ;
+
+    string events ;
+
+    // the requests of a connection follow each other, so each connection gets a row (thread) of its own
+    append_event(events, req.method_ + " " + req.path_, base, total, pid, connection_id) ;
+    events += ",\"args\":{\"status\":" ;
+    events += to_string((int)resp.status_) ;
+    events += "}}" ;
+
+    for( size_t i=0 ; i<trace.size() ; i++ ) {
+        const TraceContext::Span &s = trace[i] ;
+        if ( s.duration_ < 0 ) continue ;
+
+        events += ",\n" ;
+        append_event(events, s.name_, base + s.start_, s.duration_, pid, connection_id) ;
+        events += '}' ;
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_) ;
+
+        if ( !first_event_ ) events_ += ",\n" ;
+        first_event_ = false ;
+        events_ += events ;
+
+        if ( events_.size() < trace_flush_size ) return ;
+
+        pending_.push_back(std::move(events_)) ;
+        events_.clear() ;
+    }
+
+    wakeup_.notify_one() ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
@@ -12,13 +12,17 @@
 #include <wspp/util/zstream.hpp>
 #include <wspp/util/filesystem.hpp>
 #include <wspp/server/exceptions.hpp>
+#include <wspp/server/detail/http_date.hpp>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/asio.hpp>
 #include <boost/date_time.hpp>
 #include <boost/regex.hpp>
+#include <boost/algorithm/string.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -34,37 +38,49 @@ namespace wspp { namespace server {
 namespace status_strings {
 
 const std::string ok =
-        "HTTP/1.0 200 OK\r\n";
+        "HTTP/1.1 200 OK\r\n";
 const std::string created =
-        "HTTP/1.0 201 Created\r\n";
+        "HTTP/1.1 201 Created\r\n";
 const std::string accepted =
-        "HTTP/1.0 202 Accepted\r\n";
+        "HTTP/1.1 202 Accepted\r\n";
 const std::string no_content =
-        "HTTP/1.0 204 No Content\r\n";
+        "HTTP/1.1 204 No Content\r\n";
+const std::string partial_content =
+        "HTTP/1.1 206 Partial Content\r\n";
 const std::string multiple_choices =
-        "HTTP/1.0 300 Multiple Choices\r\n";
+        "HTTP/1.1 300 Multiple Choices\r\n";
 const std::string moved_permanently =
-        "HTTP/1.0 301 Moved Permanently\r\n";
+        "HTTP/1.1 301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-        "HTTP/1.0 302 Moved Temporarily\r\n";
+        "HTTP/1.1 302 Moved Temporarily\r\n";
 const std::string not_modified =
-        "HTTP/1.0 304 Not Modified\r\n";
+        "HTTP/1.1 304 Not Modified\r\n";
 const std::string bad_request =
-        "HTTP/1.0 400 Bad Request\r\n";
+        "HTTP/1.1 400 Bad Request\r\n";
 const std::string unauthorized =
-        "HTTP/1.0 401 Unauthorized\r\n";
+        "HTTP/1.1 401 Unauthorized\r\n";
 const std::string forbidden =
-        "HTTP/1.0 403 Forbidden\r\n";
+        "HTTP/1.1 403 Forbidden\r\n";
 const std::string not_found =
-        "HTTP/1.0 404 Not Found\r\n";
+        "HTTP/1.1 404 Not Found\r\n";
+const std::string request_timeout =
+        "HTTP/1.1 408 Request Timeout\r\n";
+const std::string payload_too_large =
+        "HTTP/1.1 413 Payload Too Large\r\n";
+const std::string uri_too_long =
+        "HTTP/1.1 414 URI Too Long\r\n";
+const std::string range_not_satisfiable =
+        "HTTP/1.1 416 Range Not Satisfiable\r\n";
+const std::string request_header_fields_too_large =
+        "HTTP/1.1 431 Request Header Fields Too Large\r\n";
 const std::string internal_server_error =
-        "HTTP/1.0 500 Internal Server Error\r\n";
+        "HTTP/1.1 500 Internal Server Error\r\n";
 const std::string not_implemented =
-        "HTTP/1.0 501 Not Implemented\r\n";
+        "HTTP/1.1 501 Not Implemented\r\n";
 const std::string bad_gateway =
-        "HTTP/1.0 502 Bad Gateway\r\n";
+        "HTTP/1.1 502 Bad Gateway\r\n";
 const std::string service_unavailable =
-        "HTTP/1.0 503 Service Unavailable\r\n";
+        "HTTP/1.1 503 Service Unavailable\r\n";
 
 boost::asio::const_buffer to_buffer(Response::Status status)
 {
@@ -78,6 +94,8 @@ boost::asio::const_buffer to_buffer(Response::Status status)
         return boost::asio::buffer(accepted);
     case Response::no_content:
         return boost::asio::buffer(no_content);
+    case Response::partial_content:
+        return boost::asio::buffer(partial_content);
     case Response::multiple_choices:
         return boost::asio::buffer(multiple_choices);
     case Response::moved_permanently:
@@ -94,6 +112,16 @@ boost::asio::const_buffer to_buffer(Response::Status status)
         return boost::asio::buffer(forbidden);
     case Response::not_found:
         return boost::asio::buffer(not_found);
+    case Response::request_timeout:
+        return boost::asio::buffer(request_timeout);
+    case Response::payload_too_large:
+        return boost::asio::buffer(payload_too_large);
+    case Response::uri_too_long:
+        return boost::asio::buffer(uri_too_long);
+    case Response::range_not_satisfiable:
+        return boost::asio::buffer(range_not_satisfiable);
+    case Response::request_header_fields_too_large:
+        return boost::asio::buffer(request_header_fields_too_large);
     case Response::internal_server_error:
         return boost::asio::buffer(internal_server_error);
     case Response::not_implemented:
@@ -117,28 +145,32 @@ const char crlf[] = { '\r', '\n' };
 } // namespace misc_strings
 
 
-/// Convert the reply into a vector of buffers. The buffers do not own the
-/// underlying memory blocks, therefore the reply object must remain valid and
-/// not be changed until the write operation has completed.
+/// Write the status line and headers of the reply into out, replacing its contents, so that the head of a response
+/// goes out as one buffer. out is owned by the connection and keeps its capacity from one response to the next. A
+/// Date header is added unless the reply already has one.
 
-
-std::vector<boost::asio::const_buffer> response_to_buffers(Response &rep, bool is_head)
+void serialize_response_head(const Response &rep, std::string &out)
 {
-    std::vector<boost::asio::const_buffer> buffers;
-    buffers.push_back(status_strings::to_buffer(rep.status_));
+    boost::asio::const_buffer status = status_strings::to_buffer(rep.status_) ;
+
+    out.assign(boost::asio::buffer_cast<const char *>(status), boost::asio::buffer_size(status)) ;
 
     for( const auto &h: rep.headers_ )
     {
-        buffers.push_back(boost::asio::buffer(h.first));
-        buffers.push_back(boost::asio::buffer(misc_strings::name_value_separator));
-        buffers.push_back(boost::asio::buffer(h.second));
-        buffers.push_back(boost::asio::buffer(misc_strings::crlf));
+        out.append(h.first) ;
+        out.append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator)) ;
+        out.append(h.second) ;
+        out.append(misc_strings::crlf, sizeof(misc_strings::crlf)) ;
     }
-    if ( !is_head ) {
-        buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-        buffers.push_back(boost::asio::buffer(rep.content_));
+
+    if ( !rep.headers_.contains("Date") ) {
+        boost::string_ref date = detail::http_date::now() ;
+        out.append("Date: ", 6) ;
+        out.append(date.data(), date.size()) ;
+        out.append(misc_strings::crlf, sizeof(misc_strings::crlf)) ;
     }
-    return buffers;
+
+    out.append(misc_strings::crlf, sizeof(misc_strings::crlf)) ;
 }
 
 namespace stock_replies {
@@ -199,6 +231,31 @@ const char not_found[] =
         "<head><title>Not Found</title></head>"
         "<body><h1>404 Not Found</h1></body>"
         "</html>";
+const char payload_too_large[] =
+        "<html>"
+        "<head><title>Payload Too Large</title></head>"
+        "<body><h1>413 Payload Too Large</h1></body>"
+        "</html>";
+const char request_timeout[] =
+        "<html>"
+        "<head><title>Request Timeout</title></head>"
+        "<body><h1>408 Request Timeout</h1></body>"
+        "</html>";
+const char uri_too_long[] =
+        "<html>"
+        "<head><title>URI Too Long</title></head>"
+        "<body><h1>414 URI Too Long</h1></body>"
+        "</html>";
+const char request_header_fields_too_large[] =
+        "<html>"
+        "<head><title>Request Header Fields Too Large</title></head>"
+        "<body><h1>431 Request Header Fields Too Large</h1></body>"
+        "</html>";
+const char range_not_satisfiable[] =
+        "<html>"
+        "<head><title>Range Not Satisfiable</title></head>"
+        "<body><h1>416 Range Not Satisfiable</h1></body>"
+        "</html>";
 const char internal_server_error[] =
         "<html>"
         "<head><title>Internal Server Error</title></head>"
@@ -248,6 +305,16 @@ std::string to_string(Response::Status status)
         return forbidden;
     case Response::not_found:
         return not_found;
+    case Response::payload_too_large:
+        return payload_too_large;
+    case Response::range_not_satisfiable:
+        return range_not_satisfiable;
+    case Response::request_timeout:
+        return request_timeout;
+    case Response::uri_too_long:
+        return uri_too_long;
+    case Response::request_header_fields_too_large:
+        return request_header_fields_too_large;
     case Response::internal_server_error:
         return internal_server_error;
     case Response::not_implemented:
@@ -266,46 +333,75 @@ std::string to_string(Response::Status status)
 void Response::stockReply(Response::Status status)
 {
     status_ = status;
+    generator_ = nullptr ;
+    file_ = FileBody() ;
+    headers_.remove("Transfer-Encoding") ;
+
+    shared_content_.reset() ;
+
+    // these have no body; validators set by the handler (Etag, Last-Modified) are kept
+    if ( status == not_modified || status == no_content ) {
+        content_.clear() ;
+        headers_.remove("Content-Type") ;
+        headers_.remove("Content-Length") ;
+        return ;
+    }
+
     content_.assign(stock_replies::to_string(status));
     setContentType("text/html");
     setContentLength() ;
 }
 
-static void gmt_time_string(char *buf, size_t buf_len, time_t *t) {
-    strftime(buf, buf_len, "%a, %d %b %Y %H:%M:%S GMT", gmtime(t));
-}
-
-void Response::encodeFileData(const std::string &bytes, const std::string &encoding, const std::string &mime, time_t mod_time)
+void Response::clear()
 {
-    status_ = ok ;
+    status_ = not_found ;
+    headers_.clear() ;
+    content_.clear() ;
+    shared_content_.reset() ;
+    generator_ = nullptr ;
+    file_ = FileBody() ;
+}
 
-    if ( bytes.empty() ) return ;
+static bool is_gzip_data(const char *bytes, size_t size) {
+    return size >= 2 && bytes[0] == 0x1f && bytes[1] == (char)0x8b ;
+}
 
+// headers common to in-memory and file payloads
+static void add_file_headers(Dictionary &headers, uint64_t size, bool gzipped, const std::string &encoding,
+                             const std::string &mime, time_t mod_time)
+{
     if ( encoding.empty() ) // try gzip encoding
     {
-        if ( bytes.size() > 2 && bytes[0] == 0x1f && bytes[1] == 0x8b )
-            headers_.add("Content-Encoding", "gzip") ;
+        if ( gzipped )
+            headers.add("Content-Encoding", "gzip") ;
     }
     else
-        headers_.add("Content-Encoding", encoding) ;
+        headers.add("Content-Encoding", encoding) ;
 
     if ( !mime.empty() )
-        headers_.add("Content-Type", mime) ;
+        headers.add("Content-Type", mime) ;
 
-    headers_.add("Access-Control-Allow-Origin", "*") ;
+    headers.add("Access-Control-Allow-Origin", "*") ;
 
-    char ctime_buf[64], mtime_buf[64] ;
-    time_t curtime = time(nullptr) ;
+    // Date is added when the response is serialized
+    char mtime_buf[32] ;
+    detail::http_date::format(mod_time, mtime_buf) ;
+    headers.add("Last-Modified", mtime_buf) ;
 
-    gmt_time_string(ctime_buf, sizeof(ctime_buf), &curtime);
-    gmt_time_string(mtime_buf, sizeof(mtime_buf), &mod_time);
+    headers.add("Accept-Ranges", "bytes") ;
+    headers.add("Etag", "\"" + boost::lexical_cast<std::string>(mod_time) + "-" + boost::lexical_cast<std::string>(size) + "\"") ;
+    headers.add("Content-Length", boost::lexical_cast<std::string>(size)) ;
+}
 
-    headers_.add("Date", ctime_buf) ;
-    headers_.add("Last-Modified", mtime_buf) ;
+void Response::encodeFileData(const std::string &bytes, const std::string &encoding, const std::string &mime, time_t mod_time)
+{
+    status_ = ok ;
+    file_ = FileBody() ;
+    shared_content_.reset() ;
 
+    if ( bytes.empty() ) return ;
 
-    headers_.add("Etag", boost::lexical_cast<std::string>(mod_time)) ;
-    headers_.add("Content-Length", boost::lexical_cast<std::string>(bytes.size())) ;
+    add_file_headers(headers_, bytes.size(), is_gzip_data(bytes.data(), bytes.size()), encoding, mime, mod_time) ;
 
     content_.assign(bytes) ;
 }
@@ -339,6 +435,144 @@ static string get_file_mime(const string &mime,  const boost::filesystem::path &
 
 
 
+// a satisfiable byte range [first_, last_] of the representation
+struct ByteRange {
+    uint64_t first_, last_ ;
+} ;
+
+// more ranges than this in a single request are not honoured
+static const size_t max_byte_ranges = 16 ;
+
+static bool parse_byte_offset(const string &s, uint64_t &val) {
+    if ( s.empty() || s.size() > 19 || !std::all_of(s.begin(), s.end(), ::isdigit) ) return false ;
+    val = std::stoull(s) ;
+    return true ;
+}
+
+// Parse a "bytes=..." header for a representation of the given size. Returns false if the header is invalid and has
+// to be ignored, otherwise ranges holds the satisfiable ranges (possibly none).
+
+static bool parse_byte_ranges(const string &header, uint64_t size, vector<ByteRange> &ranges)
+{
+    if ( !boost::starts_with(header, "bytes=") ) return false ;
+
+    vector<string> specs ;
+    boost::split(specs, header.substr(6), boost::is_any_of(","), boost::token_compress_on) ;
+
+    if ( specs.size() > max_byte_ranges ) return false ;
+
+    for( string &spec: specs ) {
+        boost::trim(spec) ;
+
+        size_t dash = spec.find('-') ;
+        if ( dash == string::npos ) return false ;
+
+        string first = spec.substr(0, dash), last = spec.substr(dash + 1) ;
+        uint64_t a, b ;
+
+        if ( first.empty() ) { // last n bytes
+            if ( !parse_byte_offset(last, b) ) return false ;
+            if ( b == 0 || size == 0 ) continue ;
+            ranges.push_back({ b >= size ? 0 : size - b, size - 1 }) ;
+        }
+        else {
+            if ( !parse_byte_offset(first, a) ) return false ;
+            if ( last.empty() ) b = size - 1 ;
+            else if ( !parse_byte_offset(last, b) || b < a ) return false ;
+
+            if ( a >= size ) continue ;
+            ranges.push_back({ a, std::min(b, size - 1) }) ;
+        }
+    }
+
+    return true ;
+}
+
+static string content_range(uint64_t first, uint64_t last, uint64_t size) {
+    return "bytes " + to_string(first) + "-" + to_string(last) + "/" + to_string(size) ;
+}
+
+void Response::applyRange(const string &range, const string &if_range)
+{
+    if ( range.empty() || status_ != ok || headers_.get("Accept-Ranges") != "bytes" ) return ;
+
+    // the client copy is out of date, send the whole file
+    if ( !if_range.empty() && if_range != headers_.get("Etag") && if_range != headers_.get("Last-Modified") ) return ;
+
+    bool has_file = !file_.path_.empty() ;
+    const string &content = body() ;
+    uint64_t size = has_file ? file_.length_ : content.size() ;
+
+    vector<ByteRange> ranges ;
+    if ( !parse_byte_ranges(range, size, ranges) ) return ;
+
+    if ( ranges.empty() ) {
+        headers_.remove("Content-Encoding") ;
+        stockReply(range_not_satisfiable) ;
+        headers_.replace("Content-Range", "bytes */" + to_string(size)) ;
+        return ;
+    }
+
+    status_ = partial_content ;
+
+    if ( ranges.size() == 1 ) {
+        const ByteRange &r = ranges[0] ;
+        uint64_t length = r.last_ - r.first_ + 1 ;
+
+        if ( has_file ) {
+            file_.offset_ += r.first_ ;
+            file_.length_ = length ;
+        }
+        else {
+            content_ = content.substr(r.first_, length) ;
+            shared_content_.reset() ;
+        }
+
+        headers_.replace("Content-Range", content_range(r.first_, r.last_, size)) ;
+        headers_.replace("Content-Length", to_string(length)) ;
+        return ;
+    }
+
+    static std::atomic<uint64_t> boundary_counter(0) ;
+    string boundary = "wspp" + to_string(time(nullptr)) + "x" + to_string(++boundary_counter) ;
+    string mime = headers_.get("Content-Type") ;
+
+    string parts ;
+    uint64_t total = 0 ;
+
+    for( const ByteRange &r: ranges ) {
+        uint64_t length = r.last_ - r.first_ + 1 ;
+
+        string header = "\r\n--" + boundary + "\r\n" ;
+        if ( !mime.empty() ) header += "Content-Type: " + mime + "\r\n" ;
+        header += "Content-Range: " + content_range(r.first_, r.last_, size) + "\r\n\r\n" ;
+
+        total += header.size() + length ;
+
+        if ( has_file )
+            file_.parts_.push_back({ header, file_.offset_ + r.first_, length }) ;
+        else
+            parts.append(header).append(content, r.first_, length) ;
+    }
+
+    string trailer = "\r\n--" + boundary + "--\r\n" ;
+    total += trailer.size() ;
+
+    if ( has_file ) file_.trailer_ = trailer ;
+    else {
+        content_ = parts + trailer ;
+        shared_content_.reset() ;
+    }
+
+    headers_.replace("Content-Type", "multipart/byteranges; boundary=" + boundary) ;
+    headers_.replace("Content-Length", to_string(total)) ;
+}
+
+string Response::fileMimeType(const string &path)
+{
+    return get_file_mime(string(), path) ;
+}
+
 void Response::encodeFile(const std::string &file_path, const std::string &encoding, const std::string &mime )
 {
     if ( !fs::exists(file_path) ) {
@@ -346,14 +580,33 @@ void Response::encodeFile(const std::string &file_path, const std::string &encod
         return ;
     }
 
-    time_t mod_time = boost::filesystem::last_write_time(file_path);
-
-    string bytes = readFileToString(file_path) ;
+    boost::system::error_code ec ;
+    time_t mod_time = fs::last_write_time(file_path, ec);
+    uint64_t size = fs::file_size(file_path, ec) ;
+    if ( ec ) throw HttpResponseException(Response::not_found) ;
 
     string omime = mime.empty() ? get_file_mime(mime, file_path) : mime ;
 
-    encodeFileData(bytes, encoding, omime, mod_time) ;
+    // only the magic bytes are read here, the body is sent from the file by the connection
+    char magic[2] ;
+    bool gzipped = false ;
+    if ( encoding.empty() ) {
+        ifstream strm(file_path, ios::binary) ;
+        strm.read(magic, 2) ;
+        gzipped = is_gzip_data(magic, strm.gcount()) ;
+    }
+
+    status_ = ok ;
+    content_.clear() ;
+    shared_content_.reset() ;
+    file_ = FileBody() ;
 
+    if ( size == 0 ) return ;
+
+    add_file_headers(headers_, size, gzipped, encoding, omime, mod_time) ;
+
+    file_.path_ = file_path ;
+    file_.length_ = size ;
 }
 
 void Response::writeJSON(const string &obj)
@@ -368,22 +621,40 @@ void Response::writeJSONVariant(const Variant &var)
 
 void Response::write(const string &content, const string &mime)
 {
+    file_ = FileBody() ;
+    shared_content_.reset() ;
     content_.assign(content) ;
     setContentType(mime) ;
     setContentLength() ;
     setStatus(ok) ;
 }
 
+void Response::writeStream(const ContentGenerator &gen, const string &mime)
+{
+    content_.clear() ;
+    shared_content_.reset() ;
+    file_ = FileBody() ;
+    generator_ = gen ;
+    setContentType(mime) ;
+    headers_.remove("Content-Length") ;
+    headers_.replace("Transfer-Encoding", "chunked") ;
+    setStatus(ok) ;
+}
+
 void Response::setContentType(const string &mime) {
     headers_.replace("Content-Type", mime) ;
 }
 
 void Response::setContentLength() {
-    headers_.replace("Content-Length", to_string(content_.size())) ;
+    headers_.replace("Content-Length", to_string(body().size())) ;
 }
 
 void Response::append(const string &content)
 {
+    if ( shared_content_ ) {
+        content_ = *shared_content_ ;
+        shared_content_.reset() ;
+    }
     content_.append(content) ;
 }
 
@@ -391,8 +662,8 @@ void Response::setCookie(const string &name, const string &value, time_t expires
 {
     string cookie = name + '=' + value ;
     if ( expires > 0 ) {
-        char etime_buf[64] ;
-        gmt_time_string(etime_buf, sizeof(etime_buf), &expires);
+        char etime_buf[32] ;
+        detail::http_date::format(expires, etime_buf) ;
         cookie += "; Expires=" ; cookie += etime_buf ;
     }
 
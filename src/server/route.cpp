@@ -1,39 +1,37 @@
 #include <wspp/server/route.hpp>
 #include <boost/regex.hpp>
-#include <boost/thread.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include <cassert>
+#include <iostream>
 
 using namespace std ;
 using namespace wspp::util ;
 
 namespace wspp { namespace server {
 
-struct RouteElement {
-
-    RouteElement(const string &name, const string &pattern, bool optional):
-        name_(name), pattern_(pattern), optional_(optional) {}
-
-    string name_ ;
-    string pattern_ ;
-    bool optional_ ;
-};
+typedef Route::Element RouteElement ;
 
 struct RouteImpl {
 public:
     RouteImpl(const std::string &pattern) {
         if ( pattern.back() == '/' ) pattern_ = pattern ;
         else pattern_ = pattern + '/' ;
-        assert(parse(pattern_)) ;
+        // not inside assert, which is compiled out in release builds
+        bool parsed = parse(pattern_) ;
+        assert(parsed) ; (void)parsed ;
+        makeRegex() ;
     }
     bool parse(const string &pattern) ;
-    bool makeRegex() ;
-    bool match(const string &path, Dictionary &vars);
+    void makeRegex() ;
+    bool match(const string &path, Dictionary *vars) const ;
     string url(const Dictionary &params, bool relative) const;
 
     vector<RouteElement> elements_ ;
     string pattern_ ;
+
+    // compiled once and only read afterwards, so matching needs no locking
+    boost::regex rx_ ;
 };
 
 
@@ -92,97 +90,53 @@ bool RouteImpl::parse(const string &pattern) {
 }
 
 
-class UriPatternMatcher {
-public:
-
-    bool matches(const string &pattern, const RouteImpl &route, const string &uri, Dictionary &vars) ;
-
-    static UriPatternMatcher &instance() {
-        static UriPatternMatcher the_instance ;
-        return the_instance;
-    }
-
-private:
-    boost::regex makeRegexFromPattern(const string &pat, const RouteImpl &route_data);
-    bool matchPattern(const boost::regex &rx, const RouteImpl &route, const string &path, Dictionary &vars) ;
-
-    std::map<std::string, boost::regex> cache_ ;
-    mutable boost::mutex cache_mutex_ ;
-};
-
-bool UriPatternMatcher::matchPattern(const boost::regex &rx, const RouteImpl &route, const string &path, Dictionary &vars)
-{
-    boost::smatch results ;
-    if ( boost::regex_match(path, results, rx) ) {
-        for( const RouteElement &e: route.elements_ ) {
-            if ( !e.name_.empty() ) {
-                string val = results[e.name_].str() ;
-                if ( !val.empty() ) vars[e.name_] = val ;
-            }
-        }
-        return true ;
-    }
-
-    return false ;
-}
-
-bool UriPatternMatcher::matches(const string &pattern, const RouteImpl &route, const string &uri, Dictionary &vars) {
-    boost::unique_lock<boost::mutex> l(cache_mutex_) ;
-
-    auto it = cache_.find(pattern) ;
-    if ( it != cache_.end() )  // pattern exists in cache
-        return matchPattern(it->second, route, uri, vars) ;
-    else {
-        boost::regex rxs = makeRegexFromPattern(pattern, route) ;
-        bool res = matchPattern(rxs, route, uri, vars) ;
-        cache_[pattern] = std::move(rxs) ;
-        return res ;
-    }
-}
+// The path is matched with or without a trailing slash
 
-boost::regex  UriPatternMatcher::makeRegexFromPattern(const string &pat, const RouteImpl &route) {
+void RouteImpl::makeRegex() {
     string rx ;
 
-    vector<string> patterns ;
-    for( const RouteElement &e: route.elements_ ) {
-        string param = e.name_ ;
+    for( const RouteElement &e: elements_ ) {
         string pattern = e.pattern_ ;
 
         if ( pattern.empty() ) pattern = "[^\\/]+" ;
 
-        if ( !param.empty() ) {
-            patterns.push_back("(?<" + param + ">" + pattern +  ")" ) ;
-        }
+        if ( !e.name_.empty() )
+            pattern = "(?<" + e.name_ + ">" + pattern +  ")" ;
         else
-            patterns.push_back( "(?:" + pattern + ")") ;
-    }
-
-    auto it = route.elements_.begin() ;
-    auto pit = patterns.begin() ;
+            pattern = "(?:" + pattern + ")" ;
 
-    for(  ; it != route.elements_.end() ; ++it, ++pit ) {
-        const RouteElement &e = *it ;
-
-        if ( e.optional_ ) rx += "(?:" + *pit + "\\/)?"  ;
-        else rx += "(?:" + *pit + "\\/)";
+        if ( e.optional_ ) rx += "(?:\\/" + pattern + ")?"  ;
+        else rx += "\\/" + pattern ;
     }
 
-    rx = "^\\/" + rx + '$';
-
+    rx = "^" + rx + "\\/?$" ;
 
     try {
-        boost::regex res(rx, boost::regex::perl) ;
-        return res ;
+        rx_.assign(rx, boost::regex::perl) ;
     }
     catch ( boost::bad_expression &e ) {
         cout << e.what() << endl ;
-        return boost::regex() ;
     }
 }
 
-bool RouteImpl::match(const string &path, Dictionary &data) {
-    return UriPatternMatcher::instance().matches(pattern_, *this, path, data) ;
+bool RouteImpl::match(const string &path, Dictionary *vars) const {
+    if ( rx_.empty() ) return false ;
+
+    if ( !vars ) return boost::regex_match(path, rx_) ;
+
+    // reused so that matching does not allocate
+    static thread_local boost::smatch results ;
+
+    if ( !boost::regex_match(path, results, rx_) ) return false ;
 
+    for( const RouteElement &e: elements_ ) {
+        if ( !e.name_.empty() ) {
+            const auto &m = results[e.name_] ;
+            if ( m.matched && m.length() > 0 ) (*vars)[e.name_] = m.str() ;
+        }
+    }
+
+    return true ;
 }
 
 string RouteImpl::url(const Dictionary &params, bool relative) const {
@@ -213,26 +167,22 @@ Route::Route(const string &pattern): impl_(new RouteImpl(pattern)) {
 
 Route::~Route() {}
 
-static string get_clean_path(const std::string &path)
-{
-    if ( path.back() != '/' ) return path + '/' ;
-    else return path ;
-}
-
 bool Route::matches(const string &path, Dictionary &data) const {
-    return impl_->match(get_clean_path(path), data) ;
-
+    return impl_->match(path, &data) ;
 }
 
 bool Route::matches(const string &path) const {
-    Dictionary data ;
-    return matches(path, data) ;
+    return impl_->match(path, nullptr) ;
 }
 
 string Route::url(const Dictionary &params, bool relative) const  {
     return impl_->url(params, relative) ;
 }
 
+const vector<Route::Element> &Route::elements() const {
+    return impl_->elements_ ;
+}
+
 } // namespace server
 } // namespace wspp
 
@@ -0,0 +1,189 @@
+#include <wspp/server/router.hpp>
+#include <wspp/server/exceptions.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std ;
+
+namespace wspp { namespace server {
+
+struct Router::Node {
+
+    struct Param {
+        string name_, pattern_ ;
+        boost::regex rx_ ;          // empty when any element matches
+        unique_ptr<Node> node_ ;
+    };
+
+    vector<pair<string, unique_ptr<Node>>> literals_ ; // sorted by text
+    vector<Param> params_ ;                            // in the order added
+    vector<size_t> routes_ ;                           // routes ending at this node
+};
+
+struct Router::Match {
+    static const size_t max_params = 16 ;
+
+    typedef pair<const string *, boost::string_ref> Capture ;
+
+    Capture captures_[max_params], best_[max_params] ;
+    size_t num_captures_ = 0, num_best_ = 0 ;
+    size_t route_ = string::npos ;
+};
+
+// elements without parameter may still contain regex syntax in which case they are matched as unnamed parameters
+static bool is_literal(const string &pattern) {
+    return pattern.find_first_of("\\^$.|?*+()[]{}") == string::npos ;
+}
+
+Router::Router(): root_(new Node) {
+}
+
+Router::~Router() {
+}
+
+void Router::addRoute(const string &methods, const string &pattern, Handler handler, const string &name)
+{
+    // the route is only recorded once it has been inserted in the tree, which fails on an invalid regex
+
+    size_t idx = routes_.size() ;
+    unique_ptr<Entry> entry(new Entry(pattern, Request::methodMask(methods), handler)) ;
+
+    try {
+        insert(*root_, entry->route_.elements(), 0, idx, false) ;
+    }
+    catch ( boost::bad_expression &e ) {
+        throw std::runtime_error("invalid regex in route " + pattern + ": " + e.what()) ;
+    }
+
+    routes_.push_back(std::move(entry)) ;
+    if ( !name.empty() ) named_[name] = idx ;
+}
+
+void Router::insert(Node &node, const vector<Route::Element> &elements, size_t pos, size_t route, bool optional)
+{
+    // an optional element makes the route match without it and any elements following it, so the route ends at
+    // every node from there on. The route is added to the nodes after the rest of the pattern has been inserted, so
+    // that an invalid regex further on leaves no trace of it.
+
+    const Route::Element *e = ( pos < elements.size() ) ? &elements[pos] : nullptr ;
+
+    if ( !e ) {
+        node.routes_.push_back(route) ;
+        return ;
+    }
+
+    bool ends_here = optional || e->optional_ ;
+
+    Node *child = nullptr ;
+
+    if ( e->name_.empty() && is_literal(e->pattern_) ) {
+        auto it = lower_bound(node.literals_.begin(), node.literals_.end(), e->pattern_,
+                              [](const pair<string, unique_ptr<Node>> &a, const string &b) { return a.first < b ; }) ;
+        if ( it == node.literals_.end() || it->first != e->pattern_ )
+            it = node.literals_.emplace(it, e->pattern_, unique_ptr<Node>(new Node)) ;
+        child = it->second.get() ;
+    }
+    else {
+        for( auto &p: node.params_ )
+            if ( p.name_ == e->name_ && p.pattern_ == e->pattern_ ) child = p.node_.get() ;
+
+        if ( !child ) {
+            Node::Param p ;
+            p.name_ = e->name_ ;
+            p.pattern_ = e->pattern_ ;
+            if ( !e->pattern_.empty() ) p.rx_.assign(e->pattern_, boost::regex::perl) ;
+            p.node_.reset(new Node) ;
+            child = p.node_.get() ;
+            node.params_.push_back(std::move(p)) ;
+        }
+    }
+
+    insert(*child, elements, pos + 1, route, ends_here) ;
+
+    if ( ends_here ) node.routes_.push_back(route) ;
+}
+
+void Router::find(const Node &node, boost::string_ref path, unsigned int method, Match &m) const
+{
+    if ( path.empty() ) {
+        for( size_t r: node.routes_ ) {
+            if ( r < m.route_ && ( routes_[r]->methods_ & method ) ) {
+                m.route_ = r ;
+                std::copy(m.captures_, m.captures_ + m.num_captures_, m.best_) ;
+                m.num_best_ = m.num_captures_ ;
+            }
+        }
+        return ;
+    }
+
+    size_t slash = path.find('/') ;
+    boost::string_ref element = path.substr(0, slash) ;
+    boost::string_ref rest = ( slash == boost::string_ref::npos ) ? boost::string_ref() : path.substr(slash + 1) ;
+
+    auto it = lower_bound(node.literals_.begin(), node.literals_.end(), element,
+                          [](const pair<string, unique_ptr<Node>> &a, boost::string_ref b) { return boost::string_ref(a.first) < b ; }) ;
+    if ( it != node.literals_.end() && it->first == element )
+        find(*it->second, rest, method, m) ;
+
+    if ( element.empty() || m.num_captures_ == Match::max_params ) return ;
+
+    for( const auto &p: node.params_ ) {
+
+        // a parameter ending a route may match the rest of the path, slashes included (e.g. {path:.*})
+        if ( !p.rx_.empty() && !rest.empty() && !p.node_->routes_.empty() &&
+             boost::regex_match(path.begin(), path.end(), p.rx_) ) {
+            m.captures_[m.num_captures_++] = Match::Capture(&p.name_, path) ;
+            find(*p.node_, boost::string_ref(), method, m) ;
+            --m.num_captures_ ;
+        }
+
+        if ( !p.rx_.empty() && !boost::regex_match(element.begin(), element.end(), p.rx_) ) continue ;
+
+        m.captures_[m.num_captures_++] = Match::Capture(&p.name_, element) ;
+        find(*p.node_, rest, method, m) ;
+        --m.num_captures_ ;
+    }
+}
+
+bool Router::dispatch(const Request &req, Response &resp) const
+{
+    // leading and trailing slashes are ignored as with Route::matches
+    boost::string_ref path(req.path_) ;
+    while ( !path.empty() && path.front() == '/' ) path.remove_prefix(1) ;
+    if ( !path.empty() && path.back() == '/' ) path.remove_suffix(1) ;
+
+    Match m ;
+    find(*root_, path, Request::methodMask(req.method_), m) ;
+
+    if ( m.route_ == string::npos ) return false ;
+
+    Dictionary params ;
+    for( size_t i = 0 ; i < m.num_best_ ; i++ ) {
+        const Match::Capture &c = m.best_[i] ;
+        if ( !c.first->empty() ) params[*c.first] = c.second.to_string() ;
+    }
+
+    const Entry &e = *routes_[m.route_] ;
+    req.route_ = e.pattern_ ;
+    e.handler_(req, resp, params) ;
+    return true ;
+}
+
+void Router::handle(const Request &req, Response &resp)
+{
+    if ( !dispatch(req, resp) )
+        throw HttpResponseException(Response::not_found) ;
+}
+
+string Router::url(const string &name, const Dictionary &params, bool relative) const
+{
+    auto it = named_.find(name) ;
+    if ( it == named_.end() ) return string() ;
+    return routes_[it->second]->route_.url(params, relative) ;
+}
+
+} // namespace server
+} // namespace wspp
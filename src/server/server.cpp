@@ -1,15 +1,18 @@
 #include <wspp/server/server.hpp>
 #include <wspp/server/detail/connection.hpp>
-#include <boost/make_shared.hpp>
+#include <wspp/util/metrics.hpp>
 
 namespace wspp { namespace server {
 
 Server::Server(const std::string& address, const std::string& port,
-               std::size_t io_service_pool_size)
+               std::size_t io_service_pool_size, const ServerOptions &options)
     : io_service_pool_(io_service_pool_size),
       signals_(io_service_pool_.get_io_service()),
-      acceptor_(io_service_pool_.get_io_service()),
-      socket_(io_service_pool_.get_io_service())
+      connection_manager_(io_service_pool_),
+      admission_(options, io_service_pool_size),
+      tracer_(options),
+      date_(io_service_pool_.get_io_service(0)),
+      options_(options)
 {
     // Register to handle the signals that indicate when the server should exit.
     // It is safe to register for the same signal multiple times in a program,
@@ -22,16 +25,79 @@ Server::Server(const std::string& address, const std::string& port,
 
     do_await_stop();
 
-    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-    boost::asio::ip::tcp::resolver resolver(acceptor_.get_io_service());
+    if ( options_.worker_threads_ > 0 )
+        workers_.reset(new detail::worker_pool(options_.worker_threads_)) ;
+
+    register_metrics() ;
+
+    boost::asio::ip::tcp::resolver resolver(io_service_pool_.get_io_service(0));
     boost::asio::ip::tcp::resolver::query query(address, port);
     boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
 
-    acceptor_.open(endpoint.protocol());
-    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    acceptor_.bind(endpoint);
-    acceptor_.listen();
+#if defined(SO_REUSEPORT)
+    if ( options_.reuse_port_ ) {
+        // one listener per event loop, the kernel balances incoming connections between them
+        for( std::size_t i = 0 ; i < io_service_pool_.size() ; i++ )
+            open_listener(i, endpoint) ;
+        return ;
+    }
+#endif
+
+    open_listener(io_service_pool_.next_index(), endpoint) ;
+}
+
+#if defined(SO_REUSEPORT)
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port ;
+#endif
+
+void Server::open_listener(std::size_t loop_index, const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    listeners_.emplace_back(new Listener(io_service_pool_.get_io_service(loop_index), loop_index)) ;
+    boost::asio::ip::tcp::acceptor &acceptor = listeners_.back()->acceptor_ ;
+
+    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+    if ( options_.reuse_port_ )
+        acceptor.set_option(reuse_port(true)) ;
+#endif
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
 
+Server::~Server()
+{
+    util::MetricsRegistry::instance().removeCollectors(this) ;
+}
+
+void Server::register_metrics()
+{
+    typedef std::vector<std::pair<util::MetricLabels, double>> Samples ;
+    util::MetricsRegistry &registry = util::MetricsRegistry::instance() ;
+
+    registry.addCollector(this, "http_connections_open", "Open client connections", [this](Samples &s) {
+        s.push_back({{}, (double)connection_manager_.count()}) ;
+    }) ;
+
+    registry.addCollector(this, "http_requests_in_flight", "Requests admitted and not yet handled", [this](Samples &s) {
+        s.push_back({{}, (double)admission_.stats().in_flight_}) ;
+    }) ;
+
+    registry.addCollector(this, "http_requests_rejected_total", "Requests refused with 503 by load shedding", [this](Samples &s) {
+        s.push_back({{}, (double)admission_.stats().rejected_}) ;
+    }, "counter") ;
+
+    registry.addCollector(this, "http_event_loop_lag_seconds", "Delay of a periodic timer on each event loop", [this](Samples &s) {
+        for( std::size_t i = 0 ; i < io_service_pool_.size() ; i++ )
+            s.push_back({{{"loop", std::to_string(i)}}, admission_.loop_lag(i) / 1000.0}) ;
+    }) ;
+
+    if ( workers_ ) {
+        registry.addCollector(this, "http_worker_queue_depth", "Requests waiting for a handler thread", [this](Samples &s) {
+            s.push_back({{}, (double)workers_->stats().queued_}) ;
+        }) ;
+    }
 }
 
 void Server::addFilter(Filter *filter) {
@@ -45,39 +111,63 @@ void Server::setHandler(RequestHandler *handler) {
 
 void Server::run()
 {
-    start_accept();
+    if ( workers_ ) workers_->run() ;
+    date_.start() ;
+    for( std::size_t i = 0 ; i < io_service_pool_.size() ; i++ )
+        admission_.monitor(io_service_pool_.get_io_service(i), i) ;
+    for( auto &listener: listeners_ )
+        start_accept(*listener);
     io_service_pool_.run();
 }
 
-void Server::start_accept()
+void Server::start_accept(Listener &listener)
 {
-    //new_connection_.reset(new connection(io_service_pool_.get_io_service(), handler_factory_));
-    acceptor_.async_accept(socket_, [this] ( const boost::system::error_code& e ){
+    // create the next connection on one of the pool's io_services so that connections are spread over all threads.
+    // With one listener per loop the connection stays on the loop that accepted it.
+
+    std::size_t loop ;
+
+    if ( listeners_.size() > 1 )
+        loop = listener.loop_index_ ;
+    else if ( options_.scheduling_ == ServerOptions::LeastLoaded )
+        loop = connection_manager_.least_loaded_loop() ;
+    else
+        loop = io_service_pool_.next_index() ;
+
+    listener.new_connection_.reset(new HttpConnection(io_service_pool_.get_io_service(loop), loop,
+                                             connection_manager_, filters_, options_, admission_, tracer_, workers_.get()));
+
+    listener.acceptor_.async_accept(listener.new_connection_->socket_, [this, &listener] ( const boost::system::error_code& e ){
 
         // Check whether the server was stopped by a signal before this
              // completion handler had a chance to run.
-             if (!acceptor_.is_open())
+             if (!listener.acceptor_.is_open())
              {
                return;
              }
 
-             if (!e)
+             if (!e && !connection_manager_.start(listener.new_connection_, options_.max_connections_))
              {
-
-               connection_manager_.start(boost::make_shared<HttpConnection>(
-                   std::move(socket_), connection_manager_, filters_));
+               // over the connection limit, drop it rather than let it queue
+               boost::system::error_code ignored_ec;
+               listener.new_connection_->socket_.close(ignored_ec);
              }
 
-        //if (!e) new_connection_->start();
-        start_accept();
+        start_accept(listener);
     }) ;
 }
 
 void Server::handle_stop()
 {
-    acceptor_.close();
-    connection_manager_.stop_all();
-    io_service_pool_.stop();
+    for( auto &listener: listeners_ ) {
+        boost::system::error_code ignored_ec;
+        listener->acceptor_.close(ignored_ec);
+    }
+    if ( workers_ ) workers_->stop() ;
+    date_.stop() ;
+
+    // the loops close their own connections and have to run until every one of them has done so
+    connection_manager_.stop_all([this]() { io_service_pool_.stop() ; });
 }
 
 
@@ -98,6 +188,32 @@ void Server::stop()
     handle_stop() ;
 }
 
+std::vector<std::size_t> Server::connectionsPerLoop()
+{
+    return connection_manager_.connections_per_loop() ;
+}
+
+std::vector<std::size_t> Server::acceptsPerLoop()
+{
+    return connection_manager_.accepts_per_loop() ;
+}
+
+WorkerPoolStats Server::workerPoolStats() const
+{
+    if ( workers_ ) return workers_->stats() ;
+    else return WorkerPoolStats{0, 0, 0, 0} ;
+}
+
+AllocationStats Server::allocationStats() const
+{
+    return detail::allocation_stats() ;
+}
+
+AdmissionStats Server::admissionStats() const
+{
+    return admission_.stats() ;
+}
+
 
 } // namespace server
 } // namespace wspp
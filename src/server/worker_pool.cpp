@@ -0,0 +1,66 @@
+#include <wspp/server/detail/worker_pool.hpp>
+
+#include <stdexcept>
+#include <boost/bind.hpp>
+
+namespace wspp { namespace server {
+namespace detail {
+
+worker_pool::worker_pool(std::size_t pool_size)
+    : work_(new boost::asio::io_service::work(io_service_)), pool_size_(pool_size),
+      queued_(0), active_(0), max_queued_(0), completed_(0)
+{
+    if (pool_size == 0)
+        throw std::runtime_error("worker_pool size is 0");
+}
+
+void worker_pool::run()
+{
+    for (std::size_t i = 0; i < pool_size_; ++i)
+    {
+        boost::shared_ptr<boost::thread> thread(new boost::thread(
+                                                    boost::bind(&boost::asio::io_service::run, &io_service_)));
+        threads_.push_back(thread);
+    }
+}
+
+void worker_pool::stop()
+{
+    work_.reset();
+    io_service_.stop();
+
+    for (std::size_t i = 0; i < threads_.size(); ++i)
+        threads_[i]->join();
+    threads_.clear();
+}
+
+void worker_pool::post(const std::function<void()> &job)
+{
+    std::size_t depth = ++queued_;
+
+    // keep track of the peak queue depth
+    std::size_t peak = max_queued_.load();
+    while ( depth > peak && !max_queued_.compare_exchange_weak(peak, depth) ) ;
+
+    io_service_.post([this, job]() {
+        --queued_;
+        ++active_;
+        job();
+        --active_;
+        ++completed_;
+    });
+}
+
+WorkerPoolStats worker_pool::stats() const
+{
+    WorkerPoolStats s ;
+    s.queued_ = queued_.load() ;
+    s.active_ = active_.load() ;
+    s.max_queued_ = max_queued_.load() ;
+    s.completed_ = completed_.load() ;
+    return s ;
+}
+
+} // namespace detail
+} // namespace server
+} // namespace wspp
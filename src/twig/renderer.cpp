@@ -1,5 +1,7 @@
 #include <wspp/twig/renderer.hpp>
 #include <wspp/twig/context.hpp>
+#include <wspp/util/metrics.hpp>
+#include <wspp/util/trace.hpp>
 #include "parser.hpp"
 
 using namespace std ;
@@ -8,8 +10,17 @@ namespace wspp { namespace twig {
 
 using namespace detail ;
 
+static util::MetricFamily<util::Histogram> &render_duration() {
+    static util::MetricFamily<util::Histogram> &family = util::MetricsRegistry::instance().histograms(
+                "template_render_duration_seconds", "Time spent rendering templates, including compilation", {"template"}) ;
+    return family ;
+}
+
 string TemplateRenderer::render(const string &resource, const Variant::Object &ctx)
 {
+    util::MetricTimer timer(render_duration().with({resource})) ;
+    util::TraceSpan span("render") ;
+
     auto ast = compile(resource) ;
 
     TemplateEvalContext eval_ctx(*this, ctx) ;
@@ -21,6 +32,8 @@ string TemplateRenderer::render(const string &resource, const Variant::Object &c
 
 string TemplateRenderer::renderString(const string &str, const Variant::Object &ctx)
 {
+    util::MetricTimer timer(render_duration().with({"<string>"})) ;
+    util::TraceSpan span("render") ;
 
     auto ast = compileString(str) ;
 
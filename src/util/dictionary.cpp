@@ -41,7 +41,7 @@ void Dictionary::removeSome(const regex &rx)
 
 void Dictionary::clear() 
 {
-    clear() ;
+    SSMap::clear() ;
 }
 		
 
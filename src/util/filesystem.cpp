@@ -2,6 +2,11 @@
 
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std ;
 
 namespace wspp { namespace util {
@@ -20,6 +25,29 @@ string readFileToString(const string &fileName)
     return res ;
 }
 
+MappedFile::MappedFile(const string &fileName): data_(nullptr), size_(0)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY) ;
+    if ( fd < 0 ) return ;
+
+    struct stat st ;
+    if ( ::fstat(fd, &st) == 0 && st.st_size > 0 ) {
+        void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) ;
+        if ( p != MAP_FAILED ) {
+            data_ = static_cast<const char *>(p) ;
+            size_ = st.st_size ;
+        }
+    }
+
+    // the mapping stays valid after closing the descriptor
+    ::close(fd) ;
+}
+
+MappedFile::~MappedFile()
+{
+    if ( data_ ) ::munmap(const_cast<char *>(data_), size_) ;
+}
+
 
 
 
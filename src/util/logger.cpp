@@ -1,4 +1,5 @@
 #include <wspp/util/logger.hpp>
+#include <wspp/util/zfstream.hpp>
 
 #include <iostream>
 
@@ -6,6 +7,7 @@
 #include <stdio.h>
 
 #include <cstdarg>
+#include <cstring>
 #include <fstream>
 
 #include <boost/algorithm/string.hpp>
@@ -16,6 +18,7 @@
 
 #include <fcntl.h>
 #include <cstdio>
+#include <algorithm>
 
 #if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__CYGWIN__)
 #  include <fcntl.h>
@@ -31,273 +34,210 @@ namespace wspp { namespace util {
 
 const std::string LogPatternFormatter::DefaultFormat = "%d{%c}-%r-(%t) %f %l %c:";
 
-static string levelToString(LogLevel ltype)
+static const char *levelToString(LogLevel ltype, bool upper = false)
 {
-    switch (ltype)
-    {
-        case Error:
-            return "Error";
-        case Warning:
-            return "Warning";
-        case Debug:
-            return "Debug";
-        case Info:
-            return "Info";
-        case Trace:
-            return "Trace";
-        default:
-            return string();
-    }
+    static const char *names[] = { "Trace", "Debug", "Info", "Warning", "Error", "Fatal" } ;
+    static const char *upper_names[] = { "TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL" } ;
+
+    if ( ltype < Trace || ltype > Fatal ) return "" ;
+    return upper ? upper_names[ltype] : names[ltype] ;
 }
 
-#define LITERAL_STATE 0
-#define CONVERTER_STATE 1
-#define DOT_STATE 2
-#define MIN_STATE 3
-#define MAX_STATE 4
-#define COMMAND_STATE 5
+// Compile the pattern into tokens, so that formatting a message no longer parses it
 
-static void printFormatedString(std::ostream &strm, const string &buffer, bool leftAlign, int minLength, int maxLength)
+void LogPatternFormatter::compile(const string &pattern)
 {
-    int rawLength = buffer.length() ;
-
-    if ( rawLength > maxLength ) {
-        strm.write(buffer.c_str() + rawLength - maxLength, maxLength) ;
-    } else if (rawLength < minLength) {
-        if ( leftAlign ) {
-            strm.write(buffer.c_str(), rawLength) ;
-            for(int i=0 ; i<minLength - rawLength ; i++ ) strm.put(' ') ;
-        } else {
-
-            for(int i=0 ; i<minLength - rawLength ; i++ ) strm.put(' ') ;
-            strm.write(buffer.c_str(), rawLength) ;
-        }
-    }
-    else strm.write(buffer.c_str(), rawLength) ;
+    enum { Literal, Converter, Dot, Min, Max, Command } state = Literal ;
 
-}
+    size_t i = 0, len = pattern.length() ;
+    Token spec ;
 
-static void formatMessage(std::ostream &strm, const string &pattern, LogLevel level, const string &message, int threadId, const string &fileName = string(), int currentLine = 0,
-                               const string &context = string())
-
-{
-    int state = LITERAL_STATE;
-    int i = 0;
-    int patternLength = pattern.length() ;
-    bool leftAlign ;
-    int minLength, maxLength ;
+    auto add_literal = [this](char c) {
+        if ( tokens_.empty() || tokens_.back().kind_ != Token::Text ) {
+            tokens_.emplace_back() ;
+            tokens_.back().kind_ = Token::Text ;
+        }
+        tokens_.back().text_ += c ;
+    } ;
 
-    while ( i < patternLength )
+    while ( i < len )
     {
-        char c = pattern[i++];
+        char c = pattern[i++] ;
 
-        switch (state)
+        switch ( state )
         {
-            case LITERAL_STATE:
-                leftAlign = false ;
-                minLength = 0 ;
-                maxLength = INT_MAX ;
-
-                // In literal state, the last char is always a literal.
-                if (i == patternLength) {
-                    strm.put(c) ;
-                    continue;
-                }
-
-                if ( c == '%' ) {
-                    // peek at the next char.
-                    if ( pattern[i] == '%' ) {
-                        strm.put(c) ;
-                        i++;
-                    } else {
-                        state = CONVERTER_STATE;
-                    }
-                } else {
-                    strm.put(c);
+        case Literal:
+            spec = Token() ;
+
+            // the last char is always a literal
+            if ( i == len ) add_literal(c) ;
+            else if ( c != '%' ) add_literal(c) ;
+            else if ( pattern[i] == '%' ) { add_literal(c) ; i++ ; }
+            else state = Converter ;
+            break ;
+
+        case Converter:
+            if ( c == '-' ) spec.left_align_ = true ;
+            else if ( c == '.' ) state = Dot ;
+            else if ( c >= '0' && c <= '9' ) { spec.min_length_ = c - '0' ; state = Min ; }
+            else { --i ; state = Command ; }
+            break ;
+
+        case Min:
+            if ( c >= '0' && c <= '9' ) spec.min_length_ = spec.min_length_ * 10 + c - '0' ;
+            else if ( c == '.' ) state = Dot ;
+            else { --i ; state = Command ; }
+            break ;
+
+        case Dot:
+            if ( c >= '0' && c <= '9' ) { spec.max_length_ = c - '0' ; state = Max ; }
+            else { add_literal(c) ; state = Literal ; } // error in pattern, was expecting digit
+            break ;
+
+        case Max:
+            if ( c >= '0' && c <= '9' ) spec.max_length_ = spec.max_length_ * 10 + c - '0' ;
+            else { --i ; state = Command ; }
+            break ;
+
+        case Command:
+            state = Literal ;
+
+            switch ( c )
+            {
+            case 'v': spec.kind_ = Token::Level ; break ;
+            case 'V': spec.kind_ = Token::LevelUpper ; break ;
+            case 'c': spec.kind_ = Token::Function ; break ;
+            case 'f': spec.kind_ = Token::FilePath ; break ;
+            case 'F': spec.kind_ = Token::FileName ; break ;
+            case 'l': spec.kind_ = Token::Line ; break ;
+            case 'r': spec.kind_ = Token::Clock ; break ;
+            case 't': spec.kind_ = Token::Thread ; break ;
+            case 'm': spec.kind_ = Token::Message ; break ;
+            case 'd':
+                spec.kind_ = Token::Date ;
+                spec.text_ = "%H:%M:%S" ;
+                if ( i < len && pattern[i] == '{' ) {
+                    size_t e = pattern.find('}', i) ;
+                    if ( e == string::npos ) e = len ;
+                    spec.text_ = pattern.substr(i + 1, e - i - 1) ;
+                    i = std::min(e + 1, len) ;
                 }
+                break ;
+            default:
+                add_literal(c) ; // invalid command specifier
+                continue ;
+            }
 
-                break;
-
-            case CONVERTER_STATE:
-                switch (c)
-                {
-                    case  '-':
-                        leftAlign = true ;
-                        break;
-                    case '.':
-                        state = DOT_STATE;
-                        break;
-                    default:
-                        if ((c >= '0') && (c <= '9'))
-                        {
-                            state = MIN_STATE ;
-                            minLength = c - '0' ;
-                        } else {
-                            --i ;
-                            state = COMMAND_STATE;
-                        }
-                }
-
-                break;
-
-            case MIN_STATE:
-                if ((c >= '0') && (c <= '9'))
-                {
-                    minLength = minLength * 10 + c - '0' ;
-                }
-                else if (c == '.')
-                {
-                    state = DOT_STATE;
-                } else {
-                    --i ;
-                    state = COMMAND_STATE;
-                }
+            tokens_.push_back(spec) ;
+            break ;
+        }
+    }
+}
 
-                break;
-
-            case DOT_STATE:
-                if ((c >= '0') && (c <= '9'))
-                {
-                    maxLength = c  - '0' ;
-                    state = MAX_STATE;
-                } else {
-                    //  Error in pattern, was expecting digit.";
-                    strm.put(c) ;
-                    state = LITERAL_STATE;
-                }
-                break;
+// append the value of a token honoring its alignment and length limits (longer values keep their end)
 
-            case MAX_STATE:
-                if ((c >= '0') && (c <= '9')) {
-                    maxLength = maxLength * 10 + c - '0' ;
-                }
-                else {
-                    --i ;
-                    state = COMMAND_STATE;
-                }
-                break;
-
-            case COMMAND_STATE:
-                switch (c)
-                {
-                case 'v': //log level
-                {
-                    string levelStr = levelToString(level) ;
-                    printFormatedString(strm, levelStr, leftAlign, minLength, maxLength) ;
-                    break ;
-                }
-                case 'V': //log level uppercase
-                {
-                    string levelStr = levelToString(level) ;
-                    printFormatedString(strm, boost::to_upper_copy(levelStr), leftAlign, minLength, maxLength) ;
-                    break ;
-                }
-                case 'c': //function name
-                    if ( !context.empty() )
-                            printFormatedString(strm, context, leftAlign, minLength, maxLength) ;
-                            break ;
-                case 'f': // %f: file path
-                    if ( !fileName.empty() )
-                        printFormatedString(strm, fileName, leftAlign, minLength, maxLength) ;
-                    break ;
-                case 'F': // %F: file name
-                    if ( !fileName.empty() )
-                    {
-                        string file_name_ = boost::filesystem::path(fileName).filename().string() ;
-                        printFormatedString(strm, file_name_, leftAlign, minLength, maxLength) ;
-                    }
-                    break ;
-
-                case 'l': // %l: line number
-                    {
-                        if ( currentLine )
-                        {
-                            std::ostringstream sb ;
-                            sb << currentLine ;
-                            printFormatedString(strm, sb.str().c_str(), leftAlign, minLength, maxLength) ;
-                        }
-                    }
-                    break ;
-                    case 'd': //%d{format}: Date with given format as given (default is %H:%M:%S)
-                        {
-                            struct tm *newtime ;
-                            time_t ltime ;
-                            time(&ltime) ;
-
-                            //newtime = gmtime( &ltime ); // C4996
-                            newtime = localtime(&ltime) ;
-
-                            char buf[80] ;
-                            int bufLen ;
-
-                            if ( pattern[i] == '{' )
-                            {
-                                char format[80], *p = format ;
-
-                                while ( pattern[++i] != '}' ) *p++ = pattern[i] ;
-                                *p = 0 ; ++i ;
-
-                                bufLen = strftime(buf, 80, format, newtime) ;
-
-                            }
-                            else
-                                bufLen = strftime(buf, 80, "%H:%M:%S", newtime) ;
-
-                            strm.write(buf, bufLen) ;
-
-
-                        }
-
-                        break ;
-
-                    case 'r': // time stamp
-                        {
-                            unsigned long cc = clock() * 1000.0 / CLOCKS_PER_SEC ;
-
-                            std::ostringstream sb ;
-                            sb << cc ;
-                            printFormatedString(strm, sb.str(), leftAlign, minLength, maxLength) ;
-                        }
-                        break ;
-                    case 't': // thread ID
-                        {
-                            unsigned long cc = threadId ;
-
-                            std::ostringstream sb ;
-                            sb << cc ;
-                            printFormatedString(strm, sb.str(), leftAlign, minLength, maxLength) ;
-                        }
-                        break ;
-                    case 'm': // message
-                        printFormatedString(strm, message, leftAlign, minLength, maxLength) ;
-                        break ;
-
-                    default:
-                        //  Error in pattern, invalid command specifier ;
-                        strm.put(c) ;
-                        state = LITERAL_STATE;
-                        continue ;
-
-                }
-                state = LITERAL_STATE ;
-                break ;
-        } // switch
+static void append_field(string &out, const char *data, size_t length, bool left_align, size_t min_length, size_t max_length)
+{
+    if ( length > max_length ) {
+        out.append(data + length - max_length, max_length) ;
     }
+    else if ( length < min_length ) {
+        if ( left_align ) {
+            out.append(data, length) ;
+            out.append(min_length - length, ' ') ;
+        }
+        else {
+            out.append(min_length - length, ' ') ;
+            out.append(data, length) ;
+        }
+    }
+    else out.append(data, length) ;
+}
 
-
+static void append_field(string &out, const string &s, bool left_align, size_t min_length, size_t max_length) {
+    append_field(out, s.data(), s.length(), left_align, min_length, max_length) ;
 }
 
 LogPatternFormatter::LogPatternFormatter(const string &pattern): LogFormatter(), pattern_(pattern) {
-
+    compile(pattern_) ;
 }
 
 string LogPatternFormatter::format(LogLevel level, const LogContext &ctx, const string &message)
 {
-    stringstream strm ;
+    string out ;
+    out.reserve(message.size() + 128) ;
 
-    formatMessage(strm, pattern_, level, message, (int)ctx.thread_id_, ctx.file_, ctx.line_, ctx.function_) ;
+    char buf[80] ;
+    struct tm now ;
+    bool have_now = false ;
 
-    return strm.str() ;
+    for( const Token &t: tokens_ )
+    {
+        switch ( t.kind_ )
+        {
+        case Token::Text:
+            out += t.text_ ;
+            break ;
+        case Token::Level:
+        case Token::LevelUpper:
+        {
+            const char *name = levelToString(level, t.kind_ == Token::LevelUpper) ;
+            append_field(out, name, strlen(name), t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        }
+        case Token::Function:
+            if ( !ctx.function_.empty() )
+                append_field(out, ctx.function_, t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        case Token::FilePath:
+            if ( !ctx.file_.empty() )
+                append_field(out, ctx.file_, t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        case Token::FileName:
+        {
+            size_t pos = ctx.file_.find_last_of('/') ;
+            const char *name = ( pos == string::npos ) ? ctx.file_.c_str() : ctx.file_.c_str() + pos + 1 ;
+            if ( !ctx.file_.empty() )
+                append_field(out, name, strlen(name), t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        }
+        case Token::Line:
+            if ( ctx.line_ ) {
+                int n = snprintf(buf, sizeof(buf), "%d", ctx.line_) ;
+                append_field(out, buf, n, t.left_align_, t.min_length_, t.max_length_) ;
+            }
+            break ;
+        case Token::Date:
+        {
+            if ( !have_now ) {
+                time_t ltime = ctx.time_ ? ctx.time_ : time(nullptr) ;
+                localtime_r(&ltime, &now) ;
+                have_now = true ;
+            }
+            size_t n = strftime(buf, sizeof(buf), t.text_.c_str(), &now) ;
+            out.append(buf, n) ;
+            break ;
+        }
+        case Token::Clock:
+        {
+            unsigned long cc = ( ctx.time_ ? ctx.clock_ : clock() ) * 1000.0 / CLOCKS_PER_SEC ;
+            int n = snprintf(buf, sizeof(buf), "%lu", cc) ;
+            append_field(out, buf, n, t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        }
+        case Token::Thread:
+        {
+            int n = snprintf(buf, sizeof(buf), "%lu", (unsigned long)(int)ctx.thread_id_) ;
+            append_field(out, buf, n, t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        }
+        case Token::Message:
+            append_field(out, message, t.left_align_, t.min_length_, t.max_length_) ;
+            break ;
+        }
+    }
+
+    return out ;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -308,6 +248,8 @@ string LogPatternFormatter::format(LogLevel level, const LogContext &ctx, const
 
 void Logger::write(LogLevel level, const LogContext &ctx, const char *format, ...)
 {
+    if ( !isEnabled(level) ) return ;
+
     va_list vl;
     va_start(vl, format);
     int nc = vsnprintf(0, 0, format, vl) ;
@@ -328,12 +270,31 @@ void Logger::addAppender(const std::shared_ptr<LogAppender> &appender)
 {
     lock_guard<mutex> lock(lock_) ;
     appenders_.push_back(appender) ;
+    update_min_level() ;
+}
+
+void Logger::setLevel(LogLevel level)
+{
+    lock_guard<mutex> lock(lock_) ;
+    level_ = level ;
+    update_min_level() ;
+}
+
+void Logger::update_min_level()
+{
+    int min_level = Fatal + 1 ;
+    for( const auto &appender: appenders_ )
+        min_level = std::min<int>(min_level, appender->threshold()) ;
+
+    min_level_ = std::max<int>(min_level, level_) ;
 }
 
 void Logger::write_impl(LogLevel level, const LogContext &ctx, const string &message)
 {
 //    boost::mutex::scoped_lock lock(lock_) ;
 
+    if ( !isEnabled(level) ) return ;
+
     for(int i=0 ; i<appenders_.size() ; i++)
         appenders_[i]->append(level, ctx, message) ;
 }
@@ -351,16 +312,18 @@ void LogStreamAppender::append(LogLevel level, const LogContext &ctx, const stri
         strm_ << formattedMessage(level, ctx, message) << endl ;
 }
 
+void LogStreamAppender::appendFormatted(const string &lines)
+{
+    strm_ << lines << flush ;
+}
+
 #define MAX_BACKUP_INDEX 20
 
 LogFileAppender::LogFileAppender(LogLevel level_threshold, const std::shared_ptr<LogFormatter> &formatter,
                                  const string &file_name, size_t max_file_size, int max_backup_index, bool append): LogAppender(level_threshold, formatter), file_name_(file_name),
     max_file_size_(max_file_size), max_backup_index_(max_backup_index), append_(append)
 {
-    unsigned int flags = O_CREAT | O_APPEND | O_WRONLY ;
-    if ( !append_ ) flags |= O_TRUNC;
-
-    fd_ = ::open(file_name.c_str(), flags, 00644);
+    open() ;
 
     // find the index of the last backup file
 
@@ -373,40 +336,157 @@ LogFileAppender::LogFileAppender(LogLevel level_threshold, const std::shared_ptr
 
     last_backup_file_index_ = last ;
 
+    find_rotated() ;
+
+    compressor_ = std::thread(&LogFileAppender::compress_rotated, this) ;
 }
 
 LogFileAppender::~LogFileAppender()
 {
+    {
+        lock_guard<mutex> lock(mutex_) ;
+        stop_ = true ;
+    }
+    wakeup_.notify_one() ;
+    compressor_.join() ;
+
     ::close(fd_) ;
 }
 
+void LogFileAppender::open()
+{
+    unsigned int flags = O_CREAT | O_APPEND | O_WRONLY ;
+    if ( !append_ ) flags |= O_TRUNC;
+
+    fd_ = ::open(file_name_.c_str(), flags, 00644);
+
+    // keep track of the size ourselves instead of asking for it after every write
+    off_t offset = ( fd_ < 0 ) ? 0 : ::lseek(fd_, 0, SEEK_END) ;
+    size_ = ( offset < 0 ) ? 0 : offset ;
+}
+
+// copy the file into a gzip file a chunk at a time
+
 static bool compress(const string &src_file, const string &out_file)
 {
-    std::ifstream t(src_file);
-    std::string str((std::istreambuf_iterator<char>(t)),
-                     std::istreambuf_iterator<char>());
+    std::ifstream in(src_file, ios::binary) ;
+    if ( !in ) return false ;
 
-    gzFile fi = gzopen(out_file.c_str(), "wb");
+    gzofstream out(out_file.c_str(), ios::out | ios::binary) ;
+    if ( !out.is_open() ) return false ;
 
-    gzwrite(fi, str.data(), str.size());
-    gzclose(fi);
+    char buf[64 * 1024] ;
+    while ( in.read(buf, sizeof(buf)) || in.gcount() > 0 ) {
+        if ( !out.write(buf, in.gcount()) ) return false ;
+    }
 
-	return true ;
+    out.close() ;
+    return !out.fail() ;
 }
 
 void LogFileAppender::append(LogLevel level, const LogContext &ctx, const string &message)
 {
     if ( !canAppend(level) ) return ;
 
-    string s = formattedMessage(level, ctx, message) + '\n';
-    ::write(fd_, s.data(), s.length()) ;
+    appendFormatted(formattedMessage(level, ctx, message) + '\n') ;
+}
+
+void LogFileAppender::appendFormatted(const string &lines)
+{
+    if ( lines.empty() ) return ;
+
+    ssize_t written = ::write(fd_, lines.data(), lines.length()) ;
+    if ( written > 0 ) size_ += written ;
+
+    if ( size_ >= max_file_size_ ) rotate() ;
+}
+
+void LogFileAppender::find_rotated()
+{
+    namespace fs = boost::filesystem ;
+
+    fs::path dir = fs::path(file_name_).parent_path() ;
+    if ( dir.empty() ) dir = "." ;
+    string prefix = fs::path(file_name_).filename().string() + ".rotated." ;
+
+    vector<pair<unsigned int, string>> found ;
+
+    boost::system::error_code ec ;
+    for( fs::directory_iterator it(dir, ec), end ; !ec && it != end ; it.increment(ec) )
+    {
+        string name = it->path().filename().string() ;
+        if ( !boost::starts_with(name, prefix) ) continue ;
+
+        string index = name.substr(prefix.length()) ;
+        if ( index.empty() || index.length() > 9 || index.find_first_not_of("0123456789") != string::npos ) continue ;
+
+        found.emplace_back(stoul(index), it->path().string()) ;
+    }
+
+    // oldest first, so that the most recent ends up in <file>.1.gz
+    std::sort(found.begin(), found.end()) ;
 
-    off_t offset = ::lseek(fd_, 0, SEEK_END);
-    if ( offset < 0 || static_cast<size_t>(offset) < max_file_size_ ) return ;
+    for( const auto &f: found ) {
+        rotated_.push_back(f.second) ;
+        rotations_ = std::max(rotations_, f.first) ;
+    }
+}
+
+void LogFileAppender::rotate()
+{
+    // only rename the full file here so that new messages go to a fresh file right away. An open file can be
+    // renamed, so on failure we keep writing to it.
+
+    string rotated = str(boost::format("%s.rotated.%d") % file_name_.c_str() % ++rotations_) ;
+    boost::system::error_code ec ;
+    boost::filesystem::rename(file_name_, rotated, ec) ;
 
-    // backup current file and open a new one
+    if ( ec ) {
+        // try again after another max_file_size bytes rather than on every message
+        size_ = 0 ;
+        return ;
+    }
 
     ::close(fd_);
+    open() ;
+
+    {
+        lock_guard<mutex> lock(mutex_) ;
+        rotated_.push_back(rotated) ;
+    }
+    wakeup_.notify_one() ;
+}
+
+void LogFileAppender::compress_rotated()
+{
+    for(;;) {
+        string rotated ;
+
+        {
+            unique_lock<mutex> lock(mutex_) ;
+            wakeup_.wait(lock, [this] { return stop_ || !rotated_.empty() ; }) ;
+            if ( rotated_.empty() ) return ; // stopped and nothing left to do
+            rotated = rotated_.front() ;
+            rotated_.pop_front() ;
+        }
+
+        backup(rotated) ;
+    }
+}
+
+void LogFileAppender::backup(const string &rotated)
+{
+    boost::system::error_code ec ;
+
+    // compress the rotated file first, so that nothing has been shifted or removed if this fails (e.g. on a full
+    // disk). The rotated file is then left in place and picked up again by find_rotated() on the next start.
+
+    string compressed = file_name_ + ".gz.tmp" ;
+
+    if ( !compress(rotated, compressed) ) {
+        boost::filesystem::remove(compressed, ec) ;
+        return ;
+    }
 
     // remove last file if too many backup files
 
@@ -414,7 +494,7 @@ void LogFileAppender::append(LogLevel level, const LogContext &ctx, const string
 
     if ( last_backup_file_index_ == max_backup_index_ )
     {
-        boost::filesystem::remove(last_log_file) ;
+        boost::filesystem::remove(last_log_file, ec) ;
         last_backup_file_index_ -- ;
     }
 
@@ -425,23 +505,197 @@ void LogFileAppender::append(LogLevel level, const LogContext &ctx, const string
     for( int i=last_backup_file_index_ ; i>=1; i-- )
     {
         string log_file = str(boost::format("%s.%d.gz") % file_name_.c_str() % i ) ;
-        boost::filesystem::rename(log_file, last_log_file) ;
+        boost::filesystem::rename(log_file, last_log_file, ec) ;
         last_log_file = log_file ;
     }
 
-    // backup and compress current file
+    // the compressed file becomes the first backup
 
-    compress(file_name_, file_name_ + ".1.gz") ;
-    boost::filesystem::remove(file_name_) ;
+    boost::filesystem::rename(compressed, file_name_ + ".1.gz", ec) ;
+    if ( !ec ) boost::filesystem::remove(rotated, ec) ;
 
     last_backup_file_index_ ++ ;
+}
 
-    // open new file
+/////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    unsigned int flags = O_CREAT | O_APPEND | O_WRONLY ;
-    if ( !append_ ) flags |= O_TRUNC;
+// Bounded multi-producer queue (after D. Vyukov). Each cell carries a sequence number telling whether it is free for
+// the producer at a given position or holds a message for the consumer, so pushing takes a single CAS and no lock.
+
+struct LogAsyncAppender::Queue {
+
+    struct Record {
+        LogLevel level_ ;
+        int line_ ;
+        time_t time_ ;
+        clock_t clock_ ;
+        string file_, function_, message_ ;
+    } ;
+
+    struct Cell {
+        std::atomic<size_t> seq_ ;
+        Record record_ ;
+    } ;
+
+    explicit Queue(size_t capacity) {
+        size_t size = 2 ;
+        while ( size < capacity ) size *= 2 ;
+        mask_ = size - 1 ;
+        cells_.reset(new Cell[size]) ;
+        for( size_t i=0 ; i<size ; i++ ) cells_[i].seq_.store(i, memory_order_relaxed) ;
+        enqueue_pos_ = dequeue_pos_ = 0 ;
+    }
 
-    fd_ = ::open(file_name_.c_str(), flags, 00644);
+    size_t capacity() const { return mask_ + 1 ; }
+
+    // approximate number of queued messages
+    size_t size() const {
+        return enqueue_pos_.load(memory_order_relaxed) - dequeue_pos_.load(memory_order_relaxed) ;
+    }
+
+    bool push(LogLevel level, const LogContext &ctx, const string &message) {
+        Cell *cell ;
+        size_t pos = enqueue_pos_.load(memory_order_relaxed) ;
+
+        for(;;) {
+            cell = &cells_[pos & mask_] ;
+            size_t seq = cell->seq_.load(memory_order_acquire) ;
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos ;
+            if ( diff == 0 ) {
+                if ( enqueue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed) ) break ;
+            }
+            else if ( diff < 0 ) return false ; // full
+            else pos = enqueue_pos_.load(memory_order_relaxed) ;
+        }
+
+        // assigning reuses the capacity of the strings left in the cell by earlier messages
+        Record &r = cell->record_ ;
+        r.level_ = level ;
+        r.line_ = ctx.line_ ;
+        r.time_ = ctx.time_ ? ctx.time_ : time(nullptr) ;
+        r.clock_ = ctx.time_ ? ctx.clock_ : clock() ;
+        r.file_ = ctx.file_ ;
+        r.function_ = ctx.function_ ;
+        r.message_ = message ;
+
+        cell->seq_.store(pos + 1, memory_order_release) ;
+        return true ;
+    }
+
+    // only called by the writer thread. The record stays valid until release().
+    Record *front() {
+        Cell &cell = cells_[dequeue_pos_.load(memory_order_relaxed) & mask_] ;
+        if ( cell.seq_.load(memory_order_acquire) != dequeue_pos_.load(memory_order_relaxed) + 1 ) return nullptr ;
+        return &cell.record_ ;
+    }
+
+    void release() {
+        size_t pos = dequeue_pos_.load(memory_order_relaxed) ;
+        cells_[pos & mask_].seq_.store(pos + mask_ + 1, memory_order_release) ;
+        dequeue_pos_.store(pos + 1, memory_order_relaxed) ;
+    }
+
+    std::unique_ptr<Cell[]> cells_ ;
+    size_t mask_ ;
+    std::atomic<size_t> enqueue_pos_ ;
+    char pad_[64] ; // keep producers and the consumer on separate cache lines
+    std::atomic<size_t> dequeue_pos_ ;
+};
+
+LogAsyncAppender::LogAsyncAppender(const std::shared_ptr<LogAppender> &appender, size_t capacity,
+                                   OverflowPolicy policy, size_t sample_rate):
+    LogAppender(appender->threshold(), std::make_shared<LogSimpleFormatter>()), appender_(appender), queue_(new Queue(capacity)),
+    batched_(appender->supportsFormatted()), policy_(policy), sample_rate_(std::max<size_t>(sample_rate, 1)), dropped_(0), sampled_(0), sleeping_(false), stop_(false)
+{
+    assert(appender_) ;
+    writer_ = std::thread(&LogAsyncAppender::run, this) ;
+}
+
+LogAsyncAppender::~LogAsyncAppender()
+{
+    {
+        lock_guard<mutex> lock(mutex_) ;
+        stop_ = true ;
+    }
+    wakeup_.notify_one() ;
+    writer_.join() ;
+}
+
+void LogAsyncAppender::append(LogLevel level, const LogContext &ctx, const string &message)
+{
+    if ( !canAppend(level) ) return ;
+
+    if ( policy_ == Sample && queue_->size() >= queue_->capacity() / 2 &&
+         sampled_.fetch_add(1, memory_order_relaxed) % sample_rate_ != 0 ) {
+        ++dropped_ ;
+        return ;
+    }
+
+    while ( !queue_->push(level, ctx, message) ) {
+        if ( policy_ != Block ) {
+            ++dropped_ ;
+            return ;
+        }
+        std::this_thread::yield() ;
+    }
+
+    // the writer sets sleeping_ before its last look at the queue. With a full fence on both sides, between the
+    // push and reading the flag here and between setting the flag and reading the queue there, either it sees this
+    // message or we see the flag.
+    std::atomic_thread_fence(memory_order_seq_cst) ;
+    if ( sleeping_ ) {
+        lock_guard<mutex> lock(mutex_) ;
+        wakeup_.notify_one() ;
+    }
+}
+
+/// Formatted messages are handed to the appender in blocks of about this size.
+static const size_t log_batch_size = 64 * 1024 ;
+
+void LogAsyncAppender::run()
+{
+    string batch ;
+
+    for(;;) {
+
+        // write out everything queued so far
+        while ( Queue::Record *r = queue_->front() ) {
+            LogContext ctx(r->file_.c_str(), r->line_, r->function_.c_str()) ;
+            ctx.time_ = r->time_ ;
+            ctx.clock_ = r->clock_ ;
+
+            if ( batched_ ) {
+                if ( appender_->canAppend(r->level_) ) {
+                    batch += appender_->formattedMessage(r->level_, ctx, r->message_) ;
+                    batch += '\n' ;
+                }
+            }
+            else
+                appender_->append(r->level_, ctx, r->message_) ;
+
+            queue_->release() ;
+
+            if ( batch.size() >= log_batch_size ) {
+                appender_->appendFormatted(batch) ;
+                batch.clear() ;
+            }
+        }
+
+        if ( !batch.empty() ) {
+            appender_->appendFormatted(batch) ;
+            batch.clear() ;
+        }
+
+        unique_lock<mutex> lock(mutex_) ;
+        sleeping_ = true ;
+        std::atomic_thread_fence(memory_order_seq_cst) ;
+        if ( !queue_->front() ) {
+            if ( stop_ ) break ;
+            // the timeout only guards against a lost wakeup
+            wakeup_.wait_for(lock, std::chrono::milliseconds(100)) ;
+        }
+        sleeping_ = false ;
+    }
 }
 
 } // namespace util
@@ -0,0 +1,304 @@
+#include <wspp/util/metrics.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace std ;
+
+namespace wspp { namespace util {
+
+namespace detail {
+
+size_t metric_shard() {
+    static std::atomic<size_t> next(0) ;
+    static thread_local size_t shard = next++ % metric_shards ;
+    return shard ;
+}
+
+}
+
+Counter::Counter() {
+    for( Shard &s: shards_ ) s.value_.store(0, memory_order_relaxed) ;
+}
+
+uint64_t Counter::value() const {
+    uint64_t v = 0 ;
+    for( const Shard &s: shards_ ) v += s.value_.load(memory_order_relaxed) ;
+    return v ;
+}
+
+Histogram::Histogram(): shards_(new Shard[detail::metric_shards]) {
+    for( size_t i=0 ; i<detail::metric_shards ; i++ ) {
+        for( auto &b: shards_[i].buckets_ ) b.store(0, memory_order_relaxed) ;
+        shards_[i].sum_.store(0, memory_order_relaxed) ;
+    }
+}
+
+unsigned Histogram::bucket(uint64_t micros) {
+    if ( micros < sub_buckets ) return micros ;
+
+    // the top 3 bits below the most significant one select the sub-bucket
+    unsigned msb = 63 - __builtin_clzll(micros) ;
+    unsigned b = (msb - 2) * sub_buckets + (micros >> (msb - 3)) - sub_buckets ;
+    return std::min(b, num_buckets - 1) ;
+}
+
+uint64_t Histogram::upper_bound(unsigned bucket) {
+    if ( bucket < sub_buckets ) return bucket + 1 ;
+    unsigned e = bucket / sub_buckets, sub = bucket % sub_buckets ;
+    return uint64_t(sub + sub_buckets + 1) << (e - 1) ;
+}
+
+vector<uint64_t> Histogram::buckets() const {
+    vector<uint64_t> counts(num_buckets, 0) ;
+    for( size_t i=0 ; i<detail::metric_shards ; i++ )
+        for( unsigned b=0 ; b<num_buckets ; b++ )
+            counts[b] += shards_[i].buckets_[b].load(memory_order_relaxed) ;
+    return counts ;
+}
+
+uint64_t Histogram::count() const {
+    uint64_t n = 0 ;
+    for( uint64_t c: buckets() ) n += c ;
+    return n ;
+}
+
+uint64_t Histogram::sum() const {
+    uint64_t v = 0 ;
+    for( size_t i=0 ; i<detail::metric_shards ; i++ ) v += shards_[i].sum_.load(memory_order_relaxed) ;
+    return v ;
+}
+
+uint64_t Histogram::quantile(double q) const {
+    vector<uint64_t> counts = buckets() ;
+
+    uint64_t total = 0 ;
+    for( uint64_t c: counts ) total += c ;
+    if ( total == 0 ) return 0 ;
+
+    uint64_t rank = std::max<uint64_t>(1, q * total + 0.5), seen = 0 ;
+    for( unsigned b=0 ; b<num_buckets ; b++ ) {
+        seen += counts[b] ;
+        if ( seen >= rank ) {
+            // middle of the bucket
+            uint64_t lower = ( b == 0 ) ? 0 : upper_bound(b - 1) ;
+            return ( lower + upper_bound(b) - 1 ) / 2 ;
+        }
+    }
+
+    return upper_bound(num_buckets - 1) ;
+}
+
+template <class M>
+M &MetricFamily<M>::with(std::initializer_list<boost::string_ref> values)
+{
+    // per thread cache keyed by the family and the label values, reusing the key buffer
+    static thread_local string key ;
+    static thread_local unordered_map<string, M *> cache ;
+
+    const MetricFamily *self = this ;
+    key.assign(reinterpret_cast<const char *>(&self), sizeof(self)) ;
+    for( const boost::string_ref &v: values ) {
+        key.append(v.data(), v.size()) ;
+        key += '\0' ;
+    }
+
+    auto it = cache.find(key) ;
+    if ( it != cache.end() ) return *it->second ;
+
+    vector<string> label_values ;
+    for( const boost::string_ref &v: values ) label_values.push_back(v.to_string()) ;
+
+    lock_guard<mutex> lock(mutex_) ;
+
+    std::unique_ptr<M> &m = metrics_[label_values] ;
+    if ( !m ) m.reset(new M) ;
+
+    cache.emplace(key, m.get()) ;
+    return *m ;
+}
+
+template class MetricFamily<Counter> ;
+template class MetricFamily<Gauge> ;
+template class MetricFamily<Histogram> ;
+
+MetricsRegistry &MetricsRegistry::instance() {
+    // never destroyed, so that metrics can still be updated by threads running while the process exits
+    static MetricsRegistry *registry = new MetricsRegistry ;
+    return *registry ;
+}
+
+template <class M>
+MetricFamily<M> &MetricsRegistry::family(map<string, unique_ptr<MetricFamily<M>>> &families, const string &name,
+                                         const string &help, const vector<string> &labels)
+{
+    lock_guard<mutex> lock(mutex_) ;
+
+    unique_ptr<MetricFamily<M>> &f = families[name] ;
+    if ( !f ) f.reset(new MetricFamily<M>(name, help, labels)) ;
+    return *f ;
+}
+
+MetricFamily<Counter> &MetricsRegistry::counters(const string &name, const string &help, const vector<string> &labels) {
+    return family(counters_, name, help, labels) ;
+}
+
+MetricFamily<Gauge> &MetricsRegistry::gauges(const string &name, const string &help, const vector<string> &labels) {
+    return family(gauges_, name, help, labels) ;
+}
+
+MetricFamily<Histogram> &MetricsRegistry::histograms(const string &name, const string &help, const vector<string> &labels) {
+    return family(histograms_, name, help, labels) ;
+}
+
+void MetricsRegistry::addCollector(const void *owner, const string &name, const string &help, const Collector &c,
+                                   const string &type) {
+    lock_guard<mutex> lock(mutex_) ;
+    collectors_.push_back(CollectorEntry{owner, name, help, type, c}) ;
+}
+
+void MetricsRegistry::removeCollectors(const void *owner) {
+    lock_guard<mutex> lock(mutex_) ;
+    collectors_.erase(std::remove_if(collectors_.begin(), collectors_.end(),
+                                     [owner](const CollectorEntry &e) { return e.owner_ == owner ; }), collectors_.end()) ;
+}
+
+// Prometheus text format
+
+static void write_header(string &out, const string &name, const string &help, const char *type) {
+    out += "# HELP " ; out += name ; out += ' ' ;
+    for( char c: help ) {
+        if ( c == '\\' ) out += "\\\\" ;
+        else if ( c == '\n' ) out += "\\n" ;
+        else out += c ;
+    }
+    out += "\n# TYPE " ; out += name ; out += ' ' ; out += type ; out += '\n' ;
+}
+
+// {name="value",...} with an optional extra label, nothing if there are no labels
+static void write_labels(string &out, const vector<string> &names, const vector<string> &values,
+                         const char *extra_name = nullptr, const char *extra_value = nullptr) {
+    if ( names.empty() && !extra_name ) return ;
+
+    out += '{' ;
+    for( size_t i=0 ; i<names.size() && i<values.size() ; i++ ) {
+        if ( i ) out += ',' ;
+        out += names[i] ; out += "=\"" ;
+        for( char c: values[i] ) {
+            if ( c == '\\' ) out += "\\\\" ;
+            else if ( c == '"' ) out += "\\\"" ;
+            else if ( c == '\n' ) out += "\\n" ;
+            else out += c ;
+        }
+        out += '"' ;
+    }
+    if ( extra_name ) {
+        if ( !names.empty() ) out += ',' ;
+        out += extra_name ; out += "=\"" ; out += extra_value ; out += '"' ;
+    }
+    out += '}' ;
+}
+
+static void write_value(string &out, double v) {
+    char buf[32] ;
+    snprintf(buf, sizeof(buf), " %.9g\n", v) ;
+    out += buf ;
+}
+
+static void write_value(string &out, uint64_t v) {
+    char buf[32] ;
+    snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)v) ;
+    out += buf ;
+}
+
+// bucket bounds of exported histograms, in seconds
+static const double histogram_bounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 } ;
+
+string MetricsRegistry::prometheusText() const
+{
+    string out ;
+
+    lock_guard<mutex> lock(mutex_) ;
+
+    for( const auto &fp: counters_ ) {
+        const MetricFamily<Counter> &f = *fp.second ;
+        write_header(out, f.name_, f.help_, "counter") ;
+        lock_guard<mutex> flock(f.mutex_) ;
+        for( const auto &m: f.metrics_ ) {
+            out += f.name_ ;
+            write_labels(out, f.labels_, m.first) ;
+            write_value(out, m.second->value()) ;
+        }
+    }
+
+    for( const auto &fp: gauges_ ) {
+        const MetricFamily<Gauge> &f = *fp.second ;
+        write_header(out, f.name_, f.help_, "gauge") ;
+        lock_guard<mutex> flock(f.mutex_) ;
+        for( const auto &m: f.metrics_ ) {
+            out += f.name_ ;
+            write_labels(out, f.labels_, m.first) ;
+            write_value(out, (double)m.second->value()) ;
+        }
+    }
+
+    for( const auto &fp: histograms_ ) {
+        const MetricFamily<Histogram> &f = *fp.second ;
+        write_header(out, f.name_, f.help_, "histogram") ;
+        lock_guard<mutex> flock(f.mutex_) ;
+        for( const auto &m: f.metrics_ ) {
+            vector<uint64_t> counts = m.second->buckets() ;
+
+            // a bucket counts towards the first bound all its values are within
+            uint64_t cumulative = 0 ;
+            unsigned b = 0 ;
+            for( double bound: histogram_bounds ) {
+                uint64_t bound_us = bound * 1e6 ;
+                for( ; b < Histogram::num_buckets && Histogram::upper_bound(b) - 1 <= bound_us ; b++ )
+                    cumulative += counts[b] ;
+
+                char le[16] ;
+                snprintf(le, sizeof(le), "%g", bound) ;
+                out += f.name_ ; out += "_bucket" ;
+                write_labels(out, f.labels_, m.first, "le", le) ;
+                write_value(out, cumulative) ;
+            }
+            for( ; b < Histogram::num_buckets ; b++ ) cumulative += counts[b] ;
+
+            out += f.name_ ; out += "_bucket" ;
+            write_labels(out, f.labels_, m.first, "le", "+Inf") ;
+            write_value(out, cumulative) ;
+
+            out += f.name_ ; out += "_sum" ;
+            write_labels(out, f.labels_, m.first) ;
+            write_value(out, m.second->sum() / 1e6) ;
+
+            out += f.name_ ; out += "_count" ;
+            write_labels(out, f.labels_, m.first) ;
+            write_value(out, cumulative) ;
+        }
+    }
+
+    for( const CollectorEntry &c: collectors_ ) {
+        vector<pair<MetricLabels, double>> samples ;
+        c.collector_(samples) ;
+
+        write_header(out, c.name_, c.help_, c.type_.c_str()) ;
+        for( const auto &s: samples ) {
+            vector<string> names, values ;
+            for( const auto &l: s.first ) {
+                names.push_back(l.first) ;
+                values.push_back(l.second) ;
+            }
+            out += c.name_ ;
+            write_labels(out, names, values) ;
+            write_value(out, s.second) ;
+        }
+    }
+
+    return out ;
+}
+
+} // namespace util
+} // namespace wspp
@@ -0,0 +1,138 @@
+#include <wspp/util/trace.hpp>
+
+#include <cctype>
+#include <cstdio>
+
+using namespace std ;
+
+namespace wspp { namespace util {
+
+static thread_local TraceContext *current_trace = nullptr ;
+
+TraceContext *TraceContext::current() {
+    return current_trace ;
+}
+
+TraceContext::Scope::Scope(TraceContext *trace): previous_(current_trace) {
+    current_trace = trace ;
+}
+
+TraceContext::Scope::~Scope() {
+    current_trace = previous_ ;
+}
+
+void TraceContext::start(clock::time_point t) {
+    start_ = t ;
+    clear() ;
+}
+
+int64_t TraceContext::elapsed(clock::time_point t) const {
+    return chrono::duration_cast<chrono::microseconds>(t - start_).count() ;
+}
+
+TraceContext::Span &TraceContext::next_span(const char *name) {
+    if ( size_ == spans_.size() ) spans_.emplace_back() ;
+    Span &s = spans_[size_++] ;
+    s.name_.assign(name) ; // reuses the capacity left by an earlier request
+    s.depth_ = depth_ ;
+    return s ;
+}
+
+size_t TraceContext::open(const char *name) {
+    Span &s = next_span(name) ;
+    s.start_ = elapsed() ;
+    s.duration_ = -1 ;
+    ++depth_ ;
+    return size_ - 1 ;
+}
+
+void TraceContext::close(size_t index) {
+    // the trace may have been restarted while the span was open
+    if ( index >= size_ || spans_[index].duration_ >= 0 ) return ;
+
+    Span &s = spans_[index] ;
+    s.duration_ = elapsed() - s.start_ ;
+    if ( depth_ ) --depth_ ;
+}
+
+void TraceContext::add(const char *name, clock::time_point start, clock::time_point end) {
+    Span &s = next_span(name) ;
+    s.start_ = elapsed(start) ;
+    s.duration_ = chrono::duration_cast<chrono::microseconds>(end - start).count() ;
+}
+
+static void append_millis(string &out, int64_t micros) {
+    char buf[32] ;
+    int n = snprintf(buf, sizeof(buf), "%.2f", micros / 1000.0) ;
+    out.append(buf, n) ;
+}
+
+string TraceContext::serverTiming() const {
+    string res ;
+
+    for( size_t i=0 ; i<size_ ; i++ ) {
+        const Span &s = spans_[i] ;
+        if ( s.duration_ < 0 ) continue ;
+
+        // metrics are listed once, in the order they first appear
+        bool seen = false ;
+        for( size_t j=0 ; j<i && !seen ; j++ )
+            seen = spans_[j].duration_ >= 0 && spans_[j].name_ == s.name_ ;
+        if ( seen ) continue ;
+
+        int64_t total = 0 ;
+        size_t count = 0 ;
+        for( size_t j=i ; j<size_ ; j++ ) {
+            if ( spans_[j].duration_ >= 0 && spans_[j].name_ == s.name_ ) {
+                total += spans_[j].duration_ ;
+                ++count ;
+            }
+        }
+
+        if ( !res.empty() ) res += ", " ;
+
+        // metric names are header tokens
+        for( char c: s.name_ )
+            res += ( isalnum((unsigned char)c) || c == '-' || c == '.' || c == '_' ) ? c : '_' ;
+
+        if ( count > 1 ) {
+            res += ";desc=\"" ;
+            res += to_string(count) ;
+            res += "x\"" ;
+        }
+        res += ";dur=" ;
+        append_millis(res, total) ;
+    }
+
+    return res ;
+}
+
+string TraceContext::summary() const {
+    string res ;
+    unsigned depth = 0 ;
+
+    for( size_t i=0 ; i<size_ ; i++ ) {
+        const Span &s = spans_[i] ;
+
+        for( ; depth > s.depth_ ; --depth ) res += " }" ;
+
+        if ( s.depth_ > depth ) {
+            res += " {" ;
+            depth = s.depth_ ;
+        }
+        else if ( i > 0 ) res += ',' ;
+
+        if ( i > 0 ) res += ' ' ;
+        res += s.name_ ;
+        res += ' ' ;
+        if ( s.duration_ < 0 ) res += '?' ;
+        else append_millis(res, s.duration_) ;
+    }
+
+    for( ; depth > 0 ; --depth ) res += " }" ;
+
+    return res ;
+}
+
+} // namespace util
+} // namespace wspp
@@ -296,7 +296,9 @@ bool XMLSAXParser::fatal(ErrorCode code) {
     return false ;
 }
 
-XMLSAXParser::XMLSAXParser(const string &src): src_(src), cursor_(src) {}
+XMLSAXParser::XMLSAXParser(const string &src): cursor_(src.data(), src.size()) {}
+
+XMLSAXParser::XMLSAXParser(const char *src, size_t size): cursor_(src, size) {}
 
 void XMLSAXParser::skipSpace() {
     while ( cursor_ ) {
@@ -0,0 +1,34 @@
+#ifndef __WSPP_TEST_CHECK_HPP__
+#define __WSPP_TEST_CHECK_HPP__
+
+#include <iostream>
+#include <string>
+
+// Minimal checks shared by the unit tests: failed checks are reported and counted, and check_result() gives the
+// exit status of the test.
+
+namespace wspp { namespace test {
+
+inline int &failures() {
+    static int count = 0 ;
+    return count ;
+}
+
+inline void check(bool cond, const std::string &what) {
+    if ( !cond ) {
+        std::cerr << "FAILED: " << what << std::endl ;
+        ++failures() ;
+    }
+}
+
+inline int check_result() {
+    if ( failures() ) std::cerr << failures() << " checks failed" << std::endl ;
+    else std::cout << "all checks passed" << std::endl ;
+
+    return failures() ? 1 : 0 ;
+}
+
+} // namespace test
+} // namespace wspp
+
+#endif
@@ -0,0 +1,127 @@
+#include <wspp/server/filter_chain.hpp>
+#include <wspp/server/request_handler.hpp>
+#include <wspp/server/filters/gzip_filter.hpp>
+
+#include "check.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std ;
+using namespace wspp::server ;
+using namespace wspp::test ;
+
+// Writes a compressible page
+
+struct Page: public RequestHandler {
+    void handle(const Request &req, Response &resp) override {
+        ++calls_ ;
+        resp.write(string(1000, 'x'), "text/html") ;
+    }
+
+    atomic<int> calls_{0} ;
+};
+
+// Records the order in which requests pass it, and after completion the status and body size of the response
+
+struct Recorder: public Filter {
+    void handle(Request &req, Response &resp, FilterContext &chain) override {
+        passed_.push_back(req.path_) ;
+        chain.next(req, resp) ;
+        chain.onComplete([this, &resp]() {
+            status_ = resp.status_ ;
+            size_ = resp.body().size() ;
+            encoding_ = resp.headers_.get("Content-Encoding") ;
+        }) ;
+    }
+
+    vector<string> passed_ ;
+    Response::Status status_ = Response::not_found ;
+    size_t size_ = 0 ;
+    string encoding_ ;
+};
+
+// Defers requests for /deferred: the rest of the chain runs on another thread once release() is called
+
+struct Deferring: public Filter {
+    void handle(Request &req, Response &resp, FilterContext &chain) override {
+        if ( req.path_ != "/deferred" ) {
+            chain.next(req, resp) ;
+            return ;
+        }
+
+        function<void()> done = chain.defer() ;
+        resp.status_ = Response::not_found ; // not finished yet
+
+        // the context is only valid during handle(), so continue with the end point directly
+        work_ = [&req, &resp, done, this]() {
+            end_point_->handle(req, resp) ;
+            done() ;
+        } ;
+    }
+
+    void release() {
+        thread t(work_) ;
+        t.join() ;
+    }
+
+    RequestHandler *end_point_ = nullptr ;
+    function<void()> work_ ;
+};
+
+static void test_deferred_completion() {
+    Page page ;
+
+    // outermost first
+    Recorder *recorder = new Recorder ;
+    GZipFilter *gzip = new GZipFilter ;
+    Deferring *deferring = new Deferring ;
+    deferring->end_point_ = &page ;
+
+    FilterChain chain ;
+    chain.add(recorder) ;
+    chain.add(gzip) ;
+    chain.add(deferring) ;
+    chain.setEndPoint(&page) ;
+
+    Request deferred_req, plain_req ;
+    deferred_req.path_ = "/deferred" ;
+    deferred_req.method_ = plain_req.method_ = "GET" ;
+    deferred_req.SERVER_["Accept-Encoding"] = plain_req.SERVER_["Accept-Encoding"] = "gzip" ;
+    plain_req.path_ = "/plain" ;
+
+    Response deferred_resp, plain_resp ;
+    atomic<int> deferred_done(0), plain_done(0) ;
+
+    chain.handle(deferred_req, deferred_resp, [&]() { ++deferred_done ; }) ;
+
+    check(deferred_done == 0, "deferred: not complete after the synchronous pass") ;
+    check(recorder->status_ == Response::not_found && recorder->size_ == 0, "deferred: outer hook waits") ;
+
+    // the chain is shared, so a second request passes it while the first one is still pending
+    chain.handle(plain_req, plain_resp, [&]() { ++plain_done ; }) ;
+
+    check(plain_done == 1, "cursor: second request complete") ;
+    check(page.calls_ == 1, "cursor: second request reached the end point") ;
+    check(recorder->passed_.size() == 2 && recorder->passed_[1] == "/plain", "cursor: second request passed the filters") ;
+    check(recorder->status_ == Response::ok && recorder->encoding_ == "gzip", "cursor: second request post-processed") ;
+
+    deferring->release() ;
+
+    check(deferred_done == 1, "deferred: complete once released") ;
+    check(page.calls_ == 2, "deferred: reached the end point") ;
+    check(deferred_resp.headers_.get("Content-Encoding") == "gzip", "deferred: compressed by the outer filter") ;
+    check(recorder->status_ == Response::ok && recorder->encoding_ == "gzip" && recorder->size_ < 1000,
+          "deferred: hooks run innermost first") ;
+}
+
+int main(int argc, char *argv[]) {
+
+    test_deferred_completion() ;
+
+    return check_result() ;
+}
@@ -0,0 +1,131 @@
+#include <wspp/util/metrics.hpp>
+
+#include "check.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+using namespace std ;
+using namespace wspp::util ;
+using namespace wspp::test ;
+
+static bool contains_line(const string &text, const string &line) {
+    return text.find("\n" + line + "\n") != string::npos || text.compare(0, line.size() + 1, line + "\n") == 0 ;
+}
+
+// values of bucket b are in [upper_bound(b-1), upper_bound(b))
+
+static void test_buckets() {
+    for( uint64_t v = 0 ; v < Histogram::sub_buckets ; v++ )
+        check(Histogram::bucket(v) == v && Histogram::upper_bound(v) == v + 1, "exact bucket of " + to_string(v)) ;
+
+    for( unsigned b = 1 ; b < Histogram::num_buckets ; b++ )
+        check(Histogram::upper_bound(b) > Histogram::upper_bound(b - 1), "bounds increase at " + to_string(b)) ;
+
+    vector<uint64_t> values ;
+    for( uint64_t v = 0 ; v < 100000 ; v++ ) values.push_back(v) ;
+    for( unsigned e = 17 ; e < 34 ; e++ )
+        for( int64_t d: { -1, 0, 1 } ) values.push_back((uint64_t(1) << e) + d) ;
+
+    for( uint64_t v: values ) {
+        unsigned b = Histogram::bucket(v) ;
+        uint64_t lower = ( b == 0 ) ? 0 : Histogram::upper_bound(b - 1) ;
+
+        if ( v < lower || v >= Histogram::upper_bound(b) ) {
+            check(false, "bucket of " + to_string(v)) ;
+            break ;
+        }
+
+        // each power of two is split in sub_buckets, so a bucket is at most 1/8 of its lower bound wide
+        if ( b >= Histogram::sub_buckets && ( Histogram::upper_bound(b) - lower ) * Histogram::sub_buckets > lower ) {
+            check(false, "width of the bucket of " + to_string(v)) ;
+            break ;
+        }
+    }
+
+    // four hours and more end up in the last bucket
+    check(Histogram::bucket(uint64_t(1) << 40) == Histogram::num_buckets - 1, "large values clamped") ;
+    check(Histogram::bucket(UINT64_MAX) == Histogram::num_buckets - 1, "largest value clamped") ;
+    check(Histogram::upper_bound(Histogram::num_buckets - 1) > 4ull * 3600 * 1000000, "range over four hours") ;
+}
+
+static void test_observe() {
+    Histogram h ;
+
+    // from several threads, which update different shards
+    vector<thread> threads ;
+    for( int t = 0 ; t < 4 ; t++ )
+        threads.emplace_back([&h] { for( uint64_t v = 1 ; v <= 1000 ; v++ ) h.observe(v) ; }) ;
+    for( thread &t: threads ) t.join() ;
+
+    check(h.count() == 4000, "count") ;
+    check(h.sum() == 4 * 500500, "sum") ;
+
+    uint64_t median = h.quantile(0.5), p99 = h.quantile(0.99) ;
+    check(median >= 500 * 7 / 8 && median <= 500 * 9 / 8, "median " + to_string(median)) ;
+    check(p99 >= 990 * 7 / 8 && p99 <= 990 * 9 / 8, "p99 " + to_string(p99)) ;
+    check(Histogram().quantile(0.5) == 0, "quantile of an empty histogram") ;
+}
+
+static void test_prometheus() {
+    MetricsRegistry &registry = MetricsRegistry::instance() ;
+
+    registry.counters("test_requests_total", "Requests.", { "method", "path" }).with({ "GET", "/a\"b\\c" }).inc(3) ;
+    registry.gauge("test_connections", "Open connections.").set(-2) ;
+
+    Histogram &h = registry.histograms("test_latency_seconds", "Latency.\nIn seconds.", { "route" }).with({ "/x" }) ;
+    h.observe(100) ;      // 0.1ms
+    h.observe(2000) ;     // 2ms
+    h.observe(3000000) ;  // 3s
+
+    registry.addCollector(&registry, "test_queue_depth", "Queued.", [](vector<pair<MetricLabels, double>> &samples) {
+        samples.push_back({ { { "pool", "workers" } }, 5 }) ;
+    }) ;
+
+    string text = registry.prometheusText() ;
+    registry.removeCollectors(&registry) ;
+
+    for( const char *line: {
+         "# HELP test_requests_total Requests.",
+         "# TYPE test_requests_total counter",
+         "test_requests_total{method=\"GET\",path=\"/a\\\"b\\\\c\"} 3",
+         "# TYPE test_connections gauge",
+         "test_connections -2",
+         "# HELP test_latency_seconds Latency.\\nIn seconds.",
+         "# TYPE test_latency_seconds histogram",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"0.0005\"} 1",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"0.001\"} 1",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"0.0025\"} 2",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"2.5\"} 2",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"5\"} 3",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"10\"} 3",
+         "test_latency_seconds_bucket{route=\"/x\",le=\"+Inf\"} 3",
+         "test_latency_seconds_sum{route=\"/x\"} 3.0021",
+         "test_latency_seconds_count{route=\"/x\"} 3",
+         "# TYPE test_queue_depth gauge",
+         "test_queue_depth{pool=\"workers\"} 5" } )
+        check(contains_line(text, line), string("prometheus: ") + line) ;
+
+    // cumulative bucket counts never decrease
+    uint64_t previous = 0 ;
+    bool increasing = true ;
+    for( size_t pos = text.find("test_latency_seconds_bucket") ; pos != string::npos ;
+         pos = text.find("test_latency_seconds_bucket", pos + 1) ) {
+        uint64_t n = stoull(text.substr(text.find(' ', pos) + 1)) ;
+        increasing = increasing && n >= previous ;
+        previous = n ;
+    }
+    check(increasing, "prometheus: cumulative buckets") ;
+
+    check(registry.prometheusText().find("test_queue_depth") == string::npos, "prometheus: collector removed") ;
+}
+
+int main(int argc, char *argv[]) {
+
+    test_buckets() ;
+    test_observe() ;
+    test_prometheus() ;
+
+    return check_result() ;
+}
@@ -0,0 +1,175 @@
+#include <wspp/server/detail/multipart_parser.hpp>
+#include <wspp/server/request.hpp>
+
+#include "check.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std ;
+using namespace wspp::server ;
+using namespace wspp::server::detail ;
+using namespace wspp::test ;
+
+namespace fs = boost::filesystem ;
+
+// temporary files of the tests are created here
+static string upload_dir ;
+
+static const string boundary = "----wsppBoundary7MA4YWxk" ;
+
+static string make_body(const string &file_data) {
+    return "preamble\r\n"
+           "--" + boundary + "\r\n"
+           "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+           "A walk\r\n"
+           "--" + boundary + "\r\n"
+           "Content-Disposition: form-data; name=\"gpx\"; filename=\"track.gpx\"\r\n"
+           "Content-Type: application/gpx+xml\r\n\r\n" +
+           file_data + "\r\n"
+           "--" + boundary + "--\r\n" ;
+}
+
+static string read_file(const string &path) {
+    ifstream strm(path, ios::binary) ;
+    stringstream ss ;
+    ss << strm.rdbuf() ;
+    return ss.str() ;
+}
+
+// feed the body in pieces of the given sizes, the last one repeated until the end
+static bool parse(MultipartParser &parser, const string &body, const vector<size_t> &pieces) {
+    size_t pos = 0, i = 0 ;
+    while ( pos < body.size() ) {
+        size_t n = std::min(pieces[std::min(i++, pieces.size() - 1)], body.size() - pos) ;
+        if ( !parser.parse(body.data() + pos, n) ) return false ;
+        pos += n ;
+    }
+    return true ;
+}
+
+// every split of the body in two, so that each boundary and header block is cut at every offset
+
+static void test_split_boundary() {
+    // the data contains a prefix of the delimiter, which must not end the part
+    string data = "<gpx>\r\n--" + boundary.substr(0, 10) + "</gpx>" ;
+    string body = make_body(data) ;
+
+    for( size_t split = 1 ; split < body.size() ; split++ ) {
+        MultipartParser parser(boundary, 1024, string()) ;
+
+        bool ok = parse(parser, body, { split, body.size() }) ;
+        check(ok && parser.is_complete(), "split at " + to_string(split) + ": complete") ;
+
+        Request req ;
+        parser.decode(req) ;
+        check(req.POST_.get("title") == "A walk", "split at " + to_string(split) + ": field") ;
+
+        auto it = req.FILE_.find("gpx") ;
+        check(it != req.FILE_.end() && it->second.data_ == data && it->second.size_ == data.size() &&
+              it->second.name_ == "track.gpx" && it->second.mime_ == "application/gpx+xml",
+              "split at " + to_string(split) + ": file") ;
+    }
+
+    // one byte at a time
+    MultipartParser parser(boundary, 1024, string()) ;
+    check(parse(parser, body, { 1 }) && parser.is_complete(), "byte by byte: complete") ;
+
+    Request req ;
+    parser.decode(req) ;
+    check(req.FILE_["gpx"].data_ == data, "byte by byte: file") ;
+}
+
+// files above the threshold go to a temporary file, smaller ones stay in memory
+
+static void test_spill_threshold() {
+    string small(64, 'a'), large ;
+    for( int i=0 ; i<1000 ; i++ ) large += to_string(i) + ',' ;
+
+    {
+        MultipartParser parser(boundary, small.size(), upload_dir) ;
+        check(parse(parser, make_body(small), { 7 }), "small: parsed") ;
+
+        Request req ;
+        parser.decode(req) ;
+        const Request::UploadedFile &f = req.FILE_["gpx"] ;
+        check(f.path_.empty() && f.data_ == small, "small: kept in memory") ;
+    }
+
+    {
+        MultipartParser parser(boundary, 100, upload_dir) ;
+        check(parse(parser, make_body(large), { 7 }), "large: parsed") ;
+
+        Request req ;
+        parser.decode(req) ;
+        const Request::UploadedFile &f = req.FILE_["gpx"] ;
+        check(!f.path_.empty() && f.data_.empty() && f.size_ == large.size(), "large: spilled") ;
+        check(fs::path(f.path_).parent_path() == fs::path(upload_dir), "large: in upload dir") ;
+        check(read_file(f.path_) == large, "large: file contents") ;
+    }
+}
+
+// the temporary file lives as long as the request, or the parser if the body is never completed
+
+static void test_temp_file_cleanup() {
+    string large(4096, 'x') ;
+    string body = make_body(large) ;
+    string path ;
+
+    {
+        Request req ;
+        {
+            MultipartParser parser(boundary, 100, upload_dir) ;
+            parse(parser, body, { 512 }) ;
+            parser.decode(req) ;
+        }
+
+        path = req.FILE_["gpx"].path_ ;
+        check(fs::exists(path), "cleanup: kept while the request exists") ;
+
+        // a copy of the record keeps it too
+        Request::UploadedFile copy = req.FILE_["gpx"] ;
+        req.FILE_.clear() ;
+        check(fs::exists(path), "cleanup: kept by a copy") ;
+    }
+    check(!fs::exists(path), "cleanup: removed with the request") ;
+
+    // body cut off in the middle of the file
+    {
+        MultipartParser parser(boundary, 100, upload_dir) ;
+        parser.parse(body.data(), body.size() / 2) ;
+        check(!parser.is_complete(), "cleanup: incomplete") ;
+        check(!fs::is_empty(upload_dir), "cleanup: spilled before the end of the part") ;
+    }
+    check(fs::is_empty(upload_dir), "cleanup: removed with the parser") ;
+}
+
+static void test_malformed() {
+    string body = "--" + boundary + "\r\nContent-Disposition: form-data\r\n\r\nvalue\r\n--" + boundary + "--\r\n" ;
+    MultipartParser parser(boundary, 1024, string()) ;
+    check(!parser.parse(body.data(), body.size()), "malformed: part without a name") ;
+
+    body = "--" + boundary + "xx" ;
+    MultipartParser parser2(boundary, 1024, string()) ;
+    check(!parser2.parse(body.data(), body.size()), "malformed: garbage after the boundary") ;
+}
+
+int main(int argc, char *argv[]) {
+
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("wspp-test-%%%%-%%%%") ;
+    fs::create_directory(dir) ;
+    upload_dir = dir.string() ;
+
+    test_split_boundary() ;
+    test_spill_threshold() ;
+    test_temp_file_cleanup() ;
+    test_malformed() ;
+
+    check(fs::is_empty(dir), "no temporary files left") ;
+    fs::remove_all(dir) ;
+
+    return check_result() ;
+}
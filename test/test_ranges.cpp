@@ -0,0 +1,167 @@
+#include <wspp/server/response.hpp>
+
+#include "check.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+using namespace std ;
+using namespace wspp::server ;
+using namespace wspp::test ;
+
+namespace fs = boost::filesystem ;
+
+static const string data = "0123456789abcdefghij" ; // 20 bytes
+
+// in-memory file response as set up by encodeFileData
+static Response make_response() {
+    Response resp ;
+    resp.encodeFileData(data, string(), "text/plain", 1500000000) ;
+    return resp ;
+}
+
+static Response ranged(const string &range, const string &if_range = string()) {
+    Response resp = make_response() ;
+    resp.applyRange(range, if_range) ;
+    return resp ;
+}
+
+static void test_single_ranges() {
+    Response resp = ranged("bytes=2-5") ;
+    check(resp.status_ == Response::partial_content && resp.body() == "2345", "first-last: body") ;
+    check(resp.headers_.get("Content-Range") == "bytes 2-5/20", "first-last: Content-Range") ;
+    check(resp.headers_.get("Content-Length") == "4", "first-last: Content-Length") ;
+
+    resp = ranged("bytes=15-") ;
+    check(resp.status_ == Response::partial_content && resp.body() == "fghij", "open ended") ;
+
+    resp = ranged("bytes=15-100") ;
+    check(resp.body() == "fghij" && resp.headers_.get("Content-Range") == "bytes 15-19/20", "last past the end") ;
+
+    resp = ranged("bytes=-3") ;
+    check(resp.status_ == Response::partial_content && resp.body() == "hij", "suffix: body") ;
+    check(resp.headers_.get("Content-Range") == "bytes 17-19/20", "suffix: Content-Range") ;
+
+    resp = ranged("bytes=-100") ;
+    check(resp.body() == data && resp.headers_.get("Content-Range") == "bytes 0-19/20", "suffix larger than the file") ;
+
+    // the shared body of a cached file is not modified
+    Response shared = make_response() ;
+    shared.shared_content_ = make_shared<const string>(data) ;
+    shared.content_.clear() ;
+    auto cached = shared.shared_content_ ;
+    shared.applyRange("bytes=0-1") ;
+    check(shared.body() == "01" && *cached == data, "shared body") ;
+}
+
+static void test_multiple_ranges() {
+    Response resp = ranged("bytes=0-1, 4-5,-2") ;
+    check(resp.status_ == Response::partial_content, "multiple: status") ;
+
+    string type = resp.headers_.get("Content-Type") ;
+    string prefix = "multipart/byteranges; boundary=" ;
+    check(type.compare(0, prefix.size(), prefix) == 0, "multiple: Content-Type") ;
+
+    string boundary = type.substr(prefix.size()) ;
+    string expected ;
+    const char *parts[][2] = { { "0-1/20", "01" }, { "4-5/20", "45" }, { "18-19/20", "ij" } } ;
+    for( auto &p: parts )
+        expected += "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes " + p[0] + "\r\n\r\n" + p[1] ;
+    expected += "\r\n--" + boundary + "--\r\n" ;
+
+    check(resp.body() == expected, "multiple: body") ;
+    check(resp.headers_.get("Content-Length") == to_string(expected.size()), "multiple: Content-Length") ;
+
+    // unsatisfiable ranges are left out
+    resp = ranged("bytes=50-60,0-0") ;
+    check(resp.status_ == Response::partial_content && resp.body() == "0", "multiple: unsatisfiable one dropped") ;
+}
+
+static void test_unsatisfiable_and_invalid() {
+    Response resp = ranged("bytes=20-30") ;
+    check(resp.status_ == Response::range_not_satisfiable, "unsatisfiable: status") ;
+    check(resp.headers_.get("Content-Range") == "bytes */20", "unsatisfiable: Content-Range") ;
+
+    resp = ranged("bytes=-0") ;
+    check(resp.status_ == Response::range_not_satisfiable, "empty suffix") ;
+
+    // invalid headers are ignored and the whole file is sent
+    for( const char *range: { "bytes=5-2", "items=0-1", "bytes=a-b", "bytes=1", "bytes=0-1,x" } ) {
+        resp = ranged(range) ;
+        check(resp.status_ == Response::ok && resp.body() == data, string("ignored: ") + range) ;
+    }
+
+    string many = "bytes=0-0" ;
+    for( int i=1 ; i<=16 ; i++ ) many += "," + to_string(i) + "-" + to_string(i) ;
+    resp = ranged(many) ;
+    check(resp.status_ == Response::ok, "too many ranges") ;
+
+    // only file responses advertising ranges are restricted
+    resp = Response() ;
+    resp.write(data, "text/plain") ;
+    resp.applyRange("bytes=0-1") ;
+    check(resp.status_ == Response::ok && resp.body() == data, "not a file response") ;
+}
+
+static void test_if_range() {
+    Response resp = make_response() ;
+    string etag = resp.headers_.get("Etag"), modified = resp.headers_.get("Last-Modified") ;
+
+    resp = ranged("bytes=0-1", etag) ;
+    check(resp.status_ == Response::partial_content, "If-Range: matching ETag") ;
+
+    resp = ranged("bytes=0-1", modified) ;
+    check(resp.status_ == Response::partial_content, "If-Range: matching date") ;
+
+    resp = ranged("bytes=0-1", "\"1500000000-21\"") ;
+    check(resp.status_ == Response::ok && resp.body() == data, "If-Range: other ETag") ;
+
+    resp = ranged("bytes=0-1", "W/" + etag) ;
+    check(resp.status_ == Response::ok, "If-Range: weak ETag") ;
+
+    resp = ranged("bytes=100-", "\"other\"") ;
+    check(resp.status_ == Response::ok, "If-Range: not matching wins over unsatisfiable") ;
+}
+
+// file bodies are restricted by offset, or turned into parts sent from the file
+
+static void test_file_ranges() {
+    fs::path path = fs::temp_directory_path() / fs::unique_path("wspp-test-%%%%-%%%%.txt") ;
+    {
+        ofstream strm(path.string(), ios::binary) ;
+        strm << data ;
+    }
+
+    Response resp ;
+    resp.encodeFile(path.string()) ;
+    resp.applyRange("bytes=-4") ;
+    check(resp.status_ == Response::partial_content && resp.file_.offset_ == 16 && resp.file_.length_ == 4,
+          "file: single range") ;
+
+    resp = Response() ;
+    resp.encodeFile(path.string()) ;
+    resp.applyRange("bytes=1-2,10-") ;
+    const auto &parts = resp.file_.parts_ ;
+    check(parts.size() == 2 && parts[0].offset_ == 1 && parts[0].length_ == 2 && parts[1].offset_ == 10 &&
+          parts[1].length_ == 10 && !resp.file_.trailer_.empty(), "file: multiple ranges") ;
+
+    uint64_t total = resp.file_.trailer_.size() ;
+    for( const auto &p: parts ) total += p.header_.size() + p.length_ ;
+    check(resp.headers_.get("Content-Length") == to_string(total), "file: multiple ranges Content-Length") ;
+
+    fs::remove(path) ;
+}
+
+int main(int argc, char *argv[]) {
+
+    test_single_ranges() ;
+    test_multiple_ranges() ;
+    test_unsatisfiable_and_invalid() ;
+    test_if_range() ;
+    test_file_ranges() ;
+
+    return check_result() ;
+}
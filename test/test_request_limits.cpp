@@ -0,0 +1,130 @@
+#include <wspp/server/detail/request_parser.hpp>
+#include <wspp/server/request.hpp>
+
+#include "check.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std ;
+using namespace wspp::server ;
+using namespace wspp::server::detail ;
+using namespace wspp::test ;
+
+static ServerOptions limits() {
+    ServerOptions options ;
+    options.max_body_size_ = 100 ;
+    options.max_url_size_ = 64 ;
+    options.max_header_size_ = 256 ;
+    options.max_header_count_ = 8 ;
+    return options ;
+}
+
+// Feed the message in reads of at most piece bytes through a single buffer that is overwritten by each read, as
+// the connection does. Returns the result of the last call.
+
+static boost::tribool feed(RequestParser &parser, const string &msg, size_t piece = string::npos) {
+    vector<char> buffer(std::min(piece, msg.size())) ;
+    boost::tribool result = boost::indeterminate ;
+
+    for( size_t pos = 0 ; pos < msg.size() && boost::indeterminate(result) ; ) {
+        size_t n = std::min(buffer.size(), msg.size() - pos), consumed ;
+        memcpy(buffer.data(), msg.data() + pos, n) ;
+        result = parser.parse(buffer.data(), n, consumed) ;
+        pos += n ;
+    }
+
+    return result ;
+}
+
+struct Parser {
+    Parser(const ServerOptions &options): parser_(options, storage_) {}
+
+    arena storage_ ;
+    RequestParser parser_ ;
+};
+
+static void expect_error(const ServerOptions &options, const string &msg, Response::Status status, const string &what) {
+    for( size_t piece: { string::npos, size_t(7) } ) {
+        Parser p(options) ;
+        boost::tribool result = feed(p.parser_, msg, piece) ;
+        check(bool(!result) && p.parser_.error_status() == status,
+              what + ( piece == string::npos ? "" : " (split)" ) + ": expected " + to_string((int)status) +
+              " got " + to_string((int)p.parser_.error_status())) ;
+    }
+}
+
+static void expect_ok(const ServerOptions &options, const string &msg, const string &what) {
+    for( size_t piece: { string::npos, size_t(7) } ) {
+        Parser p(options) ;
+        boost::tribool result = feed(p.parser_, msg, piece) ;
+        check(bool(result), what + ( piece == string::npos ? "" : " (split)" )) ;
+    }
+}
+
+static void test_body_size() {
+    ServerOptions options = limits() ;
+
+    expect_ok(options, "POST /form HTTP/1.1\r\nContent-Length: 100\r\n\r\n" + string(100, 'a'), "body at the limit") ;
+
+    // refused from Content-Length alone, before any of the body arrives
+    expect_error(options, "POST /form HTTP/1.1\r\nContent-Length: 101\r\n\r\n", Response::payload_too_large,
+                 "Content-Length over the limit") ;
+
+    string chunked = "POST /form HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" ;
+    expect_ok(options, chunked + "32\r\n" + string(50, 'a') + "\r\n32\r\n" + string(50, 'b') + "\r\n0\r\n\r\n",
+              "chunked body at the limit") ;
+    expect_error(options, chunked + "32\r\n" + string(50, 'a') + "\r\n33\r\n" + string(51, 'b') + "\r\n0\r\n\r\n",
+                 Response::payload_too_large, "chunked body over the limit") ;
+}
+
+static void test_url_size() {
+    ServerOptions options = limits() ;
+
+    string url = "/" + string(63, 'u') ;
+    expect_ok(options, "GET " + url + " HTTP/1.1\r\n\r\n", "url at the limit") ;
+    expect_error(options, "GET " + url + "u HTTP/1.1\r\n\r\n", Response::uri_too_long, "url over the limit") ;
+}
+
+static void test_header_limits() {
+    ServerOptions options = limits() ;
+
+    // names and values count, not the separators
+    string value(256 - 6, 'v') ;
+    expect_ok(options, "GET / HTTP/1.1\r\nCookie: " + value + "\r\n\r\n", "headers at the size limit") ;
+    expect_error(options, "GET / HTTP/1.1\r\nCookie: " + value + "v\r\n\r\n", Response::request_header_fields_too_large,
+                 "headers over the size limit") ;
+
+    string headers ;
+    for( int i=0 ; i<8 ; i++ ) headers += "X-Header-" + to_string(i) + ": " + to_string(i) + "\r\n" ;
+    expect_ok(options, "GET / HTTP/1.1\r\n" + headers + "\r\n", "header count at the limit") ;
+    expect_error(options, "GET / HTTP/1.1\r\n" + headers + "X-One-More: 1\r\n\r\n",
+                 Response::request_header_fields_too_large, "header count over the limit") ;
+}
+
+static void test_decode() {
+    ServerOptions options = limits() ;
+
+    // a request split over reads keeps its url and headers once the buffer is reused
+    Parser p(options) ;
+    string msg = "GET /a/b?x=1 HTTP/1.1\r\nHost: example.com\r\nAccept-Encoding: gzip\r\n\r\n" ;
+    check(bool(feed(p.parser_, msg, 5)), "decode: complete") ;
+
+    Request req ;
+    check(p.parser_.decode_message(req), "decode: decoded") ;
+    check(req.method_ == "GET" && req.path_ == "/a/b" && req.GET_.get("x") == "1", "decode: request line") ;
+    check(req.header("Host") == "example.com" && req.header("accept-encoding") == "gzip", "decode: headers") ;
+
+    expect_error(options, "GARBAGE\r\n\r\n", Response::bad_request, "malformed request") ;
+}
+
+int main(int argc, char *argv[]) {
+
+    test_body_size() ;
+    test_url_size() ;
+    test_header_limits() ;
+    test_decode() ;
+
+    return check_result() ;
+}
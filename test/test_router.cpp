@@ -0,0 +1,194 @@
+#include <wspp/server/router.hpp>
+#include <wspp/server/exceptions.hpp>
+
+#include "check.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+using namespace std ;
+using namespace wspp::server ;
+using namespace wspp::test ;
+
+// Records which route handled the request and with what parameters
+
+struct Recorder {
+    Router::Handler handler(const string &name) {
+        return [this, name](const Request &, Response &, const Dictionary &params) {
+            route_ = name ;
+            params_ = params ;
+        } ;
+    }
+
+    // name of the route handling method path, empty if none
+    string dispatch(const Router &router, const string &method, const string &path) {
+        route_.clear() ;
+        params_.clear() ;
+
+        Request req ;
+        req.method_ = method ;
+        req.path_ = path ;
+        Response resp ;
+        router.dispatch(req, resp) ;
+        return route_ ;
+    }
+
+    string route_ ;
+    Dictionary params_ ;
+};
+
+static void test_precedence() {
+    Recorder r ;
+
+    // when several routes match the one added first wins, as with a sequence of Request::matches tests
+    Router router ;
+    router.addRoute("GET", "/user/{id:\\d+}", r.handler("by_id")) ;
+    router.addRoute("GET", "/user/{name}", r.handler("by_name")) ;
+    router.addRoute("GET", "/user/me", r.handler("me")) ;
+    router.addRoute("GET", "/user/{name}/posts", r.handler("posts")) ;
+
+    check(r.dispatch(router, "GET", "/user/42") == "by_id" && r.params_.get("id") == "42", "precedence: regex first") ;
+    check(r.dispatch(router, "GET", "/user/bob") == "by_name" && r.params_.get("name") == "bob", "precedence: any") ;
+    check(r.dispatch(router, "GET", "/user/me") == "by_name", "precedence: earlier parameter over later literal") ;
+    check(r.dispatch(router, "GET", "/user/42/posts") == "posts" && r.params_.get("name") == "42" &&
+          !r.params_.contains("id"), "precedence: backtracks out of an earlier route") ;
+
+    Router literal_first ;
+    literal_first.addRoute("GET", "/user/me", r.handler("me")) ;
+    literal_first.addRoute("GET", "/user/{name}", r.handler("by_name")) ;
+    check(r.dispatch(literal_first, "GET", "/user/me") == "me", "precedence: earlier literal over later parameter") ;
+
+    // the same result as testing the patterns in turn with Request::matches
+    const char *patterns[] = { "/user/{id:\\d+}", "/user/{name}", "/user/me", "/user/{name}/posts" } ;
+    for( const char *path: { "/user/42", "/user/bob", "/user/me", "/user/42/posts", "/user", "/user/a/b" } ) {
+        Request req ;
+        req.method_ = "GET" ;
+        req.path_ = path ;
+
+        size_t first = 0 ;
+        while ( first < 4 && !req.matches("GET", patterns[first]) ) ++first ;
+
+        const char *names[] = { "by_id", "by_name", "by_name", "posts", "" } ;
+        check(r.dispatch(router, "GET", path) == names[first], string("precedence: same as matches for ") + path) ;
+    }
+}
+
+static void test_methods() {
+    Recorder r ;
+
+    Router router ;
+    router.addRoute("GET", "/item/{id}", r.handler("show")) ;
+    router.addRoute("POST|PUT", "/item/{id}", r.handler("update")) ;
+
+    check(r.dispatch(router, "GET", "/item/1") == "show", "methods: GET") ;
+    check(r.dispatch(router, "PUT", "/item/1") == "update", "methods: PUT") ;
+    check(r.dispatch(router, "DELETE", "/item/1").empty(), "methods: not routed") ;
+
+    Request req ;
+    req.method_ = "DELETE" ;
+    req.path_ = "/item/1" ;
+    Response resp ;
+    bool not_found = false ;
+    try {
+        router.handle(req, resp) ;
+    }
+    catch ( HttpResponseException &e ) {
+        not_found = e.code_ == Response::not_found ;
+    }
+    check(not_found, "methods: handle throws 404") ;
+}
+
+// an optional element lets the route end before it, so the elements after it are optional too
+
+static void test_optional_tails() {
+    Recorder r ;
+
+    Router router ;
+    router.addRoute("GET", "/page/{id:\\d+}?/{action}?", r.handler("page")) ;
+    router.addRoute("GET", "/archive/{year:\\d\\d\\d\\d}/{month:\\d\\d}?", r.handler("archive")) ;
+
+    check(r.dispatch(router, "GET", "/page") == "page" && r.params_.size() == 0, "optional: none") ;
+    check(r.dispatch(router, "GET", "/page/3") == "page" && r.params_.get("id") == "3" && !r.params_.contains("action"),
+          "optional: one") ;
+    check(r.dispatch(router, "GET", "/page/3/edit") == "page" && r.params_.get("action") == "edit", "optional: both") ;
+    check(r.dispatch(router, "GET", "/page/3/edit/") == "page", "optional: trailing slash") ;
+    check(r.dispatch(router, "GET", "/page/x").empty(), "optional: present but not matching") ;
+    check(r.dispatch(router, "GET", "/page/3/edit/more").empty(), "optional: too many elements") ;
+
+    check(r.dispatch(router, "GET", "/archive").empty(), "optional: required element missing") ;
+    check(r.dispatch(router, "GET", "/archive/2017") == "archive" && r.params_.get("year") == "2017", "optional: tail missing") ;
+    check(r.dispatch(router, "GET", "/archive/2017/05") == "archive" && r.params_.get("month") == "05", "optional: tail") ;
+
+    // the route pattern is recorded on the request
+    Request req ;
+    req.method_ = "GET" ;
+    req.path_ = "/archive/2017" ;
+    Response resp ;
+    router.dispatch(req, resp) ;
+    check(req.route_ == "/archive/{year:\\d\\d\\d\\d}/{month:\\d\\d}?", "route recorded on the request") ;
+}
+
+static void test_url() {
+    Recorder r ;
+
+    Router router ;
+    router.addRoute("GET", "/user/{id:\\d+}/{action}?", r.handler("user"), "user") ;
+
+    Dictionary params ;
+    params["id"] = "7" ;
+    check(router.url("user", params) == "user/7/", "url: optional left out") ;
+
+    params["action"] = "edit" ;
+    check(router.url("user", params, false) == "/user/7/edit/", "url: absolute") ;
+    check(router.url("nobody", params).empty(), "url: unknown name") ;
+}
+
+static void test_trailing_catch_all() {
+    Recorder r ;
+
+    Router router ;
+    router.addRoute("GET", "/files/{path:.*}", r.handler("files")) ;
+    router.addRoute("GET", "/docs/{page:.*}/edit", r.handler("edit")) ;
+
+    check(r.dispatch(router, "GET", "/files/a") == "files" && r.params_.get("path") == "a", "catch-all: one element") ;
+    check(r.dispatch(router, "GET", "/files/a/b/c.txt") == "files" && r.params_.get("path") == "a/b/c.txt",
+          "catch-all: rest of the path") ;
+    check(r.dispatch(router, "GET", "/docs/a/edit") == "edit" && r.params_.get("page") == "a", "catch-all: inner element") ;
+    check(r.dispatch(router, "GET", "/docs/a/b/edit").empty(), "catch-all: inner element spans one element only") ;
+
+    Request req ;
+    req.method_ = "GET" ;
+    req.path_ = "/files/a/b/c.txt" ;
+    check(req.matches("GET", "/files/{path:.*}"), "catch-all: same as matches") ;
+}
+
+static void test_invalid_regex() {
+    Recorder r ;
+
+    Router router ;
+    bool thrown = false ;
+    try {
+        router.addRoute("GET", "/tpl/{id}?/{fpath:**}", r.handler("bad"), "bad") ;
+    }
+    catch ( std::runtime_error & ) {
+        thrown = true ;
+    }
+    router.addRoute("GET", "/tpl/{name}", r.handler("good")) ;
+
+    check(thrown, "invalid regex: addRoute throws") ;
+    check(router.url("bad", Dictionary()).empty(), "invalid regex: route not named") ;
+    check(r.dispatch(router, "GET", "/tpl").empty(), "invalid regex: no trace left in the tree") ;
+    check(r.dispatch(router, "GET", "/tpl/x") == "good", "invalid regex: later routes work") ;
+}
+
+int main(int argc, char *argv[]) {
+
+    test_precedence() ;
+    test_methods() ;
+    test_optional_tails() ;
+    test_url() ;
+    test_trailing_catch_all() ;
+    test_invalid_regex() ;
+
+    return check_result() ;
+}